@@ -226,7 +226,7 @@ when the path is deep within a directory structure at the expense of
 additional RAM usage.
 
 Set to 0 to not use a path cache. */
-#define	ffconfigPATH_CACHE 0
+#define	ffconfigPATH_CACHE 1
 
 /* Only used if ffconfigPATH_CACHE is 1.
 
@@ -258,13 +258,24 @@ parameter). */
 #define	ffconfigMKDIR_RECURSIVE	 0
 
 /* Set to a function that will be used for all dynamic memory allocations.
-Setting to pvPortMalloc() will use the same memory allocator as FreeRTOS. */
-#define ffconfigMALLOC( size )	pvPortMalloc( size )
+Setting to pvPortMalloc() will use the same memory allocator as FreeRTOS.
+With FF_USE_POOL, small objects come from fixed-size pools and caches
+from a static arena (see ff_pool.h). */
+#if FF_USE_POOL
+#  include "ff_pool.h"
+#  define ffconfigMALLOC( size )	ff_pool_malloc( size )
+#else
+#  define ffconfigMALLOC( size )	pvPortMalloc( size )
+#endif
 
 /* Set to a function that matches the above allocator defined with
 ffconfigMALLOC.  Setting to vPortFree() will use the same memory free
 function as	FreeRTOS. */
-#define ffconfigFREE( ptr )  vPortFree( ptr )
+#if FF_USE_POOL
+#  define ffconfigFREE( ptr )  ff_pool_free( ptr )
+#else
+#  define ffconfigFREE( ptr )  vPortFree( ptr )
+#endif
 
 /* Set to 1 to calculate the free size and volume size as a 64-bit number.
 
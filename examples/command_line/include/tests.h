@@ -1,6 +1,8 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,6 +12,10 @@ int low_level_io_tests(const char *diskName);
 // void ls(const char *dir);
 void simple();
 void bench();
+void zbench(size_t xFrames);
+void logger_test(size_t xRecords);
+void tsbench(uint32_t ulSeconds);
+void writebuf_test(size_t xRecords);
 void big_file_test(const char *const pathname, size_t size,
                    uint32_t seed);
 void mtbft(const size_t size, const size_t parallelism,
@@ -18,6 +24,8 @@ void vCreateAndVerifyExampleFiles(const char *pcMountPath);
 void vStdioWithCWDTest(const char *pcMountPath);
 void vMultiTaskStdioWithCWDTest(const char *const pcMountPath, uint16_t usStackSizeWords);
 void data_log_demo();
+bool adc_capture(const char *pcPath, uint32_t ulSeconds, uint32_t ulSampleRate);
+uint32_t adc_capture_max_rate(void);
 
 #ifdef __cplusplus
 }
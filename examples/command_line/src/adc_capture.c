@@ -0,0 +1,351 @@
+/*
+ * adc_capture.c
+ *
+ * Continuous ADC capture to a file.
+ *
+ * The ADC runs free, and two chained DMA channels move its samples
+ * into a pool of sector-aligned buffers, so there is no gap between buffers.
+ * When a channel fills a buffer, its interrupt handler passes the buffer
+ * to the writer (this task) and reprograms the channel with the next free buffer.
+ * The writer writes each buffer straight from where the DMA put it
+ * (ff_fwrite_direct into a preallocated file) and then returns it to the free pool.
+ * If no buffer is free, the channel is pointed at a dummy word and
+ * a whole buffer's worth of samples is dropped and counted as an overrun.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+//
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "FreeRTOS_strerror.h"
+#include "queue.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_direct.h"
+#include "ff_utils.h"
+#include "my_debug.h"
+//
+#include "tests.h"
+
+#define TRACE_PRINTF(fmt, args...)
+//#define TRACE_PRINTF printf
+
+/* The longest write latency of the SD card that a capture must ride out
+(typically 100 to 250 ms while the card does housekeeping).
+The pool is sized from this and the sample rate. */
+#ifndef ADC_CAPTURE_STALL_MS
+#  define ADC_CAPTURE_STALL_MS 250
+#endif
+/* Most buffers in the pool. This caps the sample rate:
+a rate whose stall doesn't fit is rejected (see adc_capture_max_rate). */
+#ifndef ADC_CAPTURE_MAX_BUFFERS
+#  define ADC_CAPTURE_MAX_BUFFERS 12
+#endif
+/* Bytes per buffer. Must be a multiple of 512. */
+#ifndef ADC_CAPTURE_BUFFER_SIZE
+#  define ADC_CAPTURE_BUFFER_SIZE (8 * 1024)
+#endif
+/* ADC input: 0-3 are GPIO 26-29; 4 is the temperature sensor */
+#ifndef ADC_CAPTURE_INPUT
+#  define ADC_CAPTURE_INPUT 0
+#endif
+/* Can be shared with the SD card drivers */
+#ifndef ADC_CAPTURE_DMA_IRQ
+#  define ADC_CAPTURE_DMA_IRQ DMA_IRQ_1
+#endif
+
+#define IRQ_INDEX (ADC_CAPTURE_DMA_IRQ - DMA_IRQ_0)
+#define SAMPLES_PER_BUFFER (ADC_CAPTURE_BUFFER_SIZE / sizeof(uint16_t))
+#define NO_BUFFER (-1)
+/* Besides the samples that arrive during a stall:
+the two buffers the DMA channels are filling, and the one being written */
+#define BUSY_BUFFERS 3
+
+static struct {
+    uint16_t *pusBuffers[ADC_CAPTURE_MAX_BUFFERS];
+    size_t xBuffers;  // In the pool for this capture
+    QueueHandle_t xFree;  // Indexes of buffers ready for the DMA
+    QueueHandle_t xFull;  // Indexes of buffers ready for the writer, in order
+    uint uiChannels[2];
+    dma_channel_config xConfig[2];  // Writing to a buffer
+    dma_channel_config xDiscard[2]; // Writing to the dummy word
+    volatile int iCurrent[2];       // Buffer each channel is filling, or NO_BUFFER
+    volatile bool bStopping;
+    volatile uint32_t ulOverruns;   // Buffers' worth of samples dropped
+    uint16_t usDummy;
+} xCap;
+
+static void __not_in_flash_func(prvDmaHandler)(void) {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    for (size_t i = 0; i < 2; ++i) {
+        uint uiChannel = xCap.uiChannels[i];
+        if (!dma_irqn_get_channel_status(IRQ_INDEX, uiChannel)) continue;
+        dma_irqn_acknowledge_channel(IRQ_INDEX, uiChannel);
+
+        // Hand the buffer this channel just filled to the writer
+        int iDone = xCap.iCurrent[i];
+        if (NO_BUFFER != iDone)
+            xQueueSendFromISR(xCap.xFull, &iDone, &xHigherPriorityTaskWoken);
+        else if (!xCap.bStopping)
+            ++xCap.ulOverruns;
+
+        /* Set up this channel for its next turn,
+        which begins when the other channel finishes */
+        int iNext = NO_BUFFER;
+        if (xCap.bStopping ||
+            pdPASS != xQueueReceiveFromISR(xCap.xFree, &iNext, &xHigherPriorityTaskWoken))
+            iNext = NO_BUFFER;
+        xCap.iCurrent[i] = iNext;
+        if (NO_BUFFER == iNext) {
+            dma_channel_set_config(uiChannel, &xCap.xDiscard[i], false);
+            dma_channel_set_write_addr(uiChannel, &xCap.usDummy, false);
+        } else {
+            dma_channel_set_config(uiChannel, &xCap.xConfig[i], false);
+            dma_channel_set_write_addr(uiChannel, xCap.pusBuffers[iNext], false);
+        }
+        dma_channel_set_trans_count(uiChannel, SAMPLES_PER_BUFFER, false);
+    }
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+/* Buffers needed to keep capturing through an ADC_CAPTURE_STALL_MS stall */
+static size_t prvBuffersFor(uint32_t ulSampleRate) {
+    uint64_t ullStallBytes =
+        (uint64_t)ulSampleRate * sizeof(uint16_t) * ADC_CAPTURE_STALL_MS / 1000;
+    return BUSY_BUFFERS +
+           (ullStallBytes + ADC_CAPTURE_BUFFER_SIZE - 1) / ADC_CAPTURE_BUFFER_SIZE;
+}
+
+uint32_t adc_capture_max_rate(void) {
+    uint64_t ullRate = (uint64_t)(ADC_CAPTURE_MAX_BUFFERS - BUSY_BUFFERS) *
+                       ADC_CAPTURE_BUFFER_SIZE * 1000 / ADC_CAPTURE_STALL_MS /
+                       sizeof(uint16_t);
+    return ullRate < 500000 ? ullRate : 500000;
+}
+
+static bool prvAllocateBuffers(void) {
+    xCap.xFree = xQueueCreate(xCap.xBuffers, sizeof(int));
+    xCap.xFull = xQueueCreate(xCap.xBuffers, sizeof(int));
+    if (!xCap.xFree || !xCap.xFull) return false;
+    for (size_t i = 0; i < xCap.xBuffers; ++i) {
+        xCap.pusBuffers[i] = pvPortMalloc(ADC_CAPTURE_BUFFER_SIZE);
+        if (!xCap.pusBuffers[i]) return false;
+    }
+    return true;
+}
+
+static void prvSetUp(uint32_t ulSampleRate) {
+    // Buffers 0 and 1 go straight to the DMA channels; the rest are free
+    for (int i = 2; i < (int)xCap.xBuffers; ++i)
+        xQueueSend(xCap.xFree, &i, 0);
+    xCap.bStopping = false;
+    xCap.ulOverruns = 0;
+
+    adc_init();
+    if (ADC_CAPTURE_INPUT < 4)
+        adc_gpio_init(26 + ADC_CAPTURE_INPUT);
+    else
+        adc_set_temp_sensor_enabled(true);
+    adc_select_input(ADC_CAPTURE_INPUT);
+    adc_fifo_setup(true,   // Write each completed conversion to the sample FIFO
+                   true,   // Enable DMA data request (DREQ)
+                   1,      // DREQ (and IRQ) asserted when at least 1 sample present
+                   false,  // No error bit: we want plain 12-bit samples
+                   false); // Don't shift each sample to 8 bits
+    // A conversion takes 96 cycles of the 48 MHz ADC clock; the divider adds to that
+    adc_set_clkdiv((float)clock_get_hz(clk_adc) / ulSampleRate - 1);
+    adc_fifo_drain();
+    adc_hw->fcs |= ADC_FCS_OVER_BITS | ADC_FCS_UNDER_BITS;  // Write 1 to clear
+
+    xCap.uiChannels[0] = dma_claim_unused_channel(true);
+    xCap.uiChannels[1] = dma_claim_unused_channel(true);
+    for (size_t i = 0; i < 2; ++i) {
+        dma_channel_config c = dma_channel_get_default_config(xCap.uiChannels[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, DREQ_ADC);
+        channel_config_set_chain_to(&c, xCap.uiChannels[!i]);
+        xCap.xConfig[i] = c;
+        channel_config_set_write_increment(&c, false);
+        xCap.xDiscard[i] = c;
+        xCap.iCurrent[i] = i;
+        dma_channel_configure(xCap.uiChannels[i], &xCap.xConfig[i], xCap.pusBuffers[i],
+                              &adc_hw->fifo, SAMPLES_PER_BUFFER, false);
+        dma_irqn_set_channel_enabled(IRQ_INDEX, xCap.uiChannels[i], true);
+    }
+    irq_add_shared_handler(ADC_CAPTURE_DMA_IRQ, prvDmaHandler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(ADC_CAPTURE_DMA_IRQ, true);
+}
+
+/* Stop the ADC and the DMA.
+Returns the number of samples in the buffer that was being filled,
+and its index in *piPartial (or NO_BUFFER). */
+static size_t prvStop(int *piPartial) {
+    xCap.bStopping = true;
+    adc_run(false);
+    // Let the DMA take whatever is left in the FIFO
+    absolute_time_t xTimeout = make_timeout_time_ms(10);
+    while (adc_fifo_get_level() && absolute_time_diff_us(get_absolute_time(), xTimeout) > 0)
+        tight_loop_contents();
+
+    *piPartial = NO_BUFFER;
+    size_t xSamples = 0;
+    for (size_t i = 0; i < 2; ++i) {
+        uint uiChannel = xCap.uiChannels[i];
+        dma_irqn_set_channel_enabled(IRQ_INDEX, uiChannel, false);
+        if (dma_channel_is_busy(uiChannel)) {
+            *piPartial = xCap.iCurrent[i];
+            xSamples = SAMPLES_PER_BUFFER - dma_channel_hw_addr(uiChannel)->transfer_count;
+        }
+    }
+    // Break the chain before aborting so that neither channel can start the other
+    for (size_t i = 0; i < 2; ++i) {
+        channel_config_set_chain_to(&xCap.xDiscard[i], xCap.uiChannels[i]);
+        dma_channel_set_config(xCap.uiChannels[i], &xCap.xDiscard[i], false);
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        dma_channel_abort(xCap.uiChannels[i]);
+        dma_irqn_acknowledge_channel(IRQ_INDEX, xCap.uiChannels[i]);
+    }
+    if (NO_BUFFER == *piPartial) xSamples = 0;
+    adc_fifo_setup(false, false, 0, false, false);
+    adc_fifo_drain();
+    return xSamples;
+}
+
+static void prvFreeBuffers(void) {
+    for (size_t i = 0; i < xCap.xBuffers; ++i) {
+        vPortFree(xCap.pusBuffers[i]);
+        xCap.pusBuffers[i] = NULL;
+    }
+    if (xCap.xFree) vQueueDelete(xCap.xFree);
+    if (xCap.xFull) vQueueDelete(xCap.xFull);
+    xCap.xFree = xCap.xFull = NULL;
+}
+
+static void prvTearDown(void) {
+    irq_remove_handler(ADC_CAPTURE_DMA_IRQ, prvDmaHandler);
+    for (size_t i = 0; i < 2; ++i)
+        dma_channel_unclaim(xCap.uiChannels[i]);
+    prvFreeBuffers();
+}
+
+/* Capture ulSeconds of samples at ulSampleRate samples per second
+to file pcPath, as raw little-endian 16-bit samples.
+The rate must be no more than adc_capture_max_rate(),
+so that the pool can hold everything that arrives during an ADC_CAPTURE_STALL_MS stall. */
+bool adc_capture(const char *pcPath, uint32_t ulSeconds, uint32_t ulSampleRate) {
+    configASSERT(ulSampleRate);
+    xCap.xBuffers = prvBuffersFor(ulSampleRate);
+    if (xCap.xBuffers > ADC_CAPTURE_MAX_BUFFERS || ulSampleRate > 500000) {
+        EMSG_PRINTF("%s: %" PRIu32 " samples/s needs %zu buffers to ride out a %d ms stall;"
+                    " the most is %d (%" PRIu32 " samples/s)\n",
+                    __func__, ulSampleRate, xCap.xBuffers, ADC_CAPTURE_STALL_MS,
+                    ADC_CAPTURE_MAX_BUFFERS, adc_capture_max_rate());
+        return false;
+    }
+    bool bOk = true;
+
+    FF_FILE *pxFile = ff_fopen(pcPath, "w");
+    if (!pxFile) {
+        FF_FAIL("ff_fopen", pcPath);
+        return false;
+    }
+    // Reserve contiguous space so that buffers go to the card as multiple block writes
+    uint64_t ullExpected = (uint64_t)ulSampleRate * ulSeconds * sizeof(uint16_t);
+    if (ullExpected < UINT32_MAX && -1 == ff_fallocate(pxFile, ullExpected, false))
+        printf("Couldn't preallocate %" PRIu64 " bytes: %s\n", ullExpected,
+               FreeRTOS_strerror(stdioGET_ERRNO()));
+
+    if (!prvAllocateBuffers()) {
+        EMSG_PRINTF("%s: out of memory\n", __func__);
+        prvFreeBuffers();
+        ff_fclose(pxFile);
+        return false;
+    }
+    prvSetUp(ulSampleRate);
+    uint64_t ullBytes = 0;
+    uint32_t ulMaxWriteUs = 0;
+    UBaseType_t uxMinFree = xCap.xBuffers;
+
+    absolute_time_t xStart = get_absolute_time();
+    absolute_time_t xEnd = delayed_by_us(xStart, (uint64_t)ulSeconds * 1000 * 1000);
+    dma_channel_start(xCap.uiChannels[0]);
+    adc_run(true);
+
+    int iBuf;
+    while (absolute_time_diff_us(get_absolute_time(), xEnd) > 0) {
+        if (pdPASS != xQueueReceive(xCap.xFull, &iBuf, pdMS_TO_TICKS(1000))) {
+            EMSG_PRINTF("%s: no data from DMA\n", __func__);
+            bOk = false;
+            break;
+        }
+        UBaseType_t uxFree = uxQueueMessagesWaiting(xCap.xFree);
+        if (uxFree < uxMinFree) uxMinFree = uxFree;
+
+        absolute_time_t xWriteStart = get_absolute_time();
+        size_t nw = ff_fwrite_direct(xCap.pusBuffers[iBuf], 1, ADC_CAPTURE_BUFFER_SIZE, pxFile);
+        uint32_t ulWriteUs = absolute_time_diff_us(xWriteStart, get_absolute_time());
+        if (ulWriteUs > ulMaxWriteUs) ulMaxWriteUs = ulWriteUs;
+        xQueueSend(xCap.xFree, &iBuf, 0);
+        if (nw != ADC_CAPTURE_BUFFER_SIZE) {
+            FF_FAIL("ff_fwrite_direct", pcPath);
+            bOk = false;
+            break;
+        }
+        ullBytes += nw;
+    }
+    int iPartial;
+    size_t xPartialSamples = prvStop(&iPartial);
+    uint64_t ullElapsedUs = absolute_time_diff_us(xStart, get_absolute_time());
+    bool bAdcOverflow = adc_hw->fcs & ADC_FCS_OVER_BITS;
+
+    // Write whatever was captured before the stop
+    while (bOk && pdPASS == xQueueReceive(xCap.xFull, &iBuf, 0)) {
+        if (ff_fwrite_direct(xCap.pusBuffers[iBuf], 1, ADC_CAPTURE_BUFFER_SIZE, pxFile) !=
+            ADC_CAPTURE_BUFFER_SIZE) {
+            FF_FAIL("ff_fwrite_direct", pcPath);
+            bOk = false;
+        }
+        ullBytes += ADC_CAPTURE_BUFFER_SIZE;
+    }
+    if (bOk && xPartialSamples) {
+        size_t xLen = xPartialSamples * sizeof(uint16_t);
+        if (ff_fwrite_direct(xCap.pusBuffers[iPartial], 1, xLen, pxFile) != xLen) {
+            FF_FAIL("ff_fwrite_direct", pcPath);
+            bOk = false;
+        }
+        ullBytes += xLen;
+    }
+    prvTearDown();
+
+    ff_seteof(pxFile);  // Give back any unused reservation
+    if (-1 == ff_fclose(pxFile)) {
+        FF_FAIL("ff_fclose", pcPath);
+        bOk = false;
+    }
+    double dSeconds = ullElapsedUs / 1e6;
+    printf("Captured %" PRIu64 " samples in %.3f s (%.0f samples/s, %.1f KiB/s)\n",
+           ullBytes / sizeof(uint16_t), dSeconds, ullBytes / sizeof(uint16_t) / dSeconds,
+           ullBytes / 1024.0 / dSeconds);
+    printf("Overruns: %" PRIu32 " (%" PRIu32 " samples dropped)%s\n", xCap.ulOverruns,
+           xCap.ulOverruns * (uint32_t)SAMPLES_PER_BUFFER,
+           bAdcOverflow ? "; ADC FIFO overflowed" : "");
+    printf("Slowest write: %" PRIu32 " us; fewest free buffers: %u of %zu\n", ulMaxWriteUs,
+           (unsigned)uxMinFree, xCap.xBuffers);
+    return bOk && !xCap.ulOverruns && !bAdcOverflow;
+}
+
+/* [] END OF FILE */
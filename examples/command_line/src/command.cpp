@@ -15,6 +15,10 @@
 #include "FreeRTOS.h"
 #include "FreeRTOS_strerror.h"
 #include "FreeRTOS_time.h"
+#include "ff_copy.h"
+#include "ff_direct.h"
+#include "ff_dirindex.h"
+#include "ff_dirscan.h"
 #include "ff_sddisk.h"
 #include "ff_stdio.h"
 #include "ff_utils.h"
@@ -53,6 +57,25 @@ static bool expect_argc(const size_t argc, const char *argv[], const size_t expe
     }
     return true;
 }
+/* An optional positive count: the only argument, or default_count if there is none.
+Returns false, after saying why, if the argument is bad. */
+static bool parse_count(const size_t argc, const char *argv[], unsigned long default_count,
+                        const char *what, unsigned long *count_p) {
+    if (argc > 1) {
+        extra_argument_msg(argv[1]);
+        return false;
+    }
+    *count_p = default_count;
+    if (1 == argc) {
+        char *endptr;
+        *count_p = strtoul(argv[0], &endptr, 0);
+        if (*endptr || !*count_p) {
+            printf("Invalid number of %s: %s\n", what, argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
 static void run_date(const size_t argc, const char *argv[]) {
     if (!expect_argc(argc, argv, 0)) return;
 
@@ -156,6 +179,45 @@ static void run_info(const size_t argc, const char *argv[]) {
     printf("FAT Cluster size (\"allocation unit\"): %llu sectors (%llu bytes)\n",
             spc, spc * sd_card_p->state.ff_disk.pxIOManager->xPartition.usBlkSize);
 }
+static void run_cache(const size_t argc, const char *argv[]) {
+    if (argc < 1) {
+        missing_argument_msg();
+        return;
+    }
+    if (argc > 2) {
+        extra_argument_msg(argv[2]);
+        return;
+    }
+    sd_card_t *sd_card_p = sd_get_by_name(argv[0]);
+    if (!sd_card_p) {
+        printf("Unknown device name: \"%s\"\n", argv[0]);
+        return;
+    }
+    if (2 == argc) {
+        char *endptr;
+        unsigned long sectors = strtoul(argv[1], &endptr, 0);
+        if (*endptr || sectors < 2) {
+            printf("Invalid number of sectors: %s\n", argv[1]);
+            return;
+        }
+        if (sd_card_p->state.ff_disk.xStatus.bIsMounted) {
+            printf("Drive \"%s\" must be unmounted first\n", argv[0]);
+            return;
+        }
+        if (pdPASS != FF_SDDiskResizeCache(&sd_card_p->state.ff_disk, sectors, NULL))
+            EMSG_PRINTF("Resize failed!\n");
+        return;
+    }
+    sd_cache_stats_t const *stats_p = &sd_card_p->state.cache_stats;
+    printf("Cache: %zu sectors\n", sd_card_p->cache_sectors ? sd_card_p->cache_sectors : 4);
+    printf("Lookups: %lu, misses: %lu, evictions: %lu", (unsigned long)stats_p->lookups,
+           (unsigned long)stats_p->misses, (unsigned long)stats_p->evictions);
+    if (stats_p->lookups)
+        printf(", hit rate: %.1f%%",
+               100.0 * (stats_p->lookups - stats_p->misses) / stats_p->lookups);
+    printf("\nCard read requests: %lu, write requests: %lu\n", (unsigned long)stats_p->reads,
+           (unsigned long)stats_p->writes);
+}
 static void run_format(const size_t argc, const char *argv[]) {
     if (!expect_argc(argc, argv, 1)) return;
 
@@ -200,7 +262,7 @@ static void run_mkdir(const size_t argc, const char *argv[]) {
     if (!expect_argc(argc, argv, 1)) return;
     
     // int ff_mkdir( const char *pcDirectory );
-    int lResult = ff_mkdir(argv[0]);
+    int lResult = ff_di_mkdir(argv[0]);
     if (-1 == lResult)
         EMSG_PRINTF("ff_mkdir(\"%s\") failed: %s (%d)\n", argv[0],
                     FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
@@ -226,76 +288,253 @@ static void run_pwd(const size_t argc, const char *argv[]) {
         printf("%s", ret);
     }
 }
-static void run_cat(const size_t argc, const char *argv[]) {
-    if (!expect_argc(argc, argv, 1)) return;
-    
-    FF_FILE *f = ff_fopen(argv[0], "r");
+#define STREAM_BUF_SIZE 4096  // A multiple of the sector size, for multiple block reads
+#define HEX_LINE_SIZE 79
+#define HEX_LINES_PER_PUT 64
+
+/* Write straight to the stdio drivers in one call, without going through printf */
+static void put_bytes(const char *buf, size_t len) {
+#if PICO_SDK_VERSION_MAJOR < 2
+    fwrite(buf, 1, len, stdout);
+#else
+    stdio_put_string(buf, len, false, PICO_STDIO_ENABLE_CRLF_SUPPORT);
+#endif
+}
+
+/* Format a line like hexdump -C does. Returns its length. */
+static size_t hex_line(char *out, uint32_t offset, const uint8_t *data, size_t n) {
+    static const char digits[] = "0123456789abcdef";
+    char *p = out;
+    for (int shift = 28; shift >= 0; shift -= 4) *p++ = digits[(offset >> shift) & 0xF];
+    *p++ = ' ';
+    for (size_t i = 0; i < 16; ++i) {
+        if (8 == i) *p++ = ' ';
+        *p++ = ' ';
+        *p++ = i < n ? digits[data[i] >> 4] : ' ';
+        *p++ = i < n ? digits[data[i] & 0xF] : ' ';
+    }
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = '|';
+    for (size_t i = 0; i < n; ++i) *p++ = isprint(data[i]) ? data[i] : '.';
+    *p++ = '|';
+    *p++ = '\n';
+    return p - out;
+}
+
+/* Copy a file to the console, as is or as a hex dump,
+and report how fast that went (usually, the console is the bottleneck) */
+static void stream_file(const char *path, bool hex) {
+    FF_FILE *f = ff_fopen(path, "r");
     if (!f) {
         EMSG_PRINTF("ff_fopen: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
         return;
     }
-    char buf[256];
+    size_t out_size = hex ? HEX_LINE_SIZE * HEX_LINES_PER_PUT : 0;
+    uint8_t *buf = (uint8_t *)pvPortMalloc(STREAM_BUF_SIZE + out_size);
+    if (!buf) {
+        EMSG_PRINTF("pvPortMalloc(%zu) failed\n", STREAM_BUF_SIZE + out_size);
+        ff_fclose(f);
+        return;
+    }
+    char *out = (char *)buf + STREAM_BUF_SIZE;
+    stdio_flush();
+    uint64_t start = to_us_since_boot(get_absolute_time());
+    uint32_t total = 0;
+    char last = '\n';
     size_t len;
     do {
-        len = ff_fread(buf, 1, sizeof buf, f);
-        printf("%.*s", len, buf);
-    } while (len > 0);
+        stdioSET_ERRNO(0);
+        len = ff_fread_direct(buf, 1, STREAM_BUF_SIZE, f);
+        if (len < STREAM_BUF_SIZE && stdioGET_ERRNO()) {
+            EMSG_PRINTF("ff_fread_direct: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()),
+                        stdioGET_ERRNO());
+            break;
+        }
+        if (!hex) {
+            if (len) {
+                put_bytes((const char *)buf, len);
+                last = buf[len - 1];
+            }
+        } else {
+            size_t out_len = 0;
+            for (size_t i = 0; i < len; i += 16) {
+                out_len += hex_line(out + out_len, total + i, buf + i, len - i < 16 ? len - i : 16);
+                if (out_len > out_size - HEX_LINE_SIZE) {
+                    put_bytes(out, out_len);
+                    out_len = 0;
+                }
+            }
+            if (out_len) put_bytes(out, out_len);
+        }
+        total += len;
+    } while (len == STREAM_BUF_SIZE);
+    if (hex) printf("%08lx\n", (unsigned long)total);
+    stdio_flush();
+    uint64_t us = to_us_since_boot(get_absolute_time()) - start;
+    printf("%s%lu bytes in %.3f s (%.1f KiB/s)\n", '\n' == last ? "" : "\n",
+           (unsigned long)total, us / 1e6, us ? total / (us / 1e6) / 1024 : 0);
+    vPortFree(buf);
     int rc = ff_fclose(f);
     if (-1 == rc) {
         EMSG_PRINTF("ff_fclose: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
     }
 }
-static void run_cp(const size_t argc, const char *argv[]) {
-    if (!expect_argc(argc, argv, 2)) return;
-    
-    FF_FILE *sf = ff_fopen(argv[0], "r");
-    if (!sf) {
-        EMSG_PRINTF("ff_fopen: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+static void run_cat(const size_t argc, const char *argv[]) {
+    if (!expect_argc(argc, argv, 1)) return;
+
+    stream_file(argv[0], false);
+}
+static void run_hexdump(const size_t argc, const char *argv[]) {
+    if (!expect_argc(argc, argv, 1)) return;
+
+    stream_file(argv[0], true);
+}
+
+/* Directories waiting to be walked */
+typedef struct walk_dir_t {
+    struct walk_dir_t *next;
+    char path[1];
+} walk_dir_t;
+
+/* dir "/" name, or just name if dir is "" (the current directory) */
+static const char *path_sep(const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    return len && *name && '/' != dir[len - 1] ? "/" : "";
+}
+static bool walk_push(walk_dir_t **top, const char *dir, const char *name) {
+    size_t len = strlen(dir) + 1 + strlen(name);
+    walk_dir_t *d = (walk_dir_t *)pvPortMalloc(sizeof(walk_dir_t) + len);
+    if (!d) {
+        EMSG_PRINTF("pvPortMalloc(%zu) failed\n", sizeof(walk_dir_t) + len);
+        return false;
+    }
+    snprintf(d->path, len + 1, "%s%s%s", dir, path_sep(dir, name), name);
+    d->next = *top;
+    *top = d;
+    return true;
+}
+
+typedef void (*walk_fn_t)(const char *dir, const ff_ds_entry_t *entry, void *arg);
+
+/* Call fn for everything under path, with the batched directory iterator
+(only one directory is open at a time), and report how fast that went */
+static void walk(const char *path, walk_fn_t fn, void *arg) {
+    ff_ds_entry_t *entry = (ff_ds_entry_t *)pvPortMalloc(sizeof(ff_ds_entry_t));
+    if (!entry) {
+        EMSG_PRINTF("pvPortMalloc(%zu) failed\n", sizeof(ff_ds_entry_t));
         return;
     }
-    FF_FILE *df = ff_fopen(argv[1], "w");
-    if (!df) {
-        EMSG_PRINTF("ff_fopen: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
-        ff_fclose(sf);
+    walk_dir_t *top = NULL;
+    walk_push(&top, path, "");
+    uint32_t entries = 0, dirs = 0, reads = 0, sectors = 0;
+    uint64_t start = to_us_since_boot(get_absolute_time());
+    while (top) {
+        walk_dir_t *d = top;
+        top = d->next;
+        ff_ds_t *scan = ff_ds_open(d->path);
+        if (!scan) {
+            EMSG_PRINTF("ff_ds_open(\"%s\"): %s (%d)\n", d->path,
+                        FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+        } else {
+            ++dirs;
+            int rc;
+            while (1 == (rc = ff_ds_next(scan, entry))) {
+                ++entries;
+                fn(d->path, entry, arg);
+                if (entry->ucAttrib & FF_FAT_ATTR_DIR) walk_push(&top, d->path, entry->pcName);
+            }
+            if (-1 == rc)
+                EMSG_PRINTF("ff_ds_next(\"%s\"): %s (%d)\n", d->path,
+                            FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+            ff_ds_stats_t stats;
+            ff_ds_get_stats(scan, &stats);
+            reads += stats.ulReads;
+            sectors += stats.ulSectors;
+            ff_ds_close(scan);
+        }
+        vPortFree(d);
+    }
+    uint64_t us = to_us_since_boot(get_absolute_time()) - start;
+    vPortFree(entry);
+    printf("%lu entries in %lu directories in %.3f s (%.0f entries/s); %lu reads, %lu sectors\n",
+           (unsigned long)entries, (unsigned long)dirs, us / 1e6, us ? entries / (us / 1e6) : 0,
+           (unsigned long)reads, (unsigned long)sectors);
+}
+
+typedef struct {
+    uint32_t files;
+    uint64_t bytes;
+} du_totals_t;
+
+static void du_fn(const char *dir, const ff_ds_entry_t *entry, void *arg) {
+    (void)dir;
+    du_totals_t *totals = (du_totals_t *)arg;
+    if (entry->ucAttrib & FF_FAT_ATTR_DIR) return;
+    ++totals->files;
+    totals->bytes += entry->ulSize;
+}
+static void run_du(const size_t argc, const char *argv[]) {
+    if (argc > 1) {
+        extra_argument_msg(argv[1]);
         return;
     }
+    du_totals_t totals = {};
+    walk(argc ? argv[0] : "", du_fn, &totals);
+    printf("%llu bytes in %lu files\n", (unsigned long long)totals.bytes,
+           (unsigned long)totals.files);
+}
 
-    /* File copy buffer */
-    size_t buf_sz = ff_filelength(sf);
-    if (!buf_sz) {
-        EMSG_PRINTF("ff_filelength: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
-        ff_fclose(df);
-        ff_fclose(sf);
+/* Shell-style wildcards (* and ?), ignoring case like FAT does */
+static bool glob_match(const char *pattern, const char *name) {
+    for (; *pattern; ++pattern, ++name) {
+        if ('*' == *pattern) {
+            while ('*' == pattern[1]) ++pattern;
+            for (;; ++name) {
+                if (glob_match(pattern + 1, name)) return true;
+                if (!*name) return false;
+            }
+        }
+        if (!*name) return false;
+        if ('?' != *pattern && tolower((unsigned char)*pattern) != tolower((unsigned char)*name))
+            return false;
+    }
+    return !*name;
+}
+static void find_fn(const char *dir, const ff_ds_entry_t *entry, void *arg) {
+    const char *pattern = (const char *)arg;
+    if (!pattern || glob_match(pattern, entry->pcName))
+        printf("%s%s%s%s\n", dir, path_sep(dir, entry->pcName), entry->pcName,
+               entry->ucAttrib & FF_FAT_ATTR_DIR ? "/" : "");
+}
+static void run_find(const size_t argc, const char *argv[]) {
+    if (argc < 1) {
+        missing_argument_msg();
         return;
     }
-    if (buf_sz > 32768)
-        buf_sz = 32768;
-    uint8_t *buf = (uint8_t *)pvPortMalloc(buf_sz);
-    if (!buf) {
-        printf("pvPortMalloc(%zu) failed\n", buf_sz);
-        ff_fclose(df);
-        ff_fclose(sf);
+    if (argc > 2) {
+        extra_argument_msg(argv[2]);
         return;
     }
+    walk(argv[0], find_fn, (void *)(argc > 1 ? argv[1] : NULL));
+}
+static void run_cp(const size_t argc, const char *argv[]) {
+    const bool verbose = argc && 0 == strcmp("-v", argv[0]);
+    const size_t nargs = verbose ? argc - 1 : argc;
+    const char **args = verbose ? argv + 1 : argv;
+    if (!expect_argc(nargs, args, 2)) return;
 
-    size_t br;
-    do {
-        br = ff_fread(buf, 1, buf_sz, sf);
-        size_t bw = ff_fwrite(buf, 1, br, df);
-        if (br != bw) {
-            EMSG_PRINTF("ff_fwrite: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
-            break;
-        }
-    } while (br > 0);
-
-    vPortFree(buf);
-    ff_fclose(df);
-    ff_fclose(sf);
+    ff_copy_stats_t stats;
+    if (-1 == ff_copy(args[0], args[1], NULL, &stats)) {
+        EMSG_PRINTF("ff_copy: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+        return;
+    }
+    if (verbose) ff_copy_print_stats(&stats);
 }
 static void run_mv(const size_t argc, const char *argv[]) {
     if (!expect_argc(argc, argv, 2)) return;
     
-    int ec = ff_rename(argv[0], argv[1], false);
+    int ec = ff_di_rename(argv[0], argv[1], false);
     if (-1 == ec) {
         EMSG_PRINTF("ff_fwrite: %s (%d)\n", FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
     }
@@ -354,12 +593,14 @@ static void run_rm(const size_t argc, const char *argv[]) {
                             EMSG_PRINTF("ff_deltree(\"%s\") failed.\n", xFindStruct.pcFileName);
                     } while (ff_findnext(&xFindStruct) == 0);
                 }
+                ff_di_invalidate(NULL);
             } else {
                 int rc = ff_deltree(argv[1]);
                 if (-1 == rc) EMSG_PRINTF("ff_deltree(\"%s\") failed.\n", argv[1]);
+                ff_di_invalidate(argv[1]);
             }
         } else if (0 == strcmp("-d", argv[0])) {
-            int rc = ff_rmdir(argv[1]);
+            int rc = ff_di_rmdir(argv[1]);
             if (-1 == rc)
                 EMSG_PRINTF("ff_rmdir(\"%s\") failed: %s (%d)\n", argv[1],
                             FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
@@ -367,7 +608,7 @@ static void run_rm(const size_t argc, const char *argv[]) {
             EMSG_PRINTF("Unknown option: %s\n", argv[0]);
         }
     } else {
-        int rc = ff_remove(argv[0]);
+        int rc = ff_di_remove(argv[0]);
         if (-1 == rc)
             EMSG_PRINTF("ff_remove(\"%s\") failed: %s (%d)\n", argv[0],
                         FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
@@ -383,6 +624,26 @@ static void run_bench(const size_t argc, const char *argv[]) {
     
     bench();
 }
+static void run_zbench(const size_t argc, const char *argv[]) {
+    unsigned long frames;
+    if (!parse_count(argc, argv, 65536, "frames", &frames)) return;
+    zbench(frames);
+}
+static void run_tsbench(const size_t argc, const char *argv[]) {
+    unsigned long seconds;
+    if (!parse_count(argc, argv, 86400, "seconds", &seconds)) return;
+    tsbench(seconds);
+}
+static void run_logtest(const size_t argc, const char *argv[]) {
+    unsigned long records;
+    if (!parse_count(argc, argv, 100000, "records", &records)) return;
+    logger_test(records);
+}
+static void run_wbtest(const size_t argc, const char *argv[]) {
+    unsigned long records;
+    if (!parse_count(argc, argv, 100000, "records", &records)) return;
+    writebuf_test(records);
+}
 static void run_cvef(const size_t argc, const char *argv[]) {
     if (!expect_argc(argc, argv, 0)) return;
     
@@ -429,6 +690,31 @@ static void run_start_logger(const size_t argc, const char *argv[]) {
     
     data_log_demo();
 }
+static void run_capture(const size_t argc, const char *argv[]) {
+    if (argc < 2) {
+        missing_argument_msg();
+        return;
+    }
+    if (argc > 3) {
+        extra_argument_msg(argv[3]);
+        return;
+    }
+    char *endptr;
+    unsigned long seconds = strtoul(argv[1], &endptr, 0);
+    if (*endptr || !seconds) {
+        printf("Invalid number of seconds: %s\n", argv[1]);
+        return;
+    }
+    unsigned long rate = adc_capture_max_rate();
+    if (3 == argc) {
+        rate = strtoul(argv[2], &endptr, 0);
+        if (*endptr || !rate) {
+            printf("Invalid sample rate: %s\n", argv[2]);
+            return;
+        }
+    }
+    adc_capture(argv[0], seconds, rate);
+}
 static void run_die(const size_t argc, const char *argv[]) {
     if (!expect_argc(argc, argv, 0)) return;
     
@@ -603,6 +889,11 @@ static cmd_def_t cmds[] = {
     {"info", run_info,
      "info <device name>:\n"
      " Print information about an SD card"},
+    {"cache", run_cache,
+     "cache <device name> [sectors]:\n"
+     " Show IO manager cache statistics for a device,\n"
+     " or, if [sectors] is given, resize its cache (the drive must be unmounted).\n"
+     "\te.g.: cache sd0 16"},
     {"cd", run_cd,
      "cd <path>:\n"
      " Changes the current directory.\n"
@@ -621,8 +912,9 @@ static cmd_def_t cmds[] = {
      " -d Remove an empty directory\n"
      " -r Recursively remove a directory and its contents"},
     {"cp", run_cp,
-     "cp <source file> <dest file>:\n"
-     " Copies <source file> to <dest file>"},
+     "cp [-v] <source file> <dest file>:\n"
+     " Copies <source file> to <dest file>\n"
+     "  -v Show the time spent reading and writing"},
     {"mv", run_mv,
      "mv <source file> <dest file>:\n"
      " Moves (renames) <source file> to <dest file>"},
@@ -632,12 +924,37 @@ static cmd_def_t cmds[] = {
     {"ls", run_ls, "ls [pathname]:\n List directory"},
     // {"dir", run_ls, "dir:\n List directory"},
     {"cat", run_cat, "cat <filename>:\n Type file contents"},
+    {"hexdump", run_hexdump, "hexdump <filename>:\n Show file contents in hexadecimal and ASCII"},
+    {"du", run_du,
+     "du [directory]:\n"
+     " Total the sizes of the files in [directory] and everything under it"},
+    {"find", run_find,
+     "find <directory> [pattern]:\n"
+     " List everything under <directory>, or only names matching [pattern] (with * and ?)"},
     {"simple", run_simple, "simple:\n Run simple FS tests"},
     {"lliot", run_lliot,
      "lliot <device name>\n !DESTRUCTIVE! Low Level I/O Driver Test\n"
      "The SD card will need to be reformatted after this test.\n"
      "\te.g.: lliot sd0"},
     {"bench", run_bench, "bench <device name>:\n A simple binary write/read benchmark"},
+    {"zbench", run_zbench,
+     "zbench [frames]:\n"
+     " Compare writing telemetry raw and compressed (ff_zstream)\n"
+     " in the current working directory. The default is 65536 frames of 4 samples."},
+    {"tsbench", run_tsbench,
+     "tsbench [seconds]:\n"
+     " Write [seconds] of once a second samples to a time series (ff_tseries)\n"
+     " in the current working directory, and time queries of it.\n"
+     " The default is 86400 (a day)."},
+    {"logtest", run_logtest,
+     "logtest [records]:\n"
+     " Log 32-byte records through ff_logger into directory logtest, rotating every 32 KiB,\n"
+     " then read them back and check them. The default is 100000 records."},
+    {"wbtest", run_wbtest,
+     "wbtest [records]:\n"
+     " Write 64-byte records at 500 KiB/s through ff_writebuf to wbtest.bin\n"
+     " in the current working directory, print the write buffer statistics,\n"
+     " then read the records back and check them. The default is 100000 records."},
     {"big_file_test", run_big_file_test,
      "big_file_test <pathname> <size in MiB> <seed>:\n"
      " Writes random data to file <pathname>.\n"
@@ -667,6 +984,12 @@ static cmd_def_t cmds[] = {
     {"start_logger", run_start_logger,
      "start_logger:\n"
      " Start Data Log Demo"},
+    {"capture", run_capture,
+     "capture <filename> <seconds> [samples per second]:\n"
+     " Capture the ADC to a file with DMA\n"
+     " The default rate is the highest that the buffer pool can keep up\n"
+     " through a 250 ms SD card stall (147456 samples per second).\n"
+     "\te.g.: capture adc.bin 10"},
     {"die", run_die,
      "die:\n Kill background tasks"},
     {"undie", run_undie,
@@ -22,6 +22,8 @@ specific language governing permissions and limitations under the License.
 #include "pico/util/datetime.h"
 //
 #include "command.h"
+#include "ff_sddisk.h"
+#include "my_debug.h"
 #include "sd_card.h"
 #include "task_config.h"
 #include "unmounter.h"
@@ -69,6 +71,13 @@ static void callback(void *ptr) {
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
+static void init_cards_task(void *arg) {
+    (void)arg;
+    size_t n = FF_SDDiskInitAll();
+    DBG_PRINTF("%zu SD cards initialized\n", n);
+    vTaskDelete(NULL);
+}
+
 /**
  * \brief stdioTask - the function which handles input
  *
@@ -104,6 +113,10 @@ static void stdioTask(void *arg) {
     sd_init_driver();
     unmounter_init();
 
+    // Identify the cards in the background, all at once, so that the first mount is quicker.
+    // Nothing waits for this unless a card is mounted before it's done.
+    xTaskCreate(init_cards_task, "init cards", 1024, NULL, PRIORITY_initCardsTask, NULL);
+
     // Get notified when there are input characters available
     stdio_set_chars_available_callback(callback, xTaskGetCurrentTaskHandle());
 
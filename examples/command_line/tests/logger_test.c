@@ -0,0 +1,186 @@
+/*
+ * logger_test.c
+ *
+ * Log numbered records through ff_logger, with small files so that it rotates
+ * often, and then read all of the files back and check that every record
+ * accepted is there, once, in order, and that nothing is left past the end of each file.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "FreeRTOS_strerror.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_dirindex.h"
+#include "ff_logger.h"
+#include "my_debug.h"
+//
+#include "tests.h"
+
+#define DIRECTORY "logtest"
+#define STEM "LOG"
+#define EXT "BIN"
+
+typedef struct {
+    uint32_t ulSeq;
+    uint32_t ulCheck;  // ~ulSeq
+    uint8_t pucPad[24];
+} record_t;
+
+static uint64_t micros() {
+    return to_us_since_boot(get_absolute_time());
+}
+
+/* Read the files back, starting at number ulFirst.
+Returns the number of files, or -1 if anything is wrong. */
+static int prvVerify(uint32_t ulFirst, uint32_t ulAccepted, const uint8_t *pucAccepted) {
+    static record_t xRecords[512 / sizeof(record_t)];
+    uint32_t ulNext = 0;  // Next sequence number expected
+    uint32_t ulFound = 0;
+    int iFiles = 0;
+    char pcPath[32];
+    for (uint32_t ulNumber = ulFirst;; ++ulNumber, ++iFiles) {
+        snprintf(pcPath, sizeof pcPath, "%s/%s%05lu.%s", DIRECTORY, STEM, (unsigned long)ulNumber,
+                 EXT);
+        FF_FILE *pxFile = ff_fopen(pcPath, "r");
+        if (!pxFile) break;
+        const uint32_t ulSize = ff_filelength(pxFile);
+        // The preallocation must have been given back: no clusters past the end of the data
+        const uint32_t ulClusterSize = pxFile->pxIOManager->xPartition.ulSectorsPerCluster *
+                                       pxFile->pxIOManager->xPartition.usBlkSize;
+        uint32_t ulEnd;
+        FF_Error_t xError = FF_ERR_NONE;
+        uint32_t ulClusters = pxFile->ulObjectCluster
+                                  ? FF_GetChainLength(pxFile->pxIOManager, pxFile->ulObjectCluster,
+                                                      &ulEnd, &xError)
+                                  : 0;
+        if (FF_isERR(xError) || ulClusters != (ulSize + ulClusterSize - 1) / ulClusterSize) {
+            EMSG_PRINTF("%s: %lu bytes in %lu clusters\n", pcPath, (unsigned long)ulSize,
+                        (unsigned long)ulClusters);
+            ff_fclose(pxFile);
+            return -1;
+        }
+        if (ulSize % sizeof(record_t)) {
+            EMSG_PRINTF("%s: %lu bytes is not a whole number of records\n", pcPath,
+                        (unsigned long)ulSize);
+            ff_fclose(pxFile);
+            return -1;
+        }
+        size_t xRead;
+        while ((xRead = ff_fread(xRecords, sizeof(record_t), count_of(xRecords), pxFile))) {
+            for (size_t i = 0; i < xRead; ++i) {
+                const record_t *pxRecord = &xRecords[i];
+                // Skip the ones that were dropped
+                while (ulNext < ulAccepted && !(pucAccepted[ulNext / 8] & (1 << ulNext % 8)))
+                    ++ulNext;
+                if (pxRecord->ulSeq != ulNext || pxRecord->ulCheck != ~ulNext) {
+                    EMSG_PRINTF("%s: expected record %lu, found %lu\n", pcPath,
+                                (unsigned long)ulNext, (unsigned long)pxRecord->ulSeq);
+                    ff_fclose(pxFile);
+                    return -1;
+                }
+                ++ulNext;
+                ++ulFound;
+            }
+        }
+        ff_fclose(pxFile);
+    }
+    uint32_t ulExpected = 0;
+    for (uint32_t i = 0; i < ulAccepted; ++i)
+        if (pucAccepted[i / 8] & (1 << i % 8)) ++ulExpected;
+    if (ulFound != ulExpected) {
+        EMSG_PRINTF("Found %lu records; expected %lu\n", (unsigned long)ulFound,
+                    (unsigned long)ulExpected);
+        return -1;
+    }
+    return iFiles;
+}
+
+static void prvRemove(uint32_t ulFirst) {
+    char pcPath[32];
+    for (uint32_t ulNumber = ulFirst;; ++ulNumber) {
+        snprintf(pcPath, sizeof pcPath, "%s/%s%05lu.%s", DIRECTORY, STEM, (unsigned long)ulNumber,
+                 EXT);
+        if (ff_di_remove(pcPath)) break;
+    }
+}
+
+/* Log xRecords records of 32 bytes as fast as they can be taken */
+void logger_test(size_t xRecords) {
+    uint8_t *pucAccepted = pvPortMalloc((xRecords + 7) / 8);
+    if (!pucAccepted) {
+        EMSG_PRINTF("%s: out of memory\n", __func__);
+        return;
+    }
+    memset(pucAccepted, 0, (xRecords + 7) / 8);
+
+    char pcPath[32];
+    if (-1 == ff_di_mkdir(DIRECTORY) && pdFREERTOS_ERRNO_EEXIST != stdioGET_ERRNO()) {
+        FF_FAIL("ff_di_mkdir", DIRECTORY);
+        vPortFree(pucAccepted);
+        return;
+    }
+    // The number the logger's first file will get
+    int iFirst = ff_di_next_name(DIRECTORY, STEM, EXT, pcPath, sizeof pcPath);
+    if (-1 == iFirst) {
+        FF_FAIL("ff_di_next_name", DIRECTORY);
+        vPortFree(pucAccepted);
+        return;
+    }
+    UBaseType_t uxPriority = uxTaskPriorityGet(NULL) + 1;
+    if (uxPriority >= configMAX_PRIORITIES) uxPriority = configMAX_PRIORITIES - 1;
+    const ff_logger_config_t xConfig = {
+        .pcDirectory = DIRECTORY,
+        .pcNamePattern = STEM "." EXT,
+        .xRingSize = 16 * 1024,
+        .xChunkSize = 4096,
+        .xPreallocate = 64 * 1024,
+        .xMaxFileSize = 32 * 1024,  // Small, to rotate often
+        .ulCommitMs = 250,
+        .uxPriority = uxPriority,
+    };
+    ff_logger_t *pxLogger = ff_logger_start(&xConfig);
+    if (!pxLogger) {
+        EMSG_PRINTF("%s: ff_logger_start failed\n", __func__);
+        vPortFree(pucAccepted);
+        return;
+    }
+    record_t xRecord;
+    memset(&xRecord, 0xA5, sizeof xRecord);
+    uint64_t ullStart = micros();
+    for (uint32_t i = 0; i < xRecords; ++i) {
+        xRecord.ulSeq = i;
+        xRecord.ulCheck = ~i;
+        if (ff_logger_write(pxLogger, &xRecord, sizeof xRecord))
+            pucAccepted[i / 8] |= 1 << i % 8;
+        if (0 == i % 64) taskYIELD();
+    }
+    uint64_t ullLogUs = micros() - ullStart;
+
+    // The logger is freed when it stops, so get the stats first
+    ff_logger_stats_t xStats;
+    ff_logger_get_stats(pxLogger, &xStats);
+    ullStart = micros();
+    ff_logger_stop(pxLogger);
+    uint64_t ullStopUs = micros() - ullStart;
+
+    printf("Records: %lu accepted, %lu dropped (%.1f ms to log, %.1f ms to stop)\n",
+           (unsigned long)xStats.ulRecords, (unsigned long)xStats.ulDroppedRecords,
+           ullLogUs / 1e3, ullStopUs / 1e3);
+    printf("Ring high water: %zu of %zu bytes; longest chunk write: %.1f ms\n",
+           xStats.xRingHighWater, xConfig.xRingSize, xStats.ulMaxChunkWriteUs / 1e3);
+    int iFiles = prvVerify(iFirst, xRecords, pucAccepted);
+    if (iFiles >= 0) printf("Verified %d files\n", iFiles);
+    prvRemove(iFirst);
+    vPortFree(pucAccepted);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,176 @@
+/*
+ * tsbench.c
+ *
+ * Write a day of once a second samples to an ff_tseries file,
+ * then time queries of a minute, an hour, and the whole day, with and without the index,
+ * checking that each returns exactly the records in its range.
+ * Also check that a query for a time that repeats across blocks finds every record.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "FreeRTOS_strerror.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_tseries.h"
+#include "my_debug.h"
+//
+#include "tests.h"
+
+#define PATH "tsbench.ts"
+#define DUP_PATH "tsdup.ts"
+#define BLOCK_SIZE 4096
+#define BUFFER_BLOCKS 8
+#define T0 1700000000000LL  // ms since the epoch
+#define QUERIES 32
+
+typedef struct {
+    uint32_t ulSecond;  // Seconds since T0
+    float fTemp;
+    float fVolts;
+    float fAmps;
+} sample_t;
+
+typedef struct {
+    int64_t llFrom, llTo;
+    long lCount;
+    bool bOk;
+} check_t;
+
+static uint64_t micros() {
+    return to_us_since_boot(get_absolute_time());
+}
+
+static bool prvCheck(int64_t llTime, const void *pvRecord, void *pvArg) {
+    check_t *pxCheck = pvArg;
+    sample_t xSample;
+    memcpy(&xSample, pvRecord, sizeof xSample);
+    if (llTime < pxCheck->llFrom || llTime > pxCheck->llTo ||
+        llTime != T0 + (int64_t)xSample.ulSecond * 1000)
+        pxCheck->bOk = false;
+    ++pxCheck->lCount;
+    return true;
+}
+
+static bool prvWrite(uint32_t ulSeconds) {
+    ff_ts_writer_t *pxWriter = ff_ts_create(PATH, sizeof(sample_t), BLOCK_SIZE);
+    if (!pxWriter) {
+        FF_FAIL("ff_ts_create", PATH);
+        return false;
+    }
+    uint64_t ullStart = micros();
+    for (uint32_t i = 0; i < ulSeconds; ++i) {
+        sample_t xSample = {i, 20.0f + (i % 600) / 100.0f, 3.3f, 0.1f};
+        if (ff_ts_append(pxWriter, T0 + (int64_t)i * 1000, &xSample)) {
+            FF_FAIL("ff_ts_append", PATH);
+            ff_ts_close(pxWriter);
+            return false;
+        }
+    }
+    if (ff_ts_close(pxWriter)) {
+        FF_FAIL("ff_ts_close", PATH);
+        return false;
+    }
+    printf("Wrote %lu records in %.1f ms\n", (unsigned long)ulSeconds,
+           (micros() - ullStart) / 1e3);
+    return true;
+}
+
+/* Time QUERIES queries of ulSpan seconds at random, and check them */
+static bool prvQueries(uint32_t ulSeconds, uint32_t ulSpan, const char *pcLabel) {
+    ff_ts_reader_t *pxReader = ff_ts_open(PATH, BUFFER_BLOCKS);
+    if (!pxReader) {
+        FF_FAIL("ff_ts_open", PATH);
+        return false;
+    }
+    if (ulSpan > ulSeconds) ulSpan = ulSeconds;
+    size_t xQueries = ulSpan == ulSeconds ? 1 : QUERIES;
+    uint64_t ullUs = 0, ullMaxUs = 0;
+    bool bOk = true;
+    for (size_t i = 0; bOk && i < xQueries; ++i) {
+        uint32_t ulStart = ulSpan == ulSeconds ? 0 : rand() % (ulSeconds - ulSpan + 1);
+        check_t xCheck = {T0 + (int64_t)ulStart * 1000,
+                          T0 + (int64_t)(ulStart + ulSpan) * 1000 - 1, 0, true};
+        uint64_t ullStart = micros();
+        long lVisited = ff_ts_query(pxReader, xCheck.llFrom, xCheck.llTo, prvCheck, &xCheck);
+        uint64_t ullThisUs = micros() - ullStart;
+        ullUs += ullThisUs;
+        if (ullThisUs > ullMaxUs) ullMaxUs = ullThisUs;
+        if (lVisited != (long)ulSpan || xCheck.lCount != (long)ulSpan || !xCheck.bOk) {
+            EMSG_PRINTF("%s query from second %lu: %ld records; expected %lu\n", pcLabel,
+                        (unsigned long)ulStart, lVisited, (unsigned long)ulSpan);
+            bOk = false;
+        }
+    }
+    ff_ts_close_reader(pxReader);
+    if (bOk)
+        printf("%-24s %6zu %10.2f %10.2f\n", pcLabel, xQueries, ullUs / 1e3 / xQueries,
+               ullMaxUs / 1e3);
+    return bOk;
+}
+
+/* Records with the same time, spanning several blocks */
+static bool prvRepeats() {
+    const uint32_t ulRecords = 3 * BLOCK_SIZE / (sizeof(uint32_t) + sizeof(sample_t));
+    ff_ts_writer_t *pxWriter = ff_ts_create(DUP_PATH, sizeof(sample_t), BLOCK_SIZE);
+    if (!pxWriter) {
+        FF_FAIL("ff_ts_create", DUP_PATH);
+        return false;
+    }
+    bool bOk = true;
+    for (uint32_t i = 0; bOk && i < ulRecords + 10; ++i) {
+        // Ten at T0, the rest at T0 + 1 s, so the repeats start partway through block 0
+        uint32_t ulSecond = i < 10 ? 0 : 1;
+        sample_t xSample = {ulSecond, 0, 0, 0};
+        bOk = 0 == ff_ts_append(pxWriter, T0 + ulSecond * 1000, &xSample);
+    }
+    if (ff_ts_close(pxWriter)) bOk = false;
+    ff_ts_reader_t *pxReader = NULL;
+    if (!bOk)
+        FF_FAIL("ff_ts_append", DUP_PATH);
+    else if (!(pxReader = ff_ts_open(DUP_PATH, BUFFER_BLOCKS)))
+        FF_FAIL("ff_ts_open", DUP_PATH);
+    if (pxReader) {
+        check_t xCheck = {T0 + 1000, T0 + 1000, 0, true};
+        long lVisited = ff_ts_query(pxReader, xCheck.llFrom, xCheck.llTo, prvCheck, &xCheck);
+        ff_ts_close_reader(pxReader);
+        if (lVisited != (long)ulRecords || !xCheck.bOk) {
+            EMSG_PRINTF("Query for a repeated time: %ld records; expected %lu\n", lVisited,
+                        (unsigned long)ulRecords);
+            bOk = false;
+        }
+    } else {
+        bOk = false;
+    }
+    ff_remove(DUP_PATH);
+    ff_remove(DUP_PATH ".idx");
+    if (bOk) printf("Query for a time repeated across blocks: OK\n");
+    return bOk;
+}
+
+/* Write ulSeconds of once a second samples and query them */
+void tsbench(uint32_t ulSeconds) {
+    if (prvWrite(ulSeconds)) {
+        printf("%-24s %6s %10s %10s\n", "Query", "Count", "Avg ms", "Max ms");
+        if (prvQueries(ulSeconds, 60, "Minute") && prvQueries(ulSeconds, 3600, "Hour") &&
+            prvQueries(ulSeconds, ulSeconds, "All")) {
+            // Again, searching the block headers instead of the index
+            ff_remove(PATH ".idx");
+            if (prvQueries(ulSeconds, 60, "Minute, no index") && 0 == ff_ts_reindex(PATH))
+                prvQueries(ulSeconds, 60, "Minute, reindexed");
+        }
+    }
+    prvRepeats();
+    ff_remove(PATH);
+    ff_remove(PATH ".idx");
+}
+
+/* [] END OF FILE */
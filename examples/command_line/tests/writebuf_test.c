@@ -0,0 +1,129 @@
+/*
+ * writebuf_test.c
+ *
+ * Write numbered records at a steady rate through ff_writebuf,
+ * print the write buffer's statistics (high water mark, stalls, drops),
+ * and then read the file back and check that every record accepted is there, once, in order.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "FreeRTOS_strerror.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_writebuf.h"
+#include "my_debug.h"
+//
+#include "tests.h"
+
+#define PATH "wbtest.bin"
+#define RECORDS_PER_TICK 8  // 512 bytes a tick: 500 KiB/s at 1000 ticks a second
+
+typedef struct {
+    uint32_t ulSeq;
+    uint32_t ulCheck;  // ~ulSeq
+    uint8_t pucPad[56];
+} record_t;
+
+static uint64_t micros() {
+    return to_us_since_boot(get_absolute_time());
+}
+
+/* Read the file back. Returns false if anything is wrong. */
+static bool prvVerify(uint32_t ulAccepted) {
+    static record_t xRecords[512 / sizeof(record_t)];
+    FF_FILE *pxFile = ff_fopen(PATH, "r");
+    if (!pxFile) {
+        FF_FAIL("ff_fopen", PATH);
+        return false;
+    }
+    uint32_t ulFound = 0;
+    int64_t llLast = -1;  // Sequence number of the last record found
+    size_t xRead;
+    bool bOk = true;
+    while (bOk && (xRead = ff_fread(xRecords, sizeof(record_t), count_of(xRecords), pxFile))) {
+        for (size_t i = 0; i < xRead; ++i) {
+            const record_t *pxRecord = &xRecords[i];
+            // Dropped records leave gaps, but the rest must be in order
+            if ((int64_t)pxRecord->ulSeq <= llLast || pxRecord->ulCheck != ~pxRecord->ulSeq) {
+                EMSG_PRINTF("Record %lu: found %lu after %lld\n", (unsigned long)ulFound,
+                            (unsigned long)pxRecord->ulSeq, llLast);
+                bOk = false;
+                break;
+            }
+            llLast = pxRecord->ulSeq;
+            ++ulFound;
+        }
+    }
+    if (bOk && ff_filelength(pxFile) % sizeof(record_t)) {
+        EMSG_PRINTF("%lu bytes is not a whole number of records\n",
+                    (unsigned long)ff_filelength(pxFile));
+        bOk = false;
+    }
+    ff_fclose(pxFile);
+    if (bOk && ulFound != ulAccepted) {
+        EMSG_PRINTF("Found %lu records; expected %lu\n", (unsigned long)ulFound,
+                    (unsigned long)ulAccepted);
+        bOk = false;
+    }
+    return bOk;
+}
+
+/* Write xRecords records of 64 bytes, RECORDS_PER_TICK every tick */
+void writebuf_test(size_t xRecords) {
+    FF_FILE *pxFile = ff_fopen(PATH, "w");
+    if (!pxFile) {
+        FF_FAIL("ff_fopen", PATH);
+        return;
+    }
+    UBaseType_t uxPriority = uxTaskPriorityGet(NULL) + 1;
+    if (uxPriority >= configMAX_PRIORITIES) uxPriority = configMAX_PRIORITIES - 1;
+    const ff_writebuf_config_t xConfig = {
+        .xBufferSize = 32 * 1024,
+        .xChunkSize = 4096,
+        .xMaxBlock = pdMS_TO_TICKS(5),  // Then a record that doesn't fit is dropped
+        .xIdleFlush = pdMS_TO_TICKS(100),
+        .ulStallMs = 50,
+        .uxPriority = uxPriority,
+    };
+    ff_writebuf_t *pxWb = ff_writebuf_open(pxFile, &xConfig);
+    if (!pxWb) {
+        EMSG_PRINTF("%s: ff_writebuf_open failed\n", __func__);
+        ff_fclose(pxFile);
+        return;
+    }
+    record_t xRecord;
+    memset(&xRecord, 0x5A, sizeof xRecord);
+    uint32_t ulAccepted = 0;
+    TickType_t xLastWake = xTaskGetTickCount();
+    uint64_t ullStart = micros();
+    for (uint32_t i = 0; i < xRecords; ++i) {
+        xRecord.ulSeq = i;
+        xRecord.ulCheck = ~i;
+        if (ff_writebuf_write(pxWb, &xRecord, sizeof xRecord)) ++ulAccepted;
+        if (RECORDS_PER_TICK - 1 == i % RECORDS_PER_TICK) vTaskDelayUntil(&xLastWake, 1);
+    }
+    uint64_t ullWriteUs = micros() - ullStart;
+    if (!ff_writebuf_flush(pxWb, portMAX_DELAY)) EMSG_PRINTF("ff_writebuf_flush timed out\n");
+
+    printf("Wrote %zu records in %.1f ms\n", xRecords, ullWriteUs / 1e3);
+    ff_writebuf_print_stats(pxWb);
+    bool bOk = ff_writebuf_close(pxWb);
+    if (!bOk) EMSG_PRINTF("ff_writebuf_close: data was lost\n");
+    if (-1 == ff_fclose(pxFile)) {
+        FF_FAIL("ff_fclose", PATH);
+        bOk = false;
+    }
+    if (bOk && prvVerify(ulAccepted)) printf("Verified %lu records\n", (unsigned long)ulAccepted);
+    ff_remove(PATH);
+}
+
+/* [] END OF FILE */
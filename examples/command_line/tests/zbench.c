@@ -0,0 +1,182 @@
+/*
+ * zbench.c
+ *
+ * Compare writing telemetry raw with writing it through ff_zstream:
+ * bytes written, CPU time spent compressing, and time spent writing.
+ * Then read the compressed file back, sequentially and at random, to check it.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "FreeRTOS_strerror.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_direct.h"
+#include "ff_zstream.h"
+#include "my_debug.h"
+//
+#include "tests.h"
+
+#define CHANNELS 4
+#define CHUNK_FRAMES 256  // 4 KiB of raw samples
+#define BLOCK_SIZE 4096
+
+static uint64_t micros() {
+    return to_us_since_boot(get_absolute_time());
+}
+
+/* Something like slow telemetry: a temperature that drifts, a noisy voltage,
+a triangle wave, and a counter */
+typedef struct {
+    uint32_t ulSeed;
+    uint64_t ullFrame;
+    int32_t lTemp;
+} gen_t;
+
+static uint32_t prvRand(gen_t *pxGen) {
+    pxGen->ulSeed = pxGen->ulSeed * 1664525 + 1013904223;
+    return pxGen->ulSeed >> 16;
+}
+
+static void prvGenerate(gen_t *pxGen, int32_t *plSamples, size_t xFrames) {
+    for (size_t i = 0; i < xFrames; ++i, ++pxGen->ullFrame) {
+        if (0 == prvRand(pxGen) % 64) pxGen->lTemp += (int32_t)(prvRand(pxGen) % 3) - 1;
+        *plSamples++ = 2500 + pxGen->lTemp;
+        *plSamples++ = 3300000 + (int32_t)(prvRand(pxGen) % 64) - 32;
+        int32_t lPhase = pxGen->ullFrame % 2048;
+        *plSamples++ = lPhase < 1024 ? lPhase : 2048 - lPhase;
+        *plSamples++ = (int32_t)pxGen->ullFrame;
+    }
+}
+
+static bool prvRaw(const char *pcPath, int32_t *plSamples, size_t xChunks, uint64_t *pullUs) {
+    FF_FILE *pxFile = ff_fopen(pcPath, "w");
+    if (!pxFile) {
+        FF_FAIL("ff_fopen", pcPath);
+        return false;
+    }
+    gen_t xGen = {.ulSeed = 1};
+    *pullUs = 0;
+    for (size_t i = 0; i < xChunks; ++i) {
+        prvGenerate(&xGen, plSamples, CHUNK_FRAMES);
+        uint64_t ullStart = micros();
+        size_t xLen = CHUNK_FRAMES * CHANNELS * sizeof(int32_t);
+        if (ff_fwrite_direct(plSamples, 1, xLen, pxFile) != xLen) {
+            FF_FAIL("ff_fwrite_direct", pcPath);
+            ff_fclose(pxFile);
+            return false;
+        }
+        *pullUs += micros() - ullStart;
+    }
+    uint64_t ullStart = micros();
+    bool bOk = 0 == ff_fclose(pxFile);
+    *pullUs += micros() - ullStart;
+    return bOk;
+}
+
+static bool prvCompressed(const char *pcPath, int32_t *plSamples, size_t xChunks,
+                          ff_zs_stats_t *pxStats, uint64_t *pullUs) {
+    ff_zwriter_t *pxWriter = ff_zw_create(pcPath, CHANNELS, BLOCK_SIZE);
+    if (!pxWriter) {
+        FF_FAIL("ff_zw_create", pcPath);
+        return false;
+    }
+    gen_t xGen = {.ulSeed = 1};
+    *pullUs = 0;
+    for (size_t i = 0; i < xChunks; ++i) {
+        prvGenerate(&xGen, plSamples, CHUNK_FRAMES);
+        uint64_t ullStart = micros();
+        if (ff_zw_write(pxWriter, plSamples, CHUNK_FRAMES)) {
+            FF_FAIL("ff_zw_write", pcPath);
+            ff_zw_close(pxWriter);
+            return false;
+        }
+        *pullUs += micros() - ullStart;
+    }
+    ff_zw_get_stats(pxWriter, pxStats);
+    uint64_t ullStart = micros();
+    bool bOk = 0 == ff_zw_close(pxWriter);
+    *pullUs += micros() - ullStart;
+    return bOk;
+}
+
+static bool prvVerify(const char *pcPath, int32_t *plSamples, size_t xChunks) {
+    int32_t *plExpected = plSamples + CHUNK_FRAMES * CHANNELS;
+    ff_zreader_t *pxReader = ff_zr_open(pcPath);
+    if (!pxReader) {
+        FF_FAIL("ff_zr_open", pcPath);
+        return false;
+    }
+    bool bOk = true;
+    gen_t xGen = {.ulSeed = 1};
+    uint64_t ullStart = micros();
+    for (size_t i = 0; bOk && i < xChunks; ++i) {
+        prvGenerate(&xGen, plExpected, CHUNK_FRAMES);
+        long lRead = ff_zr_read(pxReader, i * CHUNK_FRAMES, plSamples, CHUNK_FRAMES);
+        if (CHUNK_FRAMES != lRead ||
+            memcmp(plSamples, plExpected, CHUNK_FRAMES * CHANNELS * sizeof(int32_t))) {
+            EMSG_PRINTF("Mismatch in frames %zu to %zu\n", i * CHUNK_FRAMES,
+                        (i + 1) * CHUNK_FRAMES - 1);
+            bOk = false;
+        }
+    }
+    uint64_t ullSeqUs = micros() - ullStart;
+
+    // Random access: frame n's counter channel is n
+    uint64_t ullFrames = (uint64_t)xChunks * CHUNK_FRAMES;
+    ullStart = micros();
+    for (size_t i = 0; bOk && i < 16; ++i) {
+        uint64_t ullFrame = ((uint64_t)rand() << 16 ^ rand()) % ullFrames;
+        if (1 != ff_zr_read(pxReader, ullFrame, plSamples, 1) ||
+            plSamples[3] != (int32_t)ullFrame) {
+            EMSG_PRINTF("Random read of frame %" PRIu64 " failed\n", ullFrame);
+            bOk = false;
+        }
+    }
+    uint64_t ullRandUs = micros() - ullStart;
+    ff_zr_close(pxReader);
+    if (bOk)
+        printf("Verified. Sequential read: %.1f ms; 16 random reads: %.1f ms\n", ullSeqUs / 1e3,
+               ullRandUs / 1e3);
+    return bOk;
+}
+
+/* Write xFrames frames of synthetic telemetry both ways */
+void zbench(size_t xFrames) {
+    size_t xChunks = (xFrames + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+    int32_t *plSamples = pvPortMalloc(2 * CHUNK_FRAMES * CHANNELS * sizeof(int32_t));
+    if (!plSamples) {
+        EMSG_PRINTF("%s: out of memory\n", __func__);
+        return;
+    }
+    uint64_t ullRawUs, ullCodedUs;
+    ff_zs_stats_t xStats;
+    if (prvRaw("zbench.raw", plSamples, xChunks, &ullRawUs) &&
+        prvCompressed("zbench.z", plSamples, xChunks, &xStats, &ullCodedUs)) {
+        uint64_t ullRawBytes = (uint64_t)xChunks * CHUNK_FRAMES * CHANNELS * sizeof(int32_t);
+        printf("%" PRIu64 " frames of %d channels\n", xStats.ullFrames, CHANNELS);
+        printf("%-12s %12s %12s %12s %12s\n", "", "Bytes", "Encode ms", "Write ms", "Total ms");
+        printf("%-12s %12" PRIu64 " %12s %12.1f %12.1f\n", "Raw", ullRawBytes, "-",
+               ullRawUs / 1e3, ullRawUs / 1e3);
+        printf("%-12s %12" PRIu64 " %12.1f %12.1f %12.1f\n", "Compressed", xStats.ullCodedBytes,
+               xStats.ullEncodeUs / 1e3, (ullCodedUs - xStats.ullEncodeUs) / 1e3,
+               ullCodedUs / 1e3);
+        printf("Ratio: %.2f:1; time saved: %.1f%%\n",
+               (double)ullRawBytes / xStats.ullCodedBytes,
+               100.0 * ((double)ullRawUs - ullCodedUs) / ullRawUs);
+        prvVerify("zbench.z", plSamples, xChunks);
+    }
+    ff_remove("zbench.raw");
+    ff_remove("zbench.z");
+    vPortFree(plSamples);
+}
+
+/* [] END OF FILE */
@@ -143,4 +143,13 @@
 // Set this to 1 to support fs_read() to dynamically read file data.
 // Without this (default=off), only one-block files are supported, and the contents must be ready after fs_open().
 
+#define LWIP_HTTPD_FS_ASYNC_READ 1
+// Set this to 1 to read file data asynchronously: fs_read_async_custom() returns FS_READ_DELAYED
+// until the data is ready, and then the callback is called on the tcpip thread.
+// In sd_filesystem.c, a storage task does the reads (with read-ahead),
+// so sending a file never waits for the SD card.
+// Opening one still can: the lwIP httpd opens files synchronously on the tcpip thread,
+// and a file that isn't in the RAM cache is looked up there (ff_stat, ff_fopen),
+// which waits for the FAT IO manager lock while the storage task holds it through a card stall.
+
 #define HTTPD_DEBUG LWIP_DBG_OFF
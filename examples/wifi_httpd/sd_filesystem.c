@@ -1,16 +1,702 @@
-
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+//
 #include "lwip/apps/fs.h"
 #include "lwip/apps/httpd.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+//
+#include "pico/stdlib.h"
 //
 #include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
 //
+#include "ff_direct.h"
 #include "ff_headers.h"
 #include "ff_sddisk.h"
 #include "ff_stdio.h"
 #include "ff_utils.h"
+//
+#include "sd_filesystem.h"
 
 static char const *const mnt_pnt = "sd0";
 
+#if FS_CACHE_SIZE
+
+/* RAM cache of small files, most recently used first.
+A hit is served from RAM, without touching the SD card.
+An entry is trusted for FS_CACHE_REVALIDATE_MS; after that, its size and modification time
+are checked against the directory entry (ff_stat) on the next hit.
+With LWIP_HTTPD_FS_ASYNC_READ, the storage task does that check, and the hit is served as it is
+in the meantime, so a hit never waits for the card on the tcpip thread.
+An entry also remembers that there is no precompressed <path>.gz,
+so that a hit doesn't look for one on the card either, until the entry is revalidated.
+Entries are pinned while a connection is sending them. */
+
+typedef struct cache_entry_t {
+    struct cache_entry_t *prev, *next;
+    char *path;
+    uint8_t *data;
+    uint32_t len;
+    uint32_t mtime;
+    TickType_t validated;
+    unsigned pins;
+    bool stale;  // Unlinked from the list; freed when the last pin goes
+    bool no_gz;  // There was no <path>.gz when the entry was last validated
+    bool revalidating;  // Queued for the storage task to check
+} cache_entry_t;
+
+static cache_entry_t *cache_head, *cache_tail;
+static size_t cache_bytes;  // Data in the cache
+static fs_cache_stats_t cache_stats;
+
+/* Must be called in a critical section */
+static void cache_unlink(cache_entry_t *e) {
+    if (e->prev) e->prev->next = e->next; else cache_head = e->next;
+    if (e->next) e->next->prev = e->prev; else cache_tail = e->prev;
+    e->prev = e->next = NULL;
+    cache_bytes -= e->len;
+}
+/* Must be called in a critical section */
+static void cache_push_front(cache_entry_t *e) {
+    e->prev = NULL;
+    e->next = cache_head;
+    if (cache_head) cache_head->prev = e; else cache_tail = e;
+    cache_head = e;
+}
+/* Must be called in a critical section */
+static cache_entry_t *cache_find(const char *path) {
+    for (cache_entry_t *e = cache_head; e; e = e->next)
+        if (0 == strcmp(e->path, path)) return e;
+    return NULL;
+}
+/* Must be called in a critical section. Returns true if the caller should free e. */
+static bool cache_remove(cache_entry_t *e) {
+    cache_unlink(e);
+    e->stale = true;
+    return !e->pins;
+}
+
+static cache_entry_t *cache_new(const char *path, uint32_t len, uint32_t mtime) {
+    size_t path_len = strlen(path) + 1;
+    // One allocation for the entry, the data, and the path
+    cache_entry_t *e = pvPortMalloc(sizeof(cache_entry_t) + len + path_len);
+    if (!e) return NULL;
+    memset(e, 0, sizeof *e);
+    e->data = (uint8_t *)(e + 1);
+    e->path = (char *)e->data + len;
+    memcpy(e->path, path, path_len);
+    e->len = len;
+    e->mtime = mtime;
+    return e;
+}
+
+/* Add a filled entry, evicting the least recently used unpinned entries to make room */
+static void cache_insert(cache_entry_t *e) {
+    cache_entry_t *to_free[8];
+    size_t n_free = 0;
+    bool inserted = false;
+    taskENTER_CRITICAL();
+    cache_entry_t *old = cache_find(e->path);
+    if (old && cache_remove(old)) to_free[n_free++] = old;
+    cache_entry_t *victim = cache_tail;
+    while (cache_bytes + e->len > FS_CACHE_SIZE && victim && n_free < count_of(to_free)) {
+        cache_entry_t *prev = victim->prev;
+        if (!victim->pins) {
+            cache_remove(victim);
+            to_free[n_free++] = victim;
+            ++cache_stats.evictions;
+        }
+        victim = prev;
+    }
+    if (cache_bytes + e->len <= FS_CACHE_SIZE) {
+        e->validated = xTaskGetTickCount();
+        cache_push_front(e);
+        cache_bytes += e->len;
+        inserted = true;
+    }
+    taskEXIT_CRITICAL();
+    for (size_t i = 0; i < n_free; ++i) vPortFree(to_free[i]);
+    if (!inserted) vPortFree(e);
+}
+
+static void cache_release(cache_entry_t *e) {
+    taskENTER_CRITICAL();
+    bool free_it = !--e->pins && e->stale;
+    taskEXIT_CRITICAL();
+    if (free_it) vPortFree(e);
+}
+
+/* Check a pinned entry against the directory entry.
+If the file has changed, the entry is dropped and false is returned.
+Otherwise, it is trusted for another FS_CACHE_REVALIDATE_MS,
+and a .gz copy that has turned up since is noticed. */
+static bool cache_revalidate(cache_entry_t *e) {
+    FF_Stat_t st;
+    bool same = 0 == ff_stat(e->path, &st) && st.st_size == e->len && st.st_mtime == e->mtime;
+    bool gz = false;
+    if (same && e->no_gz) {
+        char gz_path[LWIP_HTTPD_MAX_REQUEST_URI_LEN + strlen(mnt_pnt) + sizeof ".gz" + 1];
+        snprintf(gz_path, sizeof gz_path, "%s.gz", e->path);
+        gz = 0 == ff_stat(gz_path, &st);
+    }
+    taskENTER_CRITICAL();
+    ++cache_stats.revalidations;
+    if (same) {
+        e->validated = xTaskGetTickCount();
+        if (gz) e->no_gz = false;
+    } else if (!e->stale) {
+        cache_remove(e);
+    }
+    e->revalidating = false;
+    taskEXIT_CRITICAL();
+    return same;
+}
+
+#if LWIP_HTTPD_FS_ASYNC_READ
+static bool request_revalidate(cache_entry_t *e);
+#endif
+
+/* Look up path, revalidating the entry if it's due.
+Returns a pinned entry, or NULL. Runs on the tcpip thread. */
+static cache_entry_t *cache_get(const char *path) {
+    taskENTER_CRITICAL();
+    ++cache_stats.lookups;
+    cache_entry_t *e = cache_find(path);
+    bool fresh = e && xTaskGetTickCount() - e->validated < pdMS_TO_TICKS(FS_CACHE_REVALIDATE_MS);
+    if (e) ++e->pins;  // So it can't be freed while we look at it
+#if LWIP_HTTPD_FS_ASYNC_READ
+    bool revalidate = e && !fresh && !e->revalidating;
+    if (revalidate) {
+        e->revalidating = true;
+        ++e->pins;  // For the storage task
+    }
+#endif
+    taskEXIT_CRITICAL();
+    if (!e) return NULL;
+#if LWIP_HTTPD_FS_ASYNC_READ
+    // Serve it as it is; the storage task checks it for next time
+    if (revalidate && !request_revalidate(e)) {
+        taskENTER_CRITICAL();
+        e->revalidating = false;
+        --e->pins;  // Still pinned by us
+        taskEXIT_CRITICAL();
+    }
+#else
+    if (!fresh && !cache_revalidate(e)) {
+        cache_release(e);  // Unpin
+        return NULL;
+    }
+#endif
+    taskENTER_CRITICAL();
+    if (!e->stale) {
+        // Most recently used
+        cache_unlink(e);
+        cache_push_front(e);
+        cache_bytes += e->len;
+    }
+    ++cache_stats.hits;
+    taskEXIT_CRITICAL();
+    return e;
+}
+
+/* True if path is cached and known to have no .gz copy,
+so there's no need to look for one on the card.
+Without LWIP_HTTPD_FS_ASYNC_READ, the entry must also not be due for revalidation;
+with it, the storage task's revalidation looks for the .gz. */
+static bool cache_no_gz(const char *path) {
+    taskENTER_CRITICAL();
+    cache_entry_t *e = cache_find(path);
+    bool no_gz = e && e->no_gz;
+#if !LWIP_HTTPD_FS_ASYNC_READ
+    no_gz = no_gz &&
+            xTaskGetTickCount() - e->validated < pdMS_TO_TICKS(FS_CACHE_REVALIDATE_MS);
+#endif
+    if (no_gz) ++cache_stats.gz_skips;
+    taskEXIT_CRITICAL();
+    return no_gz;
+}
+
+void sd_cache_invalidate(const char *path) {
+    size_t len = path ? strlen(path) : 0;
+    if (len > 3 && 0 == strcmp(path + len - 3, ".gz")) {
+        // There might be a .gz copy of the file without the ".gz" now
+        taskENTER_CRITICAL();
+        for (cache_entry_t *e = cache_head; e; e = e->next)
+            if (0 == strncmp(e->path, path, len - 3) && !e->path[len - 3]) e->no_gz = false;
+        taskEXIT_CRITICAL();
+    }
+    for (;;) {
+        taskENTER_CRITICAL();
+        cache_entry_t *e = path ? cache_find(path) : cache_head;
+        bool free_it = e && cache_remove(e);
+        taskEXIT_CRITICAL();
+        if (!e) return;
+        if (free_it) vPortFree(e);
+        if (path) return;
+    }
+}
+
+void sd_cache_get_stats(fs_cache_stats_t *stats_p) {
+    taskENTER_CRITICAL();
+    *stats_p = cache_stats;
+    stats_p->bytes = cache_bytes;
+    taskEXIT_CRITICAL();
+}
+
+/* Read a whole small file into a new cache entry */
+static void cache_load(FF_FILE *pxFile, const char *path) {
+    FF_Stat_t st;
+    if (ff_stat(path, &st)) return;
+    cache_entry_t *e = cache_new(path, st.st_size, st.st_mtime);
+    if (!e) return;
+    if (ff_fread(e->data, 1, e->len, pxFile) != e->len) {
+        vPortFree(e);
+        return;
+    }
+    cache_insert(e);
+}
+
+#endif
+
+/* Request headers that change the response.
+lwIP's httpd doesn't pass request headers to fs_open_custom.
+But it opens the file while it is handling the segment holding the request,
+so a wrapper around its receive callback can pick them out on the way in.
+(The link uses -Wl,--wrap=tcp_recv; see CMakeLists.txt.)
+Only the first segment of a request is looked at:
+headers that spill into a second segment are ignored, and the response is just unconditional. */
+
+typedef struct {
+    bool valid;  // A GET is being handled
+    bool accept_gzip;
+    char if_none_match[48];
+    char if_modified_since[32];
+    char range[48];
+    char if_range[48];
+} req_headers_t;
+
+static req_headers_t req_headers;
+
+static void copy_value(char *dst, size_t size, const char *value) {
+    // A truncated value won't match anything, which is harmless
+    snprintf(dst, size, "%s", value);
+}
+
+static void capture_headers(struct pbuf *p) {
+    static char text[1024];  // Only used on the tcpip thread
+    u16_t len = pbuf_copy_partial(p, text, sizeof text - 1, 0);
+    text[len] = '\0';
+    memset(&req_headers, 0, sizeof req_headers);
+    if (strncmp(text, "GET ", 4)) return;
+    req_headers.valid = true;
+    char *line = strstr(text, "\r\n");  // Skip the request line
+    while (line) {
+        line += 2;
+        char *eol = strstr(line, "\r\n");
+        if (!eol || eol == line) break;  // Cut off, or the end of the headers
+        *eol = '\0';
+        char *value = strchr(line, ':');
+        if (value) {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+            if (!strcasecmp(line, "Accept-Encoding"))
+                req_headers.accept_gzip = strstr(value, "gzip") != NULL;
+            else if (!strcasecmp(line, "If-None-Match"))
+                copy_value(req_headers.if_none_match, sizeof req_headers.if_none_match, value);
+            else if (!strcasecmp(line, "If-Modified-Since"))
+                copy_value(req_headers.if_modified_since, sizeof req_headers.if_modified_since,
+                           value);
+            else if (!strcasecmp(line, "Range"))
+                copy_value(req_headers.range, sizeof req_headers.range, value);
+            else if (!strcasecmp(line, "If-Range"))
+                copy_value(req_headers.if_range, sizeof req_headers.if_range, value);
+        }
+        line = eol;
+    }
+}
+
+void __real_tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv);
+
+/* The receive callback set for each connection.
+PCBs come from a pool of MEMP_NUM_TCP_PCB, so an address that is reused
+replaces its own stale slot. */
+static struct {
+    struct tcp_pcb *pcb;
+    tcp_recv_fn recv;
+} recv_fns[MEMP_NUM_TCP_PCB];
+
+static size_t recv_slot(struct tcp_pcb *pcb) {
+    size_t free_slot = count_of(recv_fns);
+    for (size_t i = 0; i < count_of(recv_fns); ++i) {
+        if (recv_fns[i].pcb == pcb) return i;
+        if (!recv_fns[i].pcb && count_of(recv_fns) == free_slot) free_slot = i;
+    }
+    return free_slot;
+}
+
+static err_t recv_shim(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    size_t i = recv_slot(pcb);
+    configASSERT(i < count_of(recv_fns) && recv_fns[i].pcb == pcb);
+    if (p && ERR_OK == err) capture_headers(p);
+    err_t rc = recv_fns[i].recv(arg, pcb, p, err);
+    req_headers.valid = false;
+    return rc;
+}
+
+void __wrap_tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {
+    size_t i = recv_slot(pcb);
+    if (i < count_of(recv_fns)) {
+        recv_fns[i].pcb = recv ? pcb : NULL;
+        recv_fns[i].recv = recv;
+        if (recv) recv = recv_shim;
+    }
+    __real_tcp_recv(pcb, recv);
+}
+
+/* Responses carry their own headers (FS_FILE_FLAGS_HEADER_INCLUDED),
+so they can have ETag, Last-Modified, and Content-Encoding,
+or be a bodiless 304 Not Modified */
+
+#ifndef FS_HDR_SIZE
+#  define FS_HDR_SIZE 384
+#endif
+
+typedef struct {
+    char hdr[FS_HDR_SIZE];  // Sent ahead of the body
+    size_t hdr_len;
+    size_t body_off;  // Where the body starts in the file (for a range)
+    size_t body_len;
+#if FS_CACHE_SIZE
+    cache_entry_t *e;  // If set, the body comes from the cache...
+#endif
+#if LWIP_HTTPD_FS_ASYNC_READ
+    struct async_file_t *af_p;  // ...otherwise from the storage task,
+#else
+    FF_FILE *pxFile;  // ...otherwise from the file
+#endif
+} response_t;
+
+static void hdr_printf(response_t *r, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(r->hdr + r->hdr_len, sizeof r->hdr - r->hdr_len, fmt, args);
+    va_end(args);
+    if (n > 0) r->hdr_len += n;
+    if (r->hdr_len >= sizeof r->hdr) r->hdr_len = sizeof r->hdr - 1;  // Truncated
+}
+
+static const char *content_type(const char *name) {
+    static const struct {
+        const char *ext, *type;
+    } types[] = {
+        {"html", "text/html"},       {"htm", "text/html"},
+        {"css", "text/css"},         {"js", "application/javascript"},
+        {"json", "application/json"}, {"txt", "text/plain"},
+        {"csv", "text/csv"},         {"xml", "text/xml"},
+        {"svg", "image/svg+xml"},    {"png", "image/png"},
+        {"jpg", "image/jpeg"},       {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},        {"ico", "image/x-icon"},
+        {"pdf", "application/pdf"},  {"wasm", "application/wasm"},
+    };
+    const char *ext = strrchr(name, '.');
+    if (ext && !strchr(ext, '/'))
+        for (size_t i = 0; i < count_of(types); ++i)
+            if (!strcasecmp(ext + 1, types[i].ext)) return types[i].type;
+    return "text/plain";  // Like httpd's HTTP_HDR_DEFAULT_TYPE
+}
+
+/* httpd opens /404.html and the like for its error responses */
+static const char *error_status(const char *name) {
+    static const char *const errors[] = {"400 Bad Request", "404 Not Found",
+                                         "501 Not Implemented"};
+    for (size_t i = 0; i < count_of(errors); ++i)
+        if ('/' == name[0] && !strncmp(name + 1, errors[i], 3) && '.' == name[4])
+            return errors[i];
+    return NULL;
+}
+
+/* The FAT modification time is local time with two second resolution;
+it is reported as if it were GMT. */
+static void http_date(char *buf, size_t size, uint32_t mtime) {
+    time_t t = mtime;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* If-Modified-Since is compared as a string:
+clients send back the Last-Modified they were given. */
+static bool not_modified(const char *etag, const char *last_modified) {
+    if (!req_headers.valid) return false;
+    if (req_headers.if_none_match[0])  // Takes precedence over If-Modified-Since
+        return !strcmp(req_headers.if_none_match, "*") ||
+               strstr(req_headers.if_none_match, etag);
+    return req_headers.if_modified_since[0] &&
+           !strcmp(req_headers.if_modified_since, last_modified);
+}
+
+typedef enum { RANGE_NONE, RANGE_OK, RANGE_UNSATISFIABLE } range_t;
+
+/* A single range: "bytes=first-last", "bytes=first-", or "bytes=-suffix_length".
+Anything else (including several ranges) gets the whole file, which the RFC allows. */
+static range_t parse_range(uint32_t size, const char *etag, const char *last_modified,
+                           uint32_t *first_p, uint32_t *last_p) {
+    const char *s = req_headers.range;
+    if (!req_headers.valid || strncmp(s, "bytes=", 6) || strchr(s, ',')) return RANGE_NONE;
+    // If-Range: only send part if it's still the same file
+    if (req_headers.if_range[0] && strcmp(req_headers.if_range, etag) &&
+        strcmp(req_headers.if_range, last_modified))
+        return RANGE_NONE;
+    s += strlen("bytes=");
+    char *end;
+    if ('-' == *s) {
+        // The last n bytes
+        unsigned long n = strtoul(s + 1, &end, 10);
+        if (end == s + 1 || *end) return RANGE_NONE;
+        if (!n || !size) return RANGE_UNSATISFIABLE;
+        *first_p = n < size ? size - n : 0;
+        *last_p = size - 1;
+        return RANGE_OK;
+    }
+    unsigned long first = strtoul(s, &end, 10);
+    if (end == s || '-' != *end) return RANGE_NONE;
+    s = end + 1;
+    unsigned long last = UINT32_MAX;
+    if (*s) {
+        last = strtoul(s, &end, 10);
+        if (*end || last < first) return RANGE_NONE;
+    }
+    if (first >= size) return RANGE_UNSATISFIABLE;
+    *first_p = first;
+    *last_p = last < size ? last : size - 1;
+    return RANGE_OK;
+}
+
+/* Size and modification time, from the cache if path is there
+(leaving the entry pinned in r->e), or from the directory entry */
+static bool file_info(response_t *r, const char *path, uint32_t *size_p, uint32_t *mtime_p) {
+#if FS_CACHE_SIZE
+    r->e = cache_get(path);
+    if (r->e) {
+        *size_p = r->e->len;
+        *mtime_p = r->e->mtime;
+        return true;
+    }
+#else
+    (void)r;
+#endif
+    FF_Stat_t st;
+    if (ff_stat(path, &st)) return false;
+    *size_p = st.st_size;
+    *mtime_p = st.st_mtime;
+    return true;
+}
+
+/* Copy out of the header, or out of a cached body.
+Returns 0 if the rest has to come from the file. */
+static int read_from_ram(struct fs_file *file, char *buffer, int count) {
+    response_t *r = file->pextension;
+    size_t index = file->index;
+    const char *src;
+    size_t avail;
+    if (index < r->hdr_len) {
+        src = r->hdr + index;
+        avail = r->hdr_len - index;
+#if FS_CACHE_SIZE
+    } else if (r->e) {
+        src = (const char *)r->e->data + r->body_off + (index - r->hdr_len);
+        avail = file->len - index;
+#endif
+    } else {
+        return 0;
+    }
+    size_t n = avail < (size_t)count ? avail : (size_t)count;
+    memcpy(buffer, src, n);
+    file->index += n;
+    return n;
+}
+
+#if LWIP_HTTPD_FS_ASYNC_READ
+
+/* File data is read by a storage task, never by the tcpip thread,
+so a slow SD card doesn't hold up sending.
+(Opening a file that isn't cached still looks it up with ff_stat and ff_fopen on the tcpip thread,
+and those wait for the IO manager lock while the card is stalled.)
+Each open file has FS_ASYNC_BUFFERS buffers: while the tcpip thread sends from one,
+the storage task reads ahead into the others. */
+
+#ifndef FS_ASYNC_BUFFER_SIZE
+#  define FS_ASYNC_BUFFER_SIZE 2048  // A multiple of 512, so reads stay sector aligned
+#endif
+#ifndef FS_ASYNC_BUFFERS
+#  define FS_ASYNC_BUFFERS 2
+#endif
+#ifndef FS_ASYNC_TASK_PRIORITY
+#  define FS_ASYNC_TASK_PRIORITY (TCPIP_THREAD_PRIO - 1)
+#endif
+
+typedef enum { BUF_EMPTY, BUF_FILLING, BUF_FULL } buf_state_t;
+
+typedef struct {
+    uint8_t data[FS_ASYNC_BUFFER_SIZE];
+    volatile buf_state_t state;
+    size_t len;  // Bytes read into data
+    size_t pos;  // Bytes already sent
+} async_buf_t;
+
+typedef struct async_file_t {
+    FF_FILE *pxFile;
+    async_buf_t bufs[FS_ASYNC_BUFFERS];
+    size_t offset;     // Where to start reading
+    size_t len;        // Bytes to read, from offset rounded down to a sector
+    bool started;
+    size_t current;    // Buffer being sent from
+    size_t requested;  // Bytes asked of the storage task so far
+    volatile bool error;
+    // Who to call back when bufs[current] is full
+    fs_wait_cb wait_cb;
+    void *wait_arg;
+} async_file_t;
+
+typedef enum { REQ_FILL, REQ_CLOSE, REQ_CACHE, REQ_REVALIDATE } req_op_t;
+typedef struct {
+    req_op_t op;
+    union {
+        async_file_t *af_p;
+        char *path;  // For REQ_CACHE; freed by the storage task
+#if FS_CACHE_SIZE
+        cache_entry_t *e;  // For REQ_REVALIDATE; pinned, and released by the storage task
+#endif
+    };
+    size_t buf;
+} req_t;
+
+static QueueHandle_t requests;
+
+#if FS_CACHE_SIZE
+/* At most MEMP_NUM_TCP_PCB revalidations are queued at a time,
+so they can't crowd out the fill requests that the queue is sized for */
+static volatile UBaseType_t revalidations_queued;
+
+/* Called on the tcpip thread. Never blocks. Returns false if it can't be queued now. */
+static bool request_revalidate(cache_entry_t *e) {
+    if (revalidations_queued >= MEMP_NUM_TCP_PCB) return false;
+    taskENTER_CRITICAL();
+    ++revalidations_queued;
+    taskEXIT_CRITICAL();
+    req_t req = {.op = REQ_REVALIDATE, .e = e};
+    if (pdPASS == xQueueSend(requests, &req, 0)) return true;
+    taskENTER_CRITICAL();
+    --revalidations_queued;
+    taskEXIT_CRITICAL();
+    return false;
+}
+#endif
+
+static void storage_task(void *arg) {
+    (void)arg;
+    for (;;) {
+        req_t req;
+        xQueueReceive(requests, &req, portMAX_DELAY);
+#if FS_CACHE_SIZE
+        if (REQ_CACHE == req.op) {
+            FF_FILE *pxFile = ff_fopen(req.path, "r");
+            if (pxFile) {
+                cache_load(pxFile, req.path);
+                ff_fclose(pxFile);
+            }
+            vPortFree(req.path);
+            continue;
+        }
+        if (REQ_REVALIDATE == req.op) {
+            cache_revalidate(req.e);
+            cache_release(req.e);
+            taskENTER_CRITICAL();
+            --revalidations_queued;
+            taskEXIT_CRITICAL();
+            continue;
+        }
+#endif
+        async_file_t *af_p = req.af_p;
+        if (REQ_CLOSE == req.op) {
+            if (-1 == ff_fclose(af_p->pxFile))
+                FF_PRINTF("ff_fclose failed: %s (%d)\n", strerror(stdioGET_ERRNO()),
+                          stdioGET_ERRNO());
+            vPortFree(af_p);
+            continue;
+        }
+        async_buf_t *buf_p = &af_p->bufs[req.buf];
+        stdioSET_ERRNO(0);
+        size_t skip = 0;
+        if (!af_p->started) {
+            /* For a range, seek here rather than on the tcpip thread,
+            since it can mean following a long cluster chain.
+            Start on a sector boundary so the reads stay aligned,
+            and skip the bytes before the offset in the first buffer. */
+            af_p->started = true;
+            skip = af_p->offset % 512;
+            if (af_p->offset && ff_fseek(af_p->pxFile, af_p->offset - skip, FF_SEEK_SET))
+                FF_PRINTF("ff_fseek failed: %s (%d)\n", strerror(stdioGET_ERRNO()),
+                          stdioGET_ERRNO());
+        }
+        size_t br = 0;
+        int error = stdioGET_ERRNO();
+        if (!error) {
+            br = ff_fread_direct(buf_p->data, 1, sizeof buf_p->data, af_p->pxFile);
+            error = stdioGET_ERRNO();
+            if (error)
+                FF_PRINTF("ff_fread_direct returned %zu bytes: %s (%d)\n", br,
+                          strerror(error), error);
+        }
+        if (br < skip) br = skip;  // Nothing past the skipped part; reads as the end
+
+        fs_wait_cb cb = NULL;
+        void *cb_arg = NULL;
+        taskENTER_CRITICAL();
+        buf_p->len = br;
+        buf_p->pos = skip;
+        buf_p->state = BUF_FULL;
+        if (error) af_p->error = true;
+        if (af_p->wait_cb && (req.buf == af_p->current || af_p->error)) {
+            cb = af_p->wait_cb;
+            cb_arg = af_p->wait_arg;
+            af_p->wait_cb = NULL;
+        }
+        taskEXIT_CRITICAL();
+        // The callback sends data, so it has to run on the tcpip thread
+        if (cb) tcpip_callback(cb, cb_arg);
+    }
+}
+
+/* Called on the tcpip thread. Never blocks. */
+static void request_fill(async_file_t *af_p, size_t buf) {
+    if (af_p->requested >= af_p->len) return;  // Nothing left to read
+    af_p->bufs[buf].state = BUF_FILLING;
+    af_p->requested += FS_ASYNC_BUFFER_SIZE;
+    req_t req = {.op = REQ_FILL, .af_p = af_p, .buf = buf};
+    BaseType_t rc = xQueueSend(requests, &req, 0);
+    configASSERT(pdPASS == rc);
+}
+
+static void start_storage_task() {
+    /* Each open file can have a fill request outstanding for every buffer, plus a close,
+    plus a request to cache it; and there can be MEMP_NUM_TCP_PCB revalidations */
+    requests = xQueueCreate(2 * MEMP_NUM_TCP_PCB * (FS_ASYNC_BUFFERS + 2), sizeof(req_t));
+    configASSERT(requests);
+    BaseType_t rc = xTaskCreate(storage_task, "httpd storage", 1024, NULL,
+                                FS_ASYNC_TASK_PRIORITY, NULL);
+    configASSERT(pdPASS == rc);
+}
+
+#endif
+
 void sd_init_mount() {
     FF_Disk_t *pxDisk = FF_SDDiskInit(mnt_pnt);
     if (!pxDisk)
@@ -21,40 +707,266 @@ void sd_init_mount() {
         exit(1);
     }
     FF_FS_Add("/sd0", pxDisk);
+#if LWIP_HTTPD_FS_ASYNC_READ
+    start_storage_task();
+#endif
 }
 
-int fs_open_custom(struct fs_file *file, const char *name) {
-    char buf[LWIP_HTTPD_MAX_REQUEST_URI_LEN + strlen(mnt_pnt) + 1];
-    snprintf(buf, sizeof buf, "/%s%s", mnt_pnt, name);
-    FF_FILE *pxFile = ff_fopen(buf, "r");
+/* Set up reading the body from the file, which is size bytes long */
+static bool open_body(response_t *r, const char *path, uint32_t size) {
+    FF_FILE *pxFile = ff_fopen(path, "r");
     if (!pxFile) {
-        FF_PRINTF("ff_fopen(,\"%s\") failed: %s (%d)\n", buf,
+        FF_PRINTF("ff_fopen(,\"%s\") failed: %s (%d)\n", path,
                   strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
         return false;
     }
+#if FS_CACHE_SIZE
+    if (size <= FS_CACHE_MAX_FILE_SIZE) {
+#  if LWIP_HTTPD_FS_ASYNC_READ
+        // Have the storage task cache it for next time; send it the usual way this time
+        char *copy = pvPortMalloc(strlen(path) + 1);
+        if (copy) {
+            strcpy(copy, path);
+            req_t req = {.op = REQ_CACHE, .path = copy};
+            if (pdPASS != xQueueSend(requests, &req, 0)) vPortFree(copy);
+        }
+#  else
+        cache_load(pxFile, path);
+        r->e = cache_get(path);
+        if (r->e) {
+            ff_fclose(pxFile);
+            return true;
+        }
+        ff_rewind(pxFile);
+#  endif
+    }
+#else
+    (void)size;
+#endif
+#if LWIP_HTTPD_FS_ASYNC_READ
+    async_file_t *af_p = pvPortMalloc(sizeof(async_file_t));
+    if (!af_p) {
+        ff_fclose(pxFile);
+        return false;
+    }
+    memset(af_p, 0, sizeof *af_p);
+    af_p->pxFile = pxFile;
+    af_p->offset = r->body_off;
+    af_p->len = r->body_off % 512 + r->body_len;
+    r->af_p = af_p;
+    // Start reading ahead right away
+    for (size_t i = 0; i < FS_ASYNC_BUFFERS; ++i)
+        request_fill(af_p, i);
+#else
+    if (r->body_off && ff_fseek(pxFile, r->body_off, FF_SEEK_SET)) {
+        ff_fclose(pxFile);
+        return false;
+    }
+    r->pxFile = pxFile;
+#endif
+    return true;
+}
+
+int fs_open_custom(struct fs_file *file, const char *name) {
+    char path[LWIP_HTTPD_MAX_REQUEST_URI_LEN + strlen(mnt_pnt) + sizeof ".gz" + 1];
+    size_t path_len = snprintf(path, sizeof path, "/%s%s", mnt_pnt, name);
+    const char *error = error_status(name);
+
+    response_t *r = pvPortMalloc(sizeof(response_t));
+    if (!r) return false;
+    memset(r, 0, sizeof *r);
+
+    uint32_t size, mtime;
+    bool gzip = false;
+    bool gz_tried = false;
+    if (!error && req_headers.valid && req_headers.accept_gzip &&
+        path_len + strlen(".gz") < sizeof path) {
+#if FS_CACHE_SIZE
+        gz_tried = !cache_no_gz(path);
+#else
+        gz_tried = true;
+#endif
+    }
+    if (gz_tried) {
+        // Prefer a precompressed copy
+        strcpy(path + path_len, ".gz");
+        gzip = file_info(r, path, &size, &mtime);
+        if (!gzip) path[path_len] = '\0';
+    }
+    if (!gzip && !file_info(r, path, &size, &mtime)) {
+        vPortFree(r);
+        return false;
+    }
+#if FS_CACHE_SIZE
+    // Remember that there's no .gz, so the next request doesn't look for it on the card
+    if (gz_tried && !gzip && r->e) r->e->no_gz = true;
+#endif
+    char etag[32], last_modified[32];
+    snprintf(etag, sizeof etag, "\"%" PRIx32 "-%" PRIx32 "%s\"", mtime, size,
+             gzip ? "-gz" : "");
+    http_date(last_modified, sizeof last_modified, mtime);
+
+    uint32_t first = 0, last = 0;
+    range_t range = error ? RANGE_NONE : parse_range(size, etag, last_modified, &first, &last);
+    if (!error && not_modified(etag, last_modified)) {
+        // No need to read the file at all
+        hdr_printf(r, "HTTP/1.1 304 Not Modified\r\n");
+    } else if (RANGE_UNSATISFIABLE == range) {
+        hdr_printf(r, "HTTP/1.1 416 Range Not Satisfiable\r\n");
+        hdr_printf(r, "Content-Range: bytes */%" PRIu32 "\r\n", size);
+        hdr_printf(r, "Content-Length: 0\r\n");
+    } else {
+        if (RANGE_OK == range) {
+            r->body_off = first;
+            r->body_len = last - first + 1;
+            hdr_printf(r, "HTTP/1.1 206 Partial Content\r\n");
+            hdr_printf(r, "Content-Range: bytes %" PRIu32 "-%" PRIu32 "/%" PRIu32 "\r\n",
+                       first, last, size);
+        } else {
+            r->body_len = size;
+            hdr_printf(r, "HTTP/1.1 %s\r\n", error ? error : "200 OK");
+        }
+        hdr_printf(r, "Content-Type: %s\r\n", content_type(name));
+        hdr_printf(r, "Content-Length: %zu\r\n", r->body_len);
+        if (gzip) hdr_printf(r, "Content-Encoding: gzip\r\n");
+        if (!error) hdr_printf(r, "Accept-Ranges: bytes\r\n");
+        bool cached = false;
+#if FS_CACHE_SIZE
+        cached = r->e != NULL;
+#endif
+        if (!cached && !open_body(r, path, size)) {
+            vPortFree(r);
+            return false;
+        }
+    }
+    if (!error) {
+        hdr_printf(r, "ETag: %s\r\n", etag);
+        hdr_printf(r, "Last-Modified: %s\r\n", last_modified);
+        // Browsers may keep it, but must check back (a conditional GET) before using it
+        hdr_printf(r, "Cache-Control: no-cache\r\n");
+        hdr_printf(r, "Vary: Accept-Encoding\r\n");
+    }
+    hdr_printf(r, "\r\n");
+#if FS_CACHE_SIZE
+    if (!r->body_len && r->e) {
+        cache_release(r->e);
+        r->e = NULL;
+    }
+#endif
     file->data = NULL;
-    file->len = ff_filelength(pxFile);
+    file->len = r->hdr_len + r->body_len;
     file->index = 0;
-    file->pextension = pxFile;
+    file->flags = FS_FILE_FLAGS_HEADER_INCLUDED | FS_FILE_FLAGS_HEADER_PERSISTENT;
+    file->pextension = r;
     return true;
 }
+
+#if LWIP_HTTPD_FS_ASYNC_READ
+
 void fs_close_custom(struct fs_file *file) {
-    if (-1 == ff_fclose(file->pextension)) {
+    response_t *r = file->pextension;
+#if FS_CACHE_SIZE
+    if (r->e) cache_release(r->e);
+#endif
+    async_file_t *af_p = r->af_p;
+    if (af_p) {
+        taskENTER_CRITICAL();
+        af_p->wait_cb = NULL;
+        taskEXIT_CRITICAL();
+        /* The storage task closes the file and frees af_p
+        after any reads still queued for it */
+        req_t req = {.op = REQ_CLOSE, .af_p = af_p};
+        BaseType_t rc = xQueueSend(requests, &req, 0);
+        configASSERT(pdPASS == rc);
+    }
+    vPortFree(r);
+}
+
+u8_t fs_canread_custom(struct fs_file *file) {
+    response_t *r = file->pextension;
+    async_file_t *af_p = r->af_p;
+    if ((size_t)file->index < r->hdr_len || !af_p) return 1;
+    return af_p->error || BUF_FULL == af_p->bufs[af_p->current].state;
+}
+
+/* Returns 1 if callback_fn will be called when data is ready */
+u8_t fs_wait_read_custom(struct fs_file *file, fs_wait_cb callback_fn, void *callback_arg) {
+    response_t *r = file->pextension;
+    async_file_t *af_p = r->af_p;
+    if ((size_t)file->index < r->hdr_len || !af_p) return 0;
+    u8_t waiting = 0;
+    taskENTER_CRITICAL();
+    if (!af_p->error && BUF_FULL != af_p->bufs[af_p->current].state) {
+        af_p->wait_cb = callback_fn;
+        af_p->wait_arg = callback_arg;
+        waiting = 1;
+    }
+    taskEXIT_CRITICAL();
+    return waiting;
+}
+
+int fs_read_async_custom(struct fs_file *file, char *buffer, int count,
+                         fs_wait_cb callback_fn, void *callback_arg) {
+    if (file->index >= file->len) return FS_READ_EOF;
+    int n = read_from_ram(file, buffer, count);
+    if (n) return n;
+    if (!fs_wait_read_custom(file, callback_fn, callback_arg)) {
+        response_t *r = file->pextension;
+        async_file_t *af_p = r->af_p;
+        async_buf_t *buf_p = &af_p->bufs[af_p->current];
+        if (af_p->error || buf_p->pos >= buf_p->len) return FS_READ_EOF;
+
+        // Don't send more than Content-Length, even if the file has grown
+        size_t left = file->len - file->index;
+        size_t nb = buf_p->len - buf_p->pos;
+        if (nb > (size_t)count) nb = count;
+        if (nb > left) nb = left;
+        memcpy(buffer, buf_p->data + buf_p->pos, nb);
+        buf_p->pos += nb;
+        file->index += nb;
+        if (buf_p->pos == buf_p->len) {
+            // Refill this buffer while the next one is sent
+            buf_p->state = BUF_EMPTY;
+            request_fill(af_p, af_p->current);
+            af_p->current = (af_p->current + 1) % FS_ASYNC_BUFFERS;
+        }
+        return nb;
+    }
+    return FS_READ_DELAYED;
+}
+
+#else
+
+void fs_close_custom(struct fs_file *file) {
+    response_t *r = file->pextension;
+#if FS_CACHE_SIZE
+    if (r->e) cache_release(r->e);
+#endif
+    if (r->pxFile && -1 == ff_fclose(r->pxFile)) {
         FF_PRINTF("ff_fclose failed: %s (%d)\n",
                   strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
     }
+    vPortFree(r);
 }
 int fs_read_custom(struct fs_file *file, char *buffer, int count) {
     if (file->index < file->len) {
+        int n = read_from_ram(file, buffer, count);
+        if (n) return n;
         // Read "count" bytes from SD, fill in buffer, and return the amount of bytes read
-        size_t br = ff_fread(buffer, 1, count, file->pextension);
-        if (br < (size_t)count) {
-            FF_PRINTF("ff_fread(,,%d,) returned %zu bytes: %s (%d)\n",
-                      count, br, strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+        response_t *r = file->pextension;
+        size_t left = file->len - file->index;
+        size_t want = left < (size_t)count ? left : (size_t)count;
+        size_t br = ff_fread(buffer, 1, want, r->pxFile);
+        if (br < want) {
+            FF_PRINTF("ff_fread(,,%zu,) returned %zu bytes: %s (%d)\n",
+                      want, br, strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
         }
+        if (!br) return FS_READ_EOF;
         file->index += br;
         return br;
     } else {
         return FS_READ_EOF;
     }
 }
+
+#endif
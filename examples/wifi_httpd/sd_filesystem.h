@@ -1,3 +1,34 @@
 #pragma once
 
-void sd_init_mount();
\ No newline at end of file
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes of RAM for caching small files; 0 turns the cache off */
+#ifndef FS_CACHE_SIZE
+#  define FS_CACHE_SIZE (32 * 1024)
+#endif
+/* Only files up to this size are cached */
+#ifndef FS_CACHE_MAX_FILE_SIZE
+#  define FS_CACHE_MAX_FILE_SIZE (8 * 1024)
+#endif
+/* How long a cached file is served without checking the SD card for changes */
+#ifndef FS_CACHE_REVALIDATE_MS
+#  define FS_CACHE_REVALIDATE_MS 2000
+#endif
+
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t revalidations;  // Hits that had to check the directory entry
+    uint32_t evictions;
+    uint32_t gz_skips;       // Lookups of a missing .gz copy answered from the cache
+    size_t bytes;            // In the cache now
+} fs_cache_stats_t;
+
+void sd_init_mount();
+
+/* Drop path from the cache (or everything, if path is NULL).
+Call this after writing a file that the web server might serve
+(including a precompressed <name>.gz copy). */
+void sd_cache_invalidate(const char *path);
+void sd_cache_get_stats(fs_cache_stats_t *stats_p);
@@ -0,0 +1,57 @@
+/*
+ * ff_copy.h
+ *
+ * Pipelined file copy.
+ *
+ * A reader task fills buffers from the source while a writer task empties
+ * them into the destination, so reading the next buffer overlaps writing
+ * the last one. When the source and destination are on different cards
+ * (each FF_IOManager_t has its own lock), both cards are busy at once,
+ * and a copy takes about as long as the slower of reading and writing
+ * rather than their sum. On the same card, the two still take turns,
+ * but each transfer is a long multiple block read or write.
+ *
+ * The destination is preallocated with ff_fallocate (when there is a free
+ * run long enough), so it is written without FAT updates along the way.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+//
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ff_copy_config_t {
+    size_t xBufferSize;      // Bytes per buffer; a multiple of 512
+    size_t xBuffers;         // At least 2
+    UBaseType_t uxPriority;  // Reader and writer task priority
+} ff_copy_config_t;
+
+typedef struct ff_copy_stats_t {
+    uint64_t ullBytes;      // Bytes copied
+    uint64_t ullUs;         // Elapsed time
+    uint64_t ullReadUs;     // Time the reader spent reading
+    uint64_t ullWriteUs;    // Time the writer spent writing
+    uint32_t ulReaderWaits; // Times the reader found no empty buffer (the writer is slower)
+    uint32_t ulWriterWaits; // Times the writer found no full buffer (the reader is slower)
+} ff_copy_stats_t;
+
+/* Copy pcSource to pcDest, which is created or truncated.
+pxConfig can be NULL for the defaults (4 buffers of 16 KiB, at the caller's priority),
+and pxStats can be NULL if you don't want them.
+Returns 0, or -1 (and sets errno) on error. */
+int ff_copy(const char *pcSource, const char *pcDest, const ff_copy_config_t *pxConfig,
+            ff_copy_stats_t *pxStats);
+
+/* Print the statistics of a copy */
+void ff_copy_print_stats(const ff_copy_stats_t *pxStats);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,42 @@
+/*
+ * ff_direct.h
+ *
+ * Zero-copy fast path for large transfers to and from contiguous files.
+ *
+ * Whole sectors that fall within a run of contiguous clusters
+ * (for example, after ff_fallocate or in a file written to a freshly formatted card)
+ * are transferred directly between the caller's buffer and the SD card
+ * as one multiple block transfer, skipping the IO manager's sector cache
+ * and the per-cluster chain lookups.
+ * Everything else (a partial sector at either end, clusters that aren't
+ * allocated yet) goes through ff_fread or ff_fwrite as usual.
+ * Copies of the sectors written that are in the sector cache are dropped first,
+ * so later ff_fread calls don't see old data.
+ */
+
+#pragma once
+
+#include <stddef.h>
+//
+#include "FreeRTOS.h"
+#include "ff_headers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of sectors in one transfer to the SD card driver */
+#ifndef FF_DIRECT_MAX_SECTORS
+#  define FF_DIRECT_MAX_SECTORS 128
+#endif
+
+/* Drop-in replacements for ff_fread and ff_fwrite.
+For best performance, pvBuffer should be 4-byte aligned (for DMA),
+and transfers should start on a sector boundary and be a multiple of 512 bytes. */
+size_t ff_fread_direct(void *pvBuffer, size_t xSize, size_t xItems, FF_FILE *pxStream);
+size_t ff_fwrite_direct(const void *pvBuffer, size_t xSize, size_t xItems, FF_FILE *pxStream);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,129 @@
+/*
+ * ff_dirindex.h
+ *
+ * Hashed directory index.
+ *
+ * Looking up a name in a FAT directory means reading it from the start,
+ * so in a directory of thousands of files, every ff_stat or ff_fopen
+ * reads hundreds of sectors. This keeps an index per directory
+ * (name -> directory entry number and first cluster) in a hash table.
+ * It is built by one pass over the directory on the first lookup in it,
+ * and then answers lookups of names in it with a single FF_GetEntry
+ * (one sector, usually in the cache).
+ *
+ * Memory is bounded: the least recently used directories are dropped
+ * to stay within FF_DI_MAX_DIRS directories and FF_DI_MAX_BYTES bytes.
+ *
+ * The index only learns of changes made through the wrappers below
+ * (ff_di_fopen, ff_di_remove, ff_di_rename, ff_di_mkdir, ff_di_rmdir),
+ * so it is never trusted on its own:
+ * every hit is checked against the directory entry, and if the entry no longer holds
+ * the file (its name, 8.3 or long, and first cluster), the directory's index is dropped
+ * and the lookup falls back to a scan.
+ * A name that isn't in the index might have been created some other way,
+ * so it is looked up the usual way (a scan) too; if it turns out to be there,
+ * the directory's index is dropped and rebuilt on the next lookup.
+ * So the index speeds up lookups of files that exist, and never gives a wrong answer.
+ * ff_di_invalidate saves the rebuilds after changing a directory some other way.
+ *
+ * Only ff_di_stat is faster. ff_di_fopen doesn't save anything when it opens a file:
+ * FreeRTOS+FAT's FF_Open always does its own search, and has no way to open by entry number.
+ * It is there so that files it creates go into the index, and it holds the index lock
+ * while it opens, so where that doesn't matter, use plain ff_fopen.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Most directories indexed at once */
+#ifndef FF_DI_MAX_DIRS
+#  define FF_DI_MAX_DIRS 4
+#endif
+/* Most RAM for all of the indexes (about 50 bytes per file, with an 8.3 name) */
+#ifndef FF_DI_MAX_BYTES
+#  define FF_DI_MAX_BYTES (64 * 1024)
+#endif
+/* Longest absolute path that can be indexed; longer paths are just looked up the usual way */
+#ifndef FF_DI_MAX_PATH
+#  define FF_DI_MAX_PATH 256
+#endif
+/* Directories remembered by ff_di_add_known_dir */
+#ifndef FF_DI_KNOWN_DIRS
+#  define FF_DI_KNOWN_DIRS 4
+#endif
+/* Name sequences (see ff_di_next_name) remembered per directory */
+#ifndef FF_DI_SEQS
+#  define FF_DI_SEQS 2
+#endif
+
+typedef struct ff_di_stats_t {
+    uint32_t ulLookups;
+    uint32_t ulHits;       // Found through the index
+    uint32_t ulMisses;     // Not in the index, so looked up the usual way
+    uint32_t ulFallbacks;  // Looked up the usual way (not indexable, or the index was stale)
+    uint32_t ulBuilds;     // Directories read to build an index
+    uint32_t ulEvictions;  // Indexes dropped to make room
+    uint32_t ulKnownHits;  // ff_di_known_dir answered true
+    size_t xBytes;         // RAM in use now
+} ff_di_stats_t;
+
+/* Like ff_stat (st_dev is not filled in) */
+int ff_di_stat(const char *pcPath, FF_Stat_t *pxStat);
+
+/* Like ff_fopen. A file created is added to its directory's index. */
+FF_FILE *ff_di_fopen(const char *pcPath, const char *pcMode);
+
+/* Like ff_remove, ff_rename, ff_mkdir and ff_rmdir, keeping the index coherent */
+int ff_di_remove(const char *pcPath);
+int ff_di_rename(const char *pcOldName, const char *pcNewName, int bDeleteIfExists);
+int ff_di_mkdir(const char *pcPath);
+int ff_di_rmdir(const char *pcPath);
+
+/* Make a path for a new file in directory pcDir with an 8.3 name:
+pcStem (1 to 7 characters), a sequence number in the rest of the 8,
+and the extension pcExt (up to 3 characters, or ""); e.g., "LOG00042.CSV".
+The number is the lowest one past the highest already in the directory
+that isn't taken. The sequence is remembered per directory, and the names are
+checked against the index, so the number isn't found by trying names on the card one by one.
+The one name chosen is still looked up on the card (one scan), in case it was made some other way.
+The number isn't used up until a file with that name is created,
+so calling this again before then gives the same name.
+A name like this needs no long file name entries and no "~1" alias when it's created.
+This only picks a name. It is not a free entry hint: FreeRTOS+FAT finds a free directory entry
+for a new file itself, with a scan of the directory, and has no way to be told where to look.
+So making a file this way is still two scans (this one and FreeRTOS+FAT's), not constant time.
+Returns the number, or -1 (and sets errno) on error. */
+int ff_di_next_name(const char *pcDir, const char *pcStem, const char *pcExt, char *pcPath,
+                    size_t xPathSize);
+
+/* A short list of directories known to exist, for mkdirhier.
+It's only a hint: removing or renaming a directory other than through the wrappers
+(e.g., with ff_rmdir, ff_rename or ff_deltree, or in another task) doesn't update it,
+so mkdirhier checks a directory it finds here with ff_di_stat.
+ff_di_known_dir is true if pcDir was added with ff_di_add_known_dir since it was last
+removed or renamed through the wrappers above (or dropped by ff_di_invalidate). */
+bool ff_di_known_dir(const char *pcDir);
+void ff_di_add_known_dir(const char *pcDir);
+
+/* Forget what is known about directory pcDir and everything under it
+(or about every directory, if pcDir is NULL).
+Call this after changing directories other than through the wrappers above,
+e.g., with ff_deltree, and when a card is unmounted or formatted. */
+void ff_di_invalidate(const char *pcDir);
+
+void ff_di_get_stats(ff_di_stats_t *pxStats);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,69 @@
+/*
+ * ff_dirscan.h
+ *
+ * Batched directory iterator.
+ *
+ * ff_findfirst/ff_findnext go through the IO manager's sector cache
+ * one directory entry at a time. This reads the directory's clusters straight
+ * from the card, FF_DS_READ_SECTORS at a time (whole runs of contiguous
+ * clusters in one multiple block read), and decodes the entries itself,
+ * long file names included. Each entry comes back with its name, size,
+ * attributes, first cluster and times, so no ff_stat is needed afterwards.
+ *
+ * "." and ".." are skipped. The listing is read as it is on the card at the time
+ * (anything dirty in the sector cache is flushed first), so changes made to the
+ * directory while it is being scanned may or may not show up.
+ * The root directory of a FAT12 or FAT16 volume isn't a cluster chain;
+ * it is listed with ff_findfirst/ff_findnext instead, with the same results.
+ * A long name that doesn't fit in ffconfigMAX_FILENAME comes back as its 8.3 name.
+ */
+
+#pragma once
+
+#include <stdint.h>
+//
+#include "FreeRTOS.h"
+#include "ff_headers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sectors per read (the buffer is this times 512 bytes) */
+#ifndef FF_DS_READ_SECTORS
+#  define FF_DS_READ_SECTORS 16
+#endif
+
+typedef struct ff_ds_entry_t {
+    char pcName[ffconfigMAX_FILENAME];  // Long file name, or else the 8.3 name
+    uint32_t ulSize;
+    uint32_t ulCluster;                 // First cluster, or 0 for an empty file
+    uint8_t ucAttrib;                   // FF_FAT_ATTR_ bits
+    uint32_t ulMTime;                   // Modified, like st_mtime
+    uint32_t ulCTime;                   // Created
+} ff_ds_entry_t;
+
+typedef struct ff_ds_stats_t {
+    uint32_t ulEntries;  // Entries returned
+    uint32_t ulSlots;    // 32-byte directory slots decoded (long name pieces, deleted entries...)
+    uint32_t ulReads;    // Reads from the card
+    uint32_t ulSectors;  // Sectors read
+} ff_ds_stats_t;
+
+typedef struct ff_ds_t ff_ds_t;
+
+/* Start listing directory pcPath. Returns NULL (and sets errno) on error. */
+ff_ds_t *ff_ds_open(const char *pcPath);
+
+/* Get the next entry.
+Returns 1 if there was one, 0 at the end of the directory, or -1 (and sets errno) on error. */
+int ff_ds_next(ff_ds_t *pxScan, ff_ds_entry_t *pxEntry);
+
+void ff_ds_get_stats(const ff_ds_t *pxScan, ff_ds_stats_t *pxStats);
+
+void ff_ds_close(ff_ds_t *pxScan);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,63 @@
+/*
+ * ff_extents.h
+ *
+ * Per-file extent map cache.
+ *
+ * Remembers where the clusters of an open file are on the disk as
+ * (file cluster, disk cluster, run length) tuples, built lazily as the
+ * cluster chain is walked. A seek far into a large file can then be
+ * resolved without re-reading the FAT.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+//
+#include "FreeRTOS.h"
+#include "ff_headers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of files that can have an extent map at the same time */
+#ifndef FF_EXTENT_MAPS
+#  define FF_EXTENT_MAPS 4
+#endif
+/* Number of runs of contiguous clusters remembered per file.
+Beyond this, lookups walk the chain from the end of the last remembered run. */
+#ifndef FF_EXTENTS_PER_MAP
+#  define FF_EXTENTS_PER_MAP 32
+#endif
+
+typedef struct ff_extent_t {
+    uint32_t ulFileCluster;  // Index of the first cluster of the run within the file
+    uint32_t ulDiskCluster;  // First cluster of the run on the disk
+    uint32_t ulLength;       // Number of clusters in the run
+} ff_extent_t;
+
+/* Give an open file an extent map.
+Returns false if all maps are in use; the file can still be used normally. */
+bool ff_extents_attach(FF_FILE *pxFile);
+
+/* Release the extent map of a file, if it has one.
+Must be called before the file is closed. */
+void ff_extents_detach(FF_FILE *pxFile);
+
+/* Find the run of contiguous clusters containing file cluster ulFileCluster.
+On return, *pxExtent is trimmed to start at ulFileCluster.
+Works whether or not the file has an extent map; without one, the chain is walked.
+Returns false if the cluster is beyond the end of the chain or on error
+(in which case *pxError is set). */
+bool ff_extents_lookup(FF_FILE *pxFile, uint32_t ulFileCluster, ff_extent_t *pxExtent,
+                       FF_Error_t *pxError);
+
+/* Same as ff_fseek, but uses the extent map to position the file on the
+right cluster, so that the next ff_fread or ff_fwrite doesn't walk the FAT. */
+int ff_extents_fseek(FF_FILE *pxFile, long lOffset, int iWhence);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,71 @@
+/*
+ * ff_freemap.h
+ *
+ * In-RAM summary of free space on a mounted volume.
+ *
+ * After a volume is mounted, a low priority task reads the whole FAT
+ * with large multiple block reads and records the number of free clusters
+ * in each group of clusters. Once it is done, the volume's free cluster
+ * count is known, so free space queries don't have to scan the FAT,
+ * and ff_fallocate can use the summary to find a free run quickly.
+ * FreeRTOS+FAT's own allocator doesn't use the summary: it only gets a starting point
+ * for its search (ulLastFreeCluster), once, when the summary is complete.
+ * Until then, everything falls back to scanning the FAT as before.
+ *
+ * The free cluster count is FreeRTOS+FAT's own, which it keeps up to date.
+ * The per-group counts are not: FreeRTOS+FAT's allocator has no hook to update them,
+ * so they go stale as soon as anything else allocates or frees clusters.
+ * ff_freemap_hint counts a group again before suggesting it
+ * (flushing the sector cache, then reading the group's FAT sectors in one multiple block read,
+ * as the builder does), so groups that have filled up are caught;
+ * but space freed since the summary was built isn't seen until the volume is mounted again.
+ * An allocator must still check the FAT entries themselves.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+//
+#include "FreeRTOS.h"
+#include "ff_headers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Build a free space summary for each volume when it is mounted */
+#ifndef FF_USE_FREEMAP
+#  define FF_USE_FREEMAP 0
+#endif
+/* Number of FAT sectors read at a time.
+This is also the granularity of the summary. */
+#ifndef FF_FREEMAP_READ_SECTORS
+#  define FF_FREEMAP_READ_SECTORS 16
+#endif
+
+/* Start building the summary in the background. Called by FF_SDDiskMount. */
+bool ff_freemap_start(FF_Disk_t *pxDisk);
+
+/* Stop building and release the summary. Called by FF_SDDiskUnmount. */
+void ff_freemap_stop(FF_Disk_t *pxDisk);
+
+/* True once the summary is complete */
+bool ff_freemap_ready(FF_Disk_t *pxDisk);
+
+/* Number of free clusters on the volume.
+Uses the summary when it's ready; otherwise, falls back to FF_GetFreeSize. */
+uint32_t ff_freemap_free_clusters(FF_Disk_t *pxDisk, FF_Error_t *pxError);
+
+/* Suggest a cluster at which to start looking for ulCount free clusters in a row.
+Returns 0 if there is no suggestion (e.g., the summary isn't ready).
+The caller must hold the FAT lock (FF_LockFAT). */
+uint32_t ff_freemap_hint(FF_Disk_t *pxDisk, uint32_t ulCount);
+
+/* Record that ulCount clusters starting at ulCluster have been allocated */
+void ff_freemap_claim(FF_Disk_t *pxDisk, uint32_t ulCluster, uint32_t ulCount);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,74 @@
+/*
+ * ff_logger.h
+ *
+ * High rate record logger.
+ *
+ * Producers (tasks or interrupt handlers) append records to a RAM ring buffer.
+ * They never wait for the SD card: if the ring is full, the record is dropped and counted.
+ * A writer task packs the ring's contents into chunks of whole sectors
+ * and appends them to a preallocated file with multiple block writes.
+ * Every commit period, the partial chunk is written and the directory entry is updated,
+ * so that at most one commit period of data is lost in a crash.
+ * Files are rotated by size and/or age, always between records.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+//
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ff_logger_config_t {
+    const char *pcDirectory;    // Where to put the files, e.g., "/sd0/log". Created if needed.
+    /* strftime pattern for file names, e.g., "%Y%m%d-%H%M%S.bin".
+    Without a '%', an 8.3 name whose stem gets a sequence number (see ff_di_next_name),
+    e.g., "LOG.BIN" for LOG00000.BIN, LOG00001.BIN, ... */
+    const char *pcNamePattern;
+    size_t xRingSize;           // Bytes of RAM to buffer records in
+    size_t xChunkSize;          // Bytes per write; a multiple of 512 (e.g., 4096, or an AU)
+    size_t xPreallocate;        // Bytes to reserve (ff_fallocate) in each new file; 0: none
+    size_t xMaxFileSize;        // Rotate when a file gets this big; 0: no limit
+    uint32_t ulMaxFileSeconds;  // Rotate when a file gets this old; 0: no limit
+    uint32_t ulCommitMs;        // How often to make the data written so far durable
+    UBaseType_t uxPriority;     // Writer task priority
+} ff_logger_config_t;
+
+typedef struct ff_logger_stats_t {
+    uint32_t ulRecords;          // Records accepted
+    uint64_t ullBytes;           // Bytes accepted
+    uint32_t ulDroppedRecords;   // Records dropped because the ring was full
+    uint64_t ullDroppedBytes;
+    size_t xRingHighWater;       // Most bytes waiting in the ring at once
+    uint32_t ulChunks;           // Whole chunks written
+    uint32_t ulCommits;
+    uint32_t ulFiles;            // Files opened
+    uint32_t ulMaxChunkWriteUs;  // Longest time to write a chunk
+    uint32_t ulErrors;           // File system errors
+} ff_logger_stats_t;
+
+typedef struct ff_logger_t ff_logger_t;
+
+/* Start a logger. The configuration is copied (but the strings are not).
+Returns NULL if there isn't enough memory. */
+ff_logger_t *ff_logger_start(const ff_logger_config_t *pxConfig);
+
+/* Flush everything, close the file, and free the logger */
+void ff_logger_stop(ff_logger_t *pxLogger);
+
+/* Append a record. Returns false if it was dropped because the ring is full.
+The record is copied with interrupts masked, so keep records short. */
+bool ff_logger_write(ff_logger_t *pxLogger, const void *pvRecord, size_t xLength);
+bool ff_logger_write_from_isr(ff_logger_t *pxLogger, const void *pvRecord, size_t xLength);
+
+void ff_logger_get_stats(ff_logger_t *pxLogger, ff_logger_stats_t *pxStats);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
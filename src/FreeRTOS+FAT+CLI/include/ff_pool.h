@@ -0,0 +1,62 @@
+/*
+ * ff_pool.h
+ *
+ * Deterministic memory allocator for FreeRTOS+FAT.
+ *
+ * Small requests (FF_FILE handles, per-file sector buffers, stream cookies,
+ * directory iterators, ...) come from fixed-size block pools, one per size class,
+ * each with a free list, so allocation and release are O(1) and don't fragment the heap.
+ * Larger requests (e.g., the IO manager's sector cache) are carved from a static arena
+ * with a bump pointer. Blocks freed in reverse order of allocation
+ * (as caches are on unmount) are returned to the arena.
+ * If a pool or the arena is exhausted, the request falls back to pvPortMalloc.
+ *
+ * To use it, define FF_USE_POOL to 1 and, in FreeRTOSFATConfig.h,
+ *   #define ffconfigMALLOC( size ) ff_pool_malloc( size )
+ *   #define ffconfigFREE( ptr ) ff_pool_free( ptr )
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FF_USE_POOL
+#  define FF_USE_POOL 0
+#endif
+
+/* Number of blocks in each size class */
+#ifndef FF_POOL_COUNT_32
+#  define FF_POOL_COUNT_32 16
+#endif
+#ifndef FF_POOL_COUNT_64
+#  define FF_POOL_COUNT_64 8
+#endif
+#ifndef FF_POOL_COUNT_128
+#  define FF_POOL_COUNT_128 8
+#endif
+#ifndef FF_POOL_COUNT_256
+#  define FF_POOL_COUNT_256 4
+#endif
+#ifndef FF_POOL_COUNT_512
+#  define FF_POOL_COUNT_512 8
+#endif
+
+/* Size in bytes of the arena for requests bigger than 512 bytes */
+#ifndef FF_POOL_ARENA_SIZE
+#  define FF_POOL_ARENA_SIZE (8 * 1024)
+#endif
+
+void *ff_pool_malloc(size_t xSize);
+void ff_pool_free(void *pv);
+
+/* Print usage: in use, high water mark, and fallbacks to pvPortMalloc */
+void ff_pool_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,38 @@
+/*
+ * ff_syscalls.h
+ *
+ * POSIX file descriptors backed by FreeRTOS+FAT files.
+ *
+ * When FF_SYSCALLS is defined to 1, this library provides the newlib system calls
+ * _open, _close, _read, _write, _lseek, _fstat and _isatty.
+ * Then open, read, write, lseek and close (and fopen, fread, fwrite, etc.,
+ * which newlib builds on them) work on files in mounted FreeRTOS+FAT volumes.
+ * Paths are FreeRTOS+FAT paths, starting with the mount point (e.g., "/sd0/data.bin").
+ *
+ * read and write go straight to ff_fread_direct and ff_fwrite_direct,
+ * without passing through a FILE buffer.
+ * File descriptors 0, 1 and 2 are still the Pico's stdio.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FF_SYSCALLS
+#  define FF_SYSCALLS 0
+#endif
+
+/* Maximum number of files open through file descriptors at the same time */
+#ifndef FF_SYSCALLS_MAX_FILES
+#  define FF_SYSCALLS_MAX_FILES 8
+#endif
+
+/* First file descriptor given out; 0, 1 and 2 are stdin, stdout and stderr */
+#define FF_SYSCALLS_FIRST_FD 3
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
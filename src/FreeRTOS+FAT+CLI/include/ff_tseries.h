@@ -0,0 +1,85 @@
+/*
+ * ff_tseries.h
+ *
+ * Binary time series files with a sparse time index.
+ *
+ * A series is a data file of fixed-size blocks (a multiple of 512 bytes),
+ * each with a header followed by fixed-width records:
+ *   block header (ff_ts_block_hdr_t)
+ *   record: uint32_t time offset from the block's first time, then the payload
+ * Times are int64_t in whatever unit the application chooses (e.g., ms since the epoch),
+ * and must not decrease.
+ *
+ * Beside it is a sidecar index, "<name>.idx": a header (ff_ts_index_hdr_t)
+ * and then one int64_t per block, the time of the block's first record.
+ * To find a time range, a reader binary searches the index and then reads
+ * the blocks that cover the range with multiple block reads.
+ * The index can be rebuilt from the block headers, and if it is missing or short,
+ * the reader binary searches the block headers instead.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FF_TS_BLOCK_MAGIC 0x31425354  // "TSB1"
+#define FF_TS_INDEX_MAGIC 0x31495354  // "TSI1"
+
+typedef struct ff_ts_block_hdr_t {
+    uint32_t ulMagic;
+    uint32_t ulBlock;       // Position of this block in the file
+    int64_t llFirstTime;    // Time of the first record
+    uint32_t ulBlockSize;   // Bytes per block, including this header
+    uint16_t usRecordSize;  // Bytes of payload per record
+    uint16_t usCount;       // Records in this block
+} ff_ts_block_hdr_t;
+
+typedef struct ff_ts_index_hdr_t {
+    uint32_t ulMagic;
+    uint32_t ulBlockSize;
+} ff_ts_index_hdr_t;
+
+typedef struct ff_ts_writer_t ff_ts_writer_t;
+typedef struct ff_ts_reader_t ff_ts_reader_t;
+
+/* Create (or truncate) a series of records with xRecordSize bytes of payload,
+in blocks of xBlockSize bytes (a multiple of 512; e.g., 4096).
+Returns NULL (and sets errno) on error. */
+ff_ts_writer_t *ff_ts_create(const char *pcPath, size_t xRecordSize, size_t xBlockSize);
+
+/* Append a record. Returns 0, or -1 (and sets errno) on error.
+EINVAL if llTime is before the previous record's. */
+int ff_ts_append(ff_ts_writer_t *pxWriter, int64_t llTime, const void *pvRecord);
+
+/* Write the partly filled block and the index, and flush */
+int ff_ts_sync(ff_ts_writer_t *pxWriter);
+
+int ff_ts_close(ff_ts_writer_t *pxWriter);
+
+/* Open a series for reading. Queries read up to xBufferBlocks blocks at a time.
+Returns NULL (and sets errno) on error. */
+ff_ts_reader_t *ff_ts_open(const char *pcPath, size_t xBufferBlocks);
+
+/* Called for each record in a query. Return false to stop. */
+typedef bool (*ff_ts_visitor_t)(int64_t llTime, const void *pvRecord, void *pvArg);
+
+/* Visit every record with llFrom <= time <= llTo, in order.
+Returns the number of records visited, or -1 (and sets errno) on error. */
+long ff_ts_query(ff_ts_reader_t *pxReader, int64_t llFrom, int64_t llTo,
+                 ff_ts_visitor_t pxVisitor, void *pvArg);
+
+void ff_ts_close_reader(ff_ts_reader_t *pxReader);
+
+/* Rewrite the index of a series from its block headers */
+int ff_ts_reindex(const char *pcPath);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
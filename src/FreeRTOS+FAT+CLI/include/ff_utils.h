@@ -14,6 +14,7 @@ specific language governing permissions and limitations under the License.
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 //
 #include "FreeRTOS.h"
@@ -30,6 +31,7 @@ void unmount(const char *devName);
 void eject(const char *name);
 void getFree(FF_Disk_t *pxDisk, uint64_t *pFreeMB, unsigned *pFreePct);
 FF_Error_t ff_set_fsize( FF_FILE *pxFile ); // Make Filesize equal to the FilePointer
+int ff_fallocate(FF_FILE *pxFile, size_t size, bool bExtendSize); // Reserve contiguous clusters
 int mkdirhier(char *path);
 void ls(const char *path);
 sd_card_t *get_current_sd_card_p();
@@ -0,0 +1,83 @@
+/*
+ * ff_writebuf.h
+ *
+ * Bounded-latency writes.
+ *
+ * SD cards stall now and then (typically for 100 to 250 ms) while they
+ * do garbage collection, and whoever calls ff_fwrite waits it out.
+ * A write buffer sits between the caller and the file:
+ * ff_writebuf_write copies the data into a RAM buffer and returns,
+ * waiting at most xMaxBlock for room, and a background task drains
+ * the buffer to the card. If there still isn't room after xMaxBlock,
+ * the write is dropped (all of it: writes are never split) and counted.
+ *
+ * The statistics tell how big the buffer has to be:
+ * compare xHighWater to the buffer size, and ulMaxWriteUs to how long
+ * the buffer lasts at your data rate.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+//
+#include "FreeRTOS.h"
+#include "ff_headers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ff_writebuf_config_t {
+    size_t xBufferSize;      // Bytes of RAM
+    size_t xChunkSize;       // Bytes per write to the card; a multiple of 512
+    TickType_t xMaxBlock;    // Longest a writer will wait for room in the buffer
+    TickType_t xIdleFlush;   // Write out a partial chunk after this long without a full one
+    uint32_t ulStallMs;      // Writes to the card that take longer than this count as stalls
+    UBaseType_t uxPriority;  // Drain task priority
+} ff_writebuf_config_t;
+
+typedef struct ff_writebuf_stats_t {
+    uint64_t ullBytes;         // Bytes accepted
+    uint32_t ulWrites;         // Writes accepted
+    uint64_t ullDroppedBytes;  // Bytes dropped because there was no room in time
+    uint32_t ulDrops;          // Writes dropped
+    size_t xHighWater;         // Most bytes in the buffer at once
+    uint32_t ulMaxBlockUs;     // Longest a writer waited for room
+    uint64_t ullWritten;       // Bytes written to the card
+    uint32_t ulCardWrites;     // Writes to the card
+    uint32_t ulStalls;         // Writes to the card that took longer than ulStallMs
+    uint32_t ulMaxWriteUs;     // Longest write to the card
+    uint32_t ulErrors;         // File system errors (the data is lost)
+    int iLastError;            // errno of the last error
+} ff_writebuf_stats_t;
+
+typedef struct ff_writebuf_t ff_writebuf_t;
+
+/* Start buffering writes to pxFile, which must be open for writing.
+The configuration is copied. Until ff_writebuf_close,
+pxFile must not be used except through the write buffer.
+Returns NULL if there isn't enough memory. */
+ff_writebuf_t *ff_writebuf_open(FF_FILE *pxFile, const ff_writebuf_config_t *pxConfig);
+
+/* Copy xLength bytes into the buffer, waiting at most xMaxBlock for room.
+Returns false if they were dropped. Safe to call from several tasks. */
+bool ff_writebuf_write(ff_writebuf_t *pxWb, const void *pvData, size_t xLength);
+
+/* Wait until everything accepted so far is written and the file system cache is flushed.
+Other tasks may go on writing meanwhile: what they add later isn't waited for.
+Returns false on timeout. */
+bool ff_writebuf_flush(ff_writebuf_t *pxWb, TickType_t xTimeout);
+
+/* Drain the buffer, stop the task and free the buffer. The file is left open.
+Returns false if any data was lost. */
+bool ff_writebuf_close(ff_writebuf_t *pxWb);
+
+void ff_writebuf_get_stats(ff_writebuf_t *pxWb, ff_writebuf_stats_t *pxStats);
+void ff_writebuf_print_stats(ff_writebuf_t *pxWb);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
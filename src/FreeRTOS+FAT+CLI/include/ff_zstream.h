@@ -0,0 +1,83 @@
+/*
+ * ff_zstream.h
+ *
+ * Compressed streams of numeric samples.
+ *
+ * Samples are frames of usChannels int32_t values (e.g., one reading from each sensor).
+ * Each channel is delta coded against the previous frame, and the deltas are
+ * zigzag coded (so small negative numbers are small) and written as
+ * variable-length integers (7 bits per byte). Slowly changing signals
+ * typically shrink by 4 to 8 times.
+ *
+ * The file is a sequence of fixed-size blocks (a multiple of 512 bytes),
+ * each with a header (ff_zs_block_hdr_t) giving the number of the first frame in it.
+ * Each block is coded independently (the first frame in a block is coded against zero),
+ * so a reader can start anywhere: ff_zr_read binary searches the block headers
+ * for the block holding the requested frame, and decodes from there.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FF_ZS_BLOCK_MAGIC 0x3142535A  // "ZSB1"
+
+typedef struct ff_zs_block_hdr_t {
+    uint32_t ulMagic;
+    uint32_t ulBlock;        // Position of this block in the file
+    uint64_t ullFirstFrame;  // Number of the first frame in this block
+    uint32_t ulBlockSize;    // Bytes per block, including this header
+    uint16_t usChannels;     // Samples per frame
+    uint16_t usReserved;
+    uint32_t ulFrames;       // Frames in this block
+    uint32_t ulBytes;        // Bytes of coded data following this header
+} ff_zs_block_hdr_t;
+
+typedef struct ff_zs_stats_t {
+    uint64_t ullFrames;
+    uint64_t ullRawBytes;    // As int32_t samples
+    uint64_t ullCodedBytes;  // Written to the file, including headers and padding
+    uint64_t ullEncodeUs;    // Time spent compressing
+    uint64_t ullWriteUs;     // Time spent writing
+    uint32_t ulBlocks;
+} ff_zs_stats_t;
+
+typedef struct ff_zwriter_t ff_zwriter_t;
+typedef struct ff_zreader_t ff_zreader_t;
+
+/* Create (or truncate) a compressed stream of frames of usChannels samples,
+in blocks of xBlockSize bytes (a multiple of 512; e.g., 4096).
+Returns NULL (and sets errno) on error. */
+ff_zwriter_t *ff_zw_create(const char *pcPath, uint16_t usChannels, size_t xBlockSize);
+
+/* Append xFrames frames (xFrames * usChannels samples, frame by frame).
+Returns 0, or -1 (and sets errno) on error. */
+int ff_zw_write(ff_zwriter_t *pxWriter, const int32_t *plSamples, size_t xFrames);
+
+/* Write the partly filled block (it is written again when it fills) and flush */
+int ff_zw_sync(ff_zwriter_t *pxWriter);
+
+void ff_zw_get_stats(ff_zwriter_t *pxWriter, ff_zs_stats_t *pxStats);
+
+int ff_zw_close(ff_zwriter_t *pxWriter);
+
+/* Open a compressed stream for reading. Returns NULL (and sets errno) on error. */
+ff_zreader_t *ff_zr_open(const char *pcPath);
+
+uint16_t ff_zr_channels(ff_zreader_t *pxReader);
+
+/* Read up to xFrames frames starting at frame number ullFrame.
+Returns the number of frames read (0 at the end), or -1 (and sets errno) on error. */
+long ff_zr_read(ff_zreader_t *pxReader, uint64_t ullFrame, int32_t *plSamples, size_t xFrames);
+
+void ff_zr_close(ff_zreader_t *pxReader);
+
+#ifdef __cplusplus
+}
+#endif
+/* [] END OF FILE */
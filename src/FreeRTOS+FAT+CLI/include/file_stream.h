@@ -17,6 +17,12 @@
 extern "C" {
 #endif
 
+/* Size of the stream buffer. Should be a multiple of the 512 byte sector size.
+A bigger buffer means longer multiple block writes. */
+#ifndef FILE_STREAM_BUFFER_SIZE
+#  define FILE_STREAM_BUFFER_SIZE (8 * 512)
+#endif
+
 FILE *open_file_stream( const char *pcFile, const char *pcMode );
 
 #ifdef __cplusplus
@@ -6,13 +6,16 @@ extern "C" {
 #endif
 
 enum {
-    PRIORITY_stdioTask = configMAX_PRIORITIES - 2
+    PRIORITY_stdioTask = configMAX_PRIORITIES - 2,
+    PRIORITY_freemapTask = tskIDLE_PRIORITY + 1,
+    PRIORITY_initCardsTask = tskIDLE_PRIORITY + 1
 };
 
 enum {
 	NOTIFICATION_IX_reserved,
     NOTIFICATION_IX_STDIO,
-	NOTIFICATION_IX_SD_SPI  
+	NOTIFICATION_IX_SD_SPI,
+	NOTIFICATION_IX_FREEMAP  // Builder task has stopped (ff_freemap_stop)
 };
 
 #ifdef __cplusplus
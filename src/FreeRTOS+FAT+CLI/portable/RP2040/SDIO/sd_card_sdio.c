@@ -498,6 +498,9 @@ static bool sd_sdio_test_com(sd_card_t *sd_card_p) {
         if (!success) {
             // Card no longer sensed - ensure card is initialized once re-attached
             sd_card_p->state.m_Status |= STA_NOINIT;
+#if SD_FAST_RESUME
+            sd_resume_forget(sd_card_p);
+#endif
         }
     } else {
         // Do a "light" version of init, just enough to test com
@@ -532,6 +535,34 @@ static void gpio_conf(uint gpio, gpio_function_t fn, bool pullup, bool pulldown,
     // See rp2040_sdio_init
 }
 
+#if SD_FAST_RESUME
+// If the card was not removed or power cycled since it was last initialized,
+// it is still selected ("tran" state) at its old RCA, with the 4-bit bus
+// and 512-byte block length already set. A CMD13 at full speed confirms it.
+static bool sd_sdio_resume(sd_card_t *sd_card_p)
+{
+    if (!sd_resume_load(sd_card_p))
+        return false;
+    if (!sd_card_p->sdio_if_p->baud_rate)
+        return false;
+    if (!rp2040_sdio_init(sd_card_p, calculate_clk_div(sd_card_p->sdio_if_p->baud_rate)))
+        return false;
+    STATE.ongoing_wr_mlt_blk = false;
+
+    uint32_t reply = 0;
+    sdio_status_t status = rp2040_sdio_command_R1(sd_card_p, CMD13_SEND_STATUS, STATE.rca, &reply);
+    if (status != SDIO_OK)
+        return false;
+    // Card Status CURRENT_STATE [12:9]: 4 = tran
+    if (4 != ((reply >> 9) & 0xF))
+    {
+        DBG_PRINTF("%s: card status 0x%lx\n", __func__, (unsigned long)reply);
+        return false;
+    }
+    return true;
+}
+#endif
+
 static DSTATUS sd_sdio_init(sd_card_t *sd_card_p) {
     sd_lock(sd_card_p);
 
@@ -557,10 +588,24 @@ static DSTATUS sd_sdio_init(sd_card_t *sd_card_p) {
     gpio_conf(sd_card_p->sdio_if_p->D2_gpio,  GPIO_FUNC_PIO1, true, false, false, true);
     gpio_conf(sd_card_p->sdio_if_p->D3_gpio,  GPIO_FUNC_PIO1, true, false, false, true);
 
+#if SD_FAST_RESUME
+    if (sd_sdio_resume(sd_card_p)) {
+        DBG_PRINTF("SD card resumed\n");
+        sd_card_p->state.m_Status &= ~STA_NOINIT;
+        sd_unlock(sd_card_p);
+        return sd_card_p->state.m_Status;
+    }
+    sd_resume_forget(sd_card_p);
+    sd_card_p->state.card_type = SDCARD_NONE;
+#endif
+
     bool ok = sd_sdio_begin(sd_card_p);
     if (ok) {
         // The card is now initialized
         sd_card_p->state.m_Status &= ~STA_NOINIT;
+#if SD_FAST_RESUME
+        sd_resume_save(sd_card_p);
+#endif
     }
     sd_unlock(sd_card_p);
     return sd_card_p->state.m_Status;
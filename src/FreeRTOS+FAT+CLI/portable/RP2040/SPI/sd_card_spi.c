@@ -1547,6 +1547,9 @@ static bool sd_spi_test_com(sd_card_t *sd_card_p) {
             if (!success) {
                 // Card no longer sensed - ensure card is initialized once re-attached
                 sd_card_p->state.m_Status |= STA_NOINIT;
+#if SD_FAST_RESUME
+                sd_resume_forget(sd_card_p);
+#endif
             }
         } else {
             // SD card is currently holding DO which is sufficient enough to know it's still
@@ -1586,6 +1589,68 @@ static bool sd_spi_test_com(sd_card_t *sd_card_p) {
     return success;
 }
 
+/**
+ * @brief Sets up the chip select GPIO.
+ *
+ * Chip select is active-low, so we'll initialise it to a driven-high state.
+ * sd_deinit releases the pin, so this is repeated on each initialization.
+ *
+ * @param sd_card_p Pointer to the SD card object.
+ */
+static void sd_spi_ss_init(sd_card_t *sd_card_p) {
+    if ((uint)-1 == sd_card_p->spi_if_p->ss_gpio) return;
+    gpio_init(sd_card_p->spi_if_p->ss_gpio);
+    gpio_put(sd_card_p->spi_if_p->ss_gpio, 1);  // Avoid any glitches when enabling output
+    gpio_set_dir(sd_card_p->spi_if_p->ss_gpio, GPIO_OUT);
+    gpio_put(sd_card_p->spi_if_p->ss_gpio, 1);  // In case set_dir does anything
+    if (sd_card_p->spi_if_p->set_drive_strength) {
+        gpio_set_drive_strength(sd_card_p->spi_if_p->ss_gpio,
+                                sd_card_p->spi_if_p->ss_gpio_drive_strength);
+    }
+}
+
+#if SD_FAST_RESUME
+/**
+ * @brief Try to pick up a card that was identified earlier.
+ *
+ * If the card has not been removed or power cycled since it was last
+ * initialized, it is still in SPI mode, out of the idle state, and set up
+ * for 512-byte blocks. In that case, there is no need for the slow
+ * CMD0/CMD8/ACMD41 sequence at 400 kHz: a CMD13 at full speed and a CID
+ * comparison are enough to tell that it's the same card.
+ *
+ * The card must be acquired (selected) by the caller.
+ *
+ * @param sd_card_p Pointer to the SD card object.
+ * @return true if the card was resumed, false if a full initialization is needed.
+ */
+static bool sd_spi_resume(sd_card_t *sd_card_p) {
+    if (!sd_resume_load(sd_card_p)) return false;
+    if (SDCARD_V2HC != sd_card_p->state.card_type) return false;
+    sd_card_p->spi_if_p->state.ongoing_mlt_blk_wrt = false;
+
+    sd_spi_go_high_frequency(sd_card_p);
+
+    // CMD13: Response R2. R1 is in the high byte.
+    uint32_t response = R1_NO_RESPONSE;
+    int err = sd_cmd(sd_card_p, CMD13_SEND_STATUS, 0, false, &response);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != err || (response >> 8) & R1_IDLE_STATE) {
+        DBG_PRINTF("%s: CMD13 failed: err=%d response=0x%" PRIx32 "\n", __func__, err, response);
+        return false;
+    }
+    // Make sure it's the same card
+    CID_t cid;
+    if (SD_BLOCK_DEVICE_ERROR_NONE != sd_cmd(sd_card_p, CMD10_SEND_CID, 0x0, false, 0))
+        return false;
+    if (read_bytes(sd_card_p, cid, sizeof(CID_t)) != 0) return false;
+    if (memcmp(cid, sd_card_p->state.CID, sizeof(CID_t))) {
+        DBG_PRINTF("%s: A different card is in the socket\n", __func__);
+        return false;
+    }
+    return true;
+}
+#endif
+
 /**
  * @brief Initializes the SD card over SPI.
  *
@@ -1622,12 +1687,24 @@ DSTATUS sd_card_spi_init(sd_card_t *sd_card_p) {
         return sd_card_p->state.m_Status;
     }
 
-    // Initialize the member variables
-    sd_card_p->state.card_type = SDCARD_NONE;
+    sd_spi_ss_init(sd_card_p);
 
     // Acquire the SD card
     sd_spi_acquire(sd_card_p);
 
+#if SD_FAST_RESUME
+    if (sd_spi_resume(sd_card_p)) {
+        DBG_PRINTF("SD card resumed\n");
+        sd_card_p->state.m_Status &= ~STA_NOINIT;
+        sd_release(sd_card_p);
+        return sd_card_p->state.m_Status;
+    }
+    sd_resume_forget(sd_card_p);
+#endif
+
+    // Initialize the member variables
+    sd_card_p->state.card_type = SDCARD_NONE;
+
     // Initialize the medium
     int err = sd_init_medium(sd_card_p);
     if (SD_BLOCK_DEVICE_ERROR_NONE != err) {
@@ -1676,6 +1753,9 @@ DSTATUS sd_card_spi_init(sd_card_t *sd_card_p) {
 
     // The card is now initialized
     sd_card_p->state.m_Status &= ~STA_NOINIT;
+#if SD_FAST_RESUME
+    sd_resume_save(sd_card_p);
+#endif
 
     // Release the SD card
     sd_release(sd_card_p);
@@ -1723,17 +1803,7 @@ void sd_spi_ctor(sd_card_t *sd_card_p) {
     sd_card_p->get_num_sectors = sd_spi_sectors;
     sd_card_p->sd_test_com = sd_spi_test_com;
 
-    // Chip select is active-low, so we'll initialise it to a
-    // driven-high state.
-    if ((uint)-1 == sd_card_p->spi_if_p->ss_gpio) return;
-    gpio_init(sd_card_p->spi_if_p->ss_gpio);
-    gpio_put(sd_card_p->spi_if_p->ss_gpio, 1);  // Avoid any glitches when enabling output
-    gpio_set_dir(sd_card_p->spi_if_p->ss_gpio, GPIO_OUT);
-    gpio_put(sd_card_p->spi_if_p->ss_gpio, 1);  // In case set_dir does anything
-    if (sd_card_p->spi_if_p->set_drive_strength) {
-        gpio_set_drive_strength(sd_card_p->spi_if_p->ss_gpio,
-                                sd_card_p->spi_if_p->ss_gpio_drive_strength);
-    }
+    sd_spi_ss_init(sd_card_p);
 }
 
 /* [] END OF FILE */
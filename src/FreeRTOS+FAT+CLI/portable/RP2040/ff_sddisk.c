@@ -46,10 +46,16 @@ specific language governing permissions and limitations under the License.
  */
 
 #include <stdio.h>
+#include <string.h>
+//
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
 //
 #include "ff_headers.h"
 //
 #include "delays.h"
+#include "ff_freemap.h"
 #include "hw_config.h"
 #include "sd_card.h"
 #include "sd_card_constants.h"
@@ -69,6 +75,7 @@ static int32_t prvWrite(uint8_t *pucSource,      /* Source of data to be written
                         FF_Disk_t *pxDisk)       /* Describes the disk being written to. */
 {
     sd_card_t *sd_card_p = pxDisk->pvTag;
+    ++sd_card_p->state.cache_stats.writes;
     int status = sd_card_p->write_blocks(pxDisk->pvTag, pucSource, ulSectorNumber, ulSectorCount);
     if (SD_BLOCK_DEVICE_ERROR_NONE == status) {
         return FF_ERR_NONE;
@@ -84,6 +91,7 @@ static int32_t prvRead(uint8_t *pucDestination, /* Destination for data being re
                        FF_Disk_t *pxDisk)       /* Describes the disk being read from. */
 {
     sd_card_t *sd_card_p = pxDisk->pvTag;
+    ++sd_card_p->state.cache_stats.reads;
     int status = sd_card_p->read_blocks(pxDisk->pvTag, pucDestination, ulSectorNumber, ulSectorCount);
     if (SD_BLOCK_DEVICE_ERROR_NONE == status) {
         return FF_ERR_NONE;
@@ -97,7 +105,25 @@ BaseType_t FF_SDDiskDetect(FF_Disk_t *pxDisk) {
     return sd_card_detect(pxDisk->pvTag);
 }
 
-bool disk_init(sd_card_t *sd_card_p) {
+#if FF_CACHE_STATS
+/* Link with -Wl,--wrap=FF_GetBuffer to count cache hits and misses.
+A lookup that causes a read from the card is a miss;
+one that causes a write to the card is an eviction of a modified sector. */
+FF_Buffer_t *__real_FF_GetBuffer(FF_IOManager_t *pxIOManager, uint32_t ulSector, uint8_t ucMode);
+FF_Buffer_t *__wrap_FF_GetBuffer(FF_IOManager_t *pxIOManager, uint32_t ulSector, uint8_t ucMode) {
+    sd_card_t *sd_card_p = pxIOManager->xBlkDevice.pxDisk->pvTag;
+    sd_cache_stats_t *stats_p = &sd_card_p->state.cache_stats;
+    uint32_t reads = stats_p->reads;
+    uint32_t writes = stats_p->writes;
+    FF_Buffer_t *pxBuffer = __real_FF_GetBuffer(pxIOManager, ulSector, ucMode);
+    ++stats_p->lookups;
+    if (stats_p->reads != reads) ++stats_p->misses;
+    if (stats_p->writes != writes) ++stats_p->evictions;
+    return pxBuffer;
+}
+#endif
+
+static bool create_io_manager(sd_card_t *sd_card_p) {
     FF_Error_t xError = 0;
     FF_CreationParameters_t xParameters = {};
     uint32_t xIOManagerCacheSize;
@@ -106,15 +132,61 @@ bool disk_init(sd_card_t *sd_card_p) {
     else
         xIOManagerCacheSize = 4 * SECTOR_SIZE;
 
+    /* Check the validity of the xIOManagerCacheSize parameter. */
+    configASSERT((xIOManagerCacheSize % SECTOR_SIZE) == 0);
+    configASSERT((xIOManagerCacheSize >= (2 * SECTOR_SIZE)));
+
+    memset(&sd_card_p->state.cache_stats, 0, sizeof sd_card_p->state.cache_stats);
+
+    /* Create the IO manager that will be used to control the disk –
+     the FF_CreationParameters_t structure completed with the required
+     parameters, then passed into the FF_CreateIOManager() function.
+     If pucCacheMemory is NULL, the IO manager allocates the cache itself. */
+    xParameters.pucCacheMemory = sd_card_p->cache_p;
+    xParameters.ulMemorySize = xIOManagerCacheSize;
+    xParameters.ulSectorSize = SECTOR_SIZE;
+    xParameters.fnWriteBlocks = prvWrite;
+    xParameters.fnReadBlocks = prvRead;
+    xParameters.pxDisk = &sd_card_p->state.ff_disk;
+    xParameters.pvSemaphore = (void *)xSemaphoreCreateRecursiveMutex();
+    xParameters.xBlockDeviceIsReentrant = pdTRUE;
+    sd_card_p->state.ff_disk.pxIOManager = FF_CreateIOManger(&xParameters, &xError);
+
+    if ((sd_card_p->state.ff_disk.pxIOManager != NULL) && (FF_isERR(xError) == pdFALSE)) {
+        return true;
+    } else {
+        FF_PRINTF("FF_SDDiskInit: FF_CreateIOManger: %s\n",
+                  (const char *)FF_GetErrMessage(xError));
+        if (xParameters.pvSemaphore) vSemaphoreDelete(xParameters.pvSemaphore);
+        return false;
+    }
+}
+
+/* FF_DeleteIOManager leaves the semaphore to whoever created it */
+static void delete_io_manager(FF_Disk_t *pxDisk) {
+    SemaphoreHandle_t xSemaphore = pxDisk->pxIOManager->pvSemaphore;
+    FF_DeleteIOManager(pxDisk->pxIOManager);
+    pxDisk->pxIOManager = NULL;
+    if (xSemaphore) vSemaphoreDelete(xSemaphore);
+}
+
+/* Held while a card is initialized, and by FF_SDDiskInitAll until all of them are,
+so that a card isn't initialized twice at once */
+static SemaphoreHandle_t get_init_mutex(void) {
+    static StaticSemaphore_t init_mutex_buf;
+    static SemaphoreHandle_t init_mutex;
+    taskENTER_CRITICAL();
+    if (!init_mutex) init_mutex = xSemaphoreCreateMutexStatic(&init_mutex_buf);
+    taskEXIT_CRITICAL();
+    return init_mutex;
+}
+
+static bool init_one(sd_card_t *sd_card_p) {
     if (sd_card_p->state.ff_disk.xStatus.bIsInitialised != pdFALSE) {
         // Already initialized
         return true;
     }
 
-    /* Check the validity of the xIOManagerCacheSize parameter. */
-    configASSERT((xIOManagerCacheSize % SECTOR_SIZE) == 0);
-    configASSERT((xIOManagerCacheSize >= (2 * SECTOR_SIZE)));
-
     // Initialize the media driver
     bool rc = sd_init_driver();
     if (!rc) return rc;
@@ -133,34 +205,28 @@ bool disk_init(sd_card_t *sd_card_p) {
      write functions. */
     sd_card_p->state.ff_disk.ulNumberOfSectors = sd_card_p->state.sectors;
 
-    /* Create the IO manager that will be used to control the disk –
-     the FF_CreationParameters_t structure completed with the required
-     parameters, then passed into the FF_CreateIOManager() function. */
-    xParameters.pucCacheMemory = NULL;
-    xParameters.ulMemorySize = xIOManagerCacheSize;
-    xParameters.ulSectorSize = SECTOR_SIZE;
-    xParameters.fnWriteBlocks = prvWrite;
-    xParameters.fnReadBlocks = prvRead;
-    xParameters.pxDisk = &sd_card_p->state.ff_disk;
-    xParameters.pvSemaphore = (void *)xSemaphoreCreateRecursiveMutex();
-    xParameters.xBlockDeviceIsReentrant = pdTRUE;
-    sd_card_p->state.ff_disk.pxIOManager = FF_CreateIOManger(&xParameters, &xError);
-
-    if ((sd_card_p->state.ff_disk.pxIOManager != NULL) && (FF_isERR(xError) == pdFALSE)) {
+    if (create_io_manager(sd_card_p)) {
         /* Record that the disk has been initialised. */
         sd_card_p->state.ff_disk.xStatus.bIsInitialised = pdTRUE;
     } else {
         /* The disk structure was allocated, but the disk’s IO manager could
          not be allocated, so free the disk again. */
         FF_SDDiskDelete(&sd_card_p->state.ff_disk);
-        FF_PRINTF("FF_SDDiskInit: FF_CreateIOManger: %s\n",
-                  (const char *)FF_GetErrMessage(xError));
         configASSERT(!"disk's IO manager could not be allocated!");
         sd_card_p->state.ff_disk.xStatus.bIsInitialised = pdFALSE;
     }
     return true;
 }
 
+// Waits for FF_SDDiskInitAll, if it is running
+bool disk_init(sd_card_t *sd_card_p) {
+    SemaphoreHandle_t init_mutex = get_init_mutex();
+    xSemaphoreTake(init_mutex, portMAX_DELAY);
+    bool rc = init_one(sd_card_p);
+    xSemaphoreGive(init_mutex);
+    return rc;
+}
+
 // Doesn't do an automatic mount, since card might need to be formatted first.
 // State after return is disk is initialized, but not mounted.
 FF_Disk_t *FF_SDDiskInit(const char *pcName) {
@@ -175,16 +241,91 @@ FF_Disk_t *FF_SDDiskInit(const char *pcName) {
         return NULL;
 }
 
+typedef struct init_job_t {
+    sd_card_t *sd_card_p;
+    SemaphoreHandle_t done;
+} init_job_t;
+
+static void init_task(void *arg) {
+    init_job_t *job_p = arg;
+    init_one(job_p->sd_card_p);
+    xSemaphoreGive(job_p->done);
+    vTaskDelete(NULL);
+}
+
+// Initialize all of the cards at once, each in its own task,
+// so that the slow identification phases overlap.
+// Cards on the same SPI bus still take turns, since the bus is locked.
+// Returns the number of disks that are initialized (but not mounted).
+// Meanwhile, disk_init (e.g., FF_SDDiskInit) in other tasks waits for it to finish.
+size_t FF_SDDiskInitAll(void) {
+    size_t n = sd_get_num();
+    // sd_init_driver asserts that there are cards,
+    // and a counting semaphore can't have a maximum count of 0
+    if (!n || !sd_init_driver()) return 0;
+
+    SemaphoreHandle_t init_mutex = get_init_mutex();
+    xSemaphoreTake(init_mutex, portMAX_DELAY);
+    init_job_t *jobs = pvPortMalloc(n * sizeof(init_job_t));
+    StaticSemaphore_t done_buf;
+    SemaphoreHandle_t done = xSemaphoreCreateCountingStatic(n, 0, &done_buf);
+    size_t started = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sd_card_t *sd_card_p = sd_get_by_num(i);
+        if (!sd_card_p) continue;
+        if (jobs) {
+            jobs[i].sd_card_p = sd_card_p;
+            jobs[i].done = done;
+            if (pdPASS == xTaskCreate(init_task, sd_card_p->device_name, 1024, &jobs[i],
+                                      uxTaskPriorityGet(NULL), NULL)) {
+                ++started;
+                continue;
+            }
+        }
+        // Couldn't get a task: do it here
+        init_one(sd_card_p);
+    }
+    while (started--) xSemaphoreTake(done, portMAX_DELAY);
+    vSemaphoreDelete(done);
+    vPortFree(jobs);
+    xSemaphoreGive(init_mutex);
+
+    size_t initialized = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sd_card_t *sd_card_p = sd_get_by_num(i);
+        if (sd_card_p && sd_card_p->state.ff_disk.xStatus.bIsInitialised) ++initialized;
+    }
+    return initialized;
+}
+
 BaseType_t FF_SDDiskReinit(FF_Disk_t *pxDisk) {
     return disk_init(pxDisk->pvTag) ? pdPASS : pdFAIL;
 }
 
+// Change the size of the IO manager's cache, and optionally supply its memory.
+// The disk must not be mounted. pucBuffer may be NULL to have the cache allocated,
+// or point to ulSectors * 512 bytes that stay valid for as long as the disk exists.
+// If the disk isn't initialized yet, the new size takes effect when it is.
+BaseType_t FF_SDDiskResizeCache(FF_Disk_t *pxDisk, uint32_t ulSectors, uint8_t *pucBuffer) {
+    if (!pxDisk || pxDisk->xStatus.bIsMounted || ulSectors < 2) return pdFAIL;
+    sd_card_t *sd_card_p = pxDisk->pvTag;
+    if (!sd_card_p) return pdFAIL;
+    sd_card_p->cache_sectors = ulSectors;
+    sd_card_p->cache_p = pucBuffer;
+    if (!pxDisk->xStatus.bIsInitialised) return pdPASS;
+    if (pxDisk->pxIOManager) delete_io_manager(pxDisk);
+    if (create_io_manager(sd_card_p)) return pdPASS;
+    pxDisk->xStatus.bIsInitialised = pdFALSE;
+    return pdFAIL;
+}
+
 /* Unmount the volume */
 // FF_SDDiskUnmount() calls FF_Unmount().
 BaseType_t FF_SDDiskUnmount(FF_Disk_t *pxDisk) {
     if (!pxDisk->xStatus.bIsMounted) return FF_ERR_NONE;
     sd_card_t *sd_card_p = pxDisk->pvTag;
     const char *name = sd_card_p->device_name;
+    ff_freemap_stop(pxDisk);
     FF_PRINTF("Invalidating %s\n", name);
     int32_t rc = FF_Invalidate(pxDisk->pxIOManager);
     if (0 == rc)
@@ -219,6 +360,9 @@ BaseType_t FF_SDDiskMount(FF_Disk_t *pDisk) {
         FF_PRINTF("FF_Mount error: %s\n", FF_GetErrMessage(e));
     } else {
         pDisk->xStatus.bIsMounted = pdTRUE;
+#if FF_USE_FREEMAP
+        ff_freemap_start(pDisk);
+#endif
     }
     return e;
 }
@@ -231,7 +375,7 @@ BaseType_t FF_SDDiskDelete(FF_Disk_t *pxDisk) {
                 sd_card_p->deinit(sd_card_p);
             }
             if (pxDisk->pxIOManager) {
-                FF_DeleteIOManager(pxDisk->pxIOManager);
+                delete_io_manager(pxDisk);
             }
             pxDisk->ulSignature = 0;
             pxDisk->xStatus.bIsInitialised = pdFALSE;
@@ -277,9 +421,7 @@ BaseType_t FF_SDDiskShowPartition(FF_Disk_t *pxDisk) {
                 break;
         }
 
-        FF_GetFreeSize(pxIOManager, &xError);
-
-        ullFreeSectors = pxIOManager->xPartition.ulFreeClusterCount *
+        ullFreeSectors = (uint64_t)ff_freemap_free_clusters(pxDisk, &xError) *
                          pxIOManager->xPartition.ulSectorsPerCluster;
         if (pxIOManager->xPartition.ulDataSectors == (uint32_t)0) {
             iPercentageFree = 0;
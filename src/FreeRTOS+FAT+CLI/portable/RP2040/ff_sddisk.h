@@ -49,6 +49,13 @@ extern "C" {
 #include "sd_card.h"
 #include "ff_headers.h"
 
+/* Count IO manager cache hits, misses and evictions in sd_card_t.state.cache_stats.
+Requires linking with -Wl,--wrap=FF_GetBuffer. Without it, only the read and write
+requests to the card are counted. */
+#ifndef FF_CACHE_STATS
+#  define FF_CACHE_STATS 0
+#endif
+
 /* Return non-zero if the SD-card is present.
 The parameter 'pxDisk' may be null, unless device locking is necessary. */
 BaseType_t FF_SDDiskDetect( FF_Disk_t *pxDisk );
@@ -56,8 +63,14 @@ BaseType_t FF_SDDiskDetect( FF_Disk_t *pxDisk );
 /* Create a RAM disk, supplying enough memory to hold N sectors of 512 bytes each */
 FF_Disk_t *FF_SDDiskInit( const char *pcName );
 
+/* Initialize every configured card concurrently; returns the number initialized */
+size_t FF_SDDiskInitAll( void );
+
 BaseType_t FF_SDDiskReinit( FF_Disk_t *pxDisk );
 
+/* Change the size (and optionally the memory) of the IO manager's cache while unmounted */
+BaseType_t FF_SDDiskResizeCache( FF_Disk_t *pxDisk, uint32_t ulSectors, uint8_t *pucBuffer );
+
 /* Unmount the volume */
 BaseType_t FF_SDDiskUnmount( FF_Disk_t *pDisk );
 
@@ -13,6 +13,7 @@ specific language governing permissions and limitations under the License.
 */
 
 /* Standard includes. */
+#include <stddef.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <inttypes.h>
@@ -23,6 +24,7 @@ specific language governing permissions and limitations under the License.
 //
 #include "SDIO/SdioCard.h"
 #include "SPI/sd_card_spi.h"
+#include "crc.h"
 #include "hw_config.h"  // Hardware Configuration of the SPI and SD Card "objects"
 #include "my_debug.h"
 #include "sd_card_constants.h"
@@ -37,6 +39,75 @@ specific language governing permissions and limitations under the License.
 
 static bool driver_initialized;
 
+#if SD_FAST_RESUME
+/* What we learned about each card the last time it was identified.
+Kept in RAM that the C runtime does not zero, so that it survives
+a soft reset as well as an unmount/mount cycle. */
+typedef struct sd_resume_t {
+    uint32_t magic;
+    card_type_t card_type;
+    CSD_t CSD;
+    CID_t CID;
+    uint32_t sectors;
+    uint32_t rca;  // SDIO Relative Card Address
+    uint32_t ocr;  // SDIO Operating Conditions Register
+    uint8_t crc;
+} sd_resume_t;
+static const uint32_t sd_resume_magic = 0x5D5E5E4D;
+static sd_resume_t resume_ram[SD_RESUME_SLOTS] __attribute__((section(".uninitialized_data")));
+
+static sd_resume_t *resume_slot(sd_card_t *sd_card_p) {
+    for (size_t i = 0; i < sd_get_num() && i < count_of(resume_ram); ++i)
+        if (sd_get_by_num(i) == sd_card_p) return &resume_ram[i];
+    return NULL;
+}
+static bool resume_valid(sd_resume_t *rec_p) {
+    return rec_p && sd_resume_magic == rec_p->magic &&
+           crc7((uint8_t *)rec_p, offsetof(sd_resume_t, crc)) == rec_p->crc;
+}
+
+/* Remember the identity of a freshly initialized card */
+void sd_resume_save(sd_card_t *sd_card_p) {
+    sd_resume_t *rec_p = resume_slot(sd_card_p);
+    if (!rec_p) return;
+    memset(rec_p, 0, sizeof *rec_p);
+    rec_p->magic = sd_resume_magic;
+    rec_p->card_type = sd_card_p->state.card_type;
+    memcpy(rec_p->CSD, sd_card_p->state.CSD, sizeof(CSD_t));
+    memcpy(rec_p->CID, sd_card_p->state.CID, sizeof(CID_t));
+    rec_p->sectors = sd_card_p->state.sectors;
+    if (SD_IF_SDIO == sd_card_p->type) {
+        rec_p->rca = sd_card_p->sdio_if_p->state.rca;
+        rec_p->ocr = sd_card_p->sdio_if_p->state.ocr;
+    }
+    rec_p->crc = crc7((uint8_t *)rec_p, offsetof(sd_resume_t, crc));
+}
+/* Restore the remembered identity into the card state.
+Returns false if there is nothing trustworthy to resume from.
+The caller must still confirm that the card answers (CMD13). */
+bool sd_resume_load(sd_card_t *sd_card_p) {
+    sd_resume_t *rec_p = resume_slot(sd_card_p);
+    if (!resume_valid(rec_p)) return false;
+    sd_card_p->state.card_type = rec_p->card_type;
+    memcpy(sd_card_p->state.CSD, rec_p->CSD, sizeof(CSD_t));
+    memcpy(sd_card_p->state.CID, rec_p->CID, sizeof(CID_t));
+    sd_card_p->state.sectors = rec_p->sectors;
+    if (SD_IF_SDIO == sd_card_p->type) {
+        sd_card_p->sdio_if_p->state.rca = rec_p->rca;
+        sd_card_p->sdio_if_p->state.ocr = rec_p->ocr;
+    }
+    return true;
+}
+bool sd_resume_available(sd_card_t *sd_card_p) {
+    return resume_valid(resume_slot(sd_card_p));
+}
+/* The card was removed, or didn't answer as expected */
+void sd_resume_forget(sd_card_t *sd_card_p) {
+    sd_resume_t *rec_p = resume_slot(sd_card_p);
+    if (rec_p) rec_p->magic = 0;
+}
+#endif
+
 // An SD card can only do one thing at a time.
 void sd_lock(sd_card_t *sd_card_p) {
     myASSERT(sd_card_p);
@@ -83,6 +154,9 @@ bool sd_card_detect(sd_card_t *sd_card_p) {
         // The socket is now empty
         sd_card_p->state.m_Status |= (STA_NODISK | STA_NOINIT);
         sd_card_p->state.card_type = SDCARD_NONE;
+#if SD_FAST_RESUME
+        sd_resume_forget(sd_card_p);
+#endif
         EMSG_PRINTF("No SD card detected!\r\n");
         return false;
     }
@@ -144,8 +218,19 @@ bool sd_init_driver() {
                      * device can cause a bus conflict due to an accidental response of the
                      * MMC/SDC. Therefore the MMC/SDC should be initialized to put it into the
                      * SPI mode prior to access any other device attached to the same SPI bus.
+                     *
+                     * A card that we can resume is already in SPI mode (e.g., after a soft
+                     * reset), and sending it CMD0 now would throw that away.
+                     *
+                     * If nothing else is on the bus, this can wait until the card is first
+                     * initialized (see SD_LAZY_INIT).
                      */
-                    sd_go_idle_state(sd_card_p);
+#if !SD_LAZY_INIT
+#  if SD_FAST_RESUME
+                    if (!sd_resume_available(sd_card_p))
+#  endif
+                        sd_go_idle_state(sd_card_p);
+#endif
                     break;
                 case SD_IF_SDIO:
                     myASSERT(sd_card_p->sdio_if_p);
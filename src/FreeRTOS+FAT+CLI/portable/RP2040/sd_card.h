@@ -41,6 +41,23 @@ specific language governing permissions and limitations under the License.
 extern "C" {
 #endif
 
+/* Fast resume: remember each card's CID, CSD, and bus settings so that
+a remount (or soft reset) with the same card still in the socket can skip
+the full identification sequence. */
+#ifndef SD_FAST_RESUME
+#  define SD_FAST_RESUME 1
+#endif
+#ifndef SD_RESUME_SLOTS
+#  define SD_RESUME_SLOTS 4  // Cards beyond this many are always fully initialized
+#endif
+
+/* Lazy initialization: don't put SPI cards into SPI mode (CMD0) in
+sd_init_driver; leave it to the first initialization of each card.
+Only safe if the SD cards are the only devices on their SPI buses. */
+#ifndef SD_LAZY_INIT
+#  define SD_LAZY_INIT 0
+#endif
+
 typedef uint8_t BYTE;
 /* Status of Disk Functions */
 typedef BYTE DSTATUS;
@@ -97,6 +114,18 @@ typedef struct sd_sdio_if_t {
     sd_sdio_if_state_t state;
 } sd_sdio_if_t;
 
+// IO manager cache statistics (see FF_CACHE_STATS in ff_sddisk.h)
+typedef struct sd_cache_stats_t {
+    uint32_t lookups;    // Sector lookups in the cache (FF_GetBuffer)
+    uint32_t misses;     // Lookups that had to read the sector from the card
+    uint32_t evictions;  // Lookups that had to write a modified sector back to make room
+    /* Requests made through the IO manager's driver (cache fills and write backs,
+    and the whole-sector transfers FreeRTOS+FAT makes straight to or from a caller's buffer).
+    Not counted: ff_direct, ff_dirscan and ff_freemap, which call read_blocks and write_blocks themselves. */
+    uint32_t reads;
+    uint32_t writes;
+} sd_cache_stats_t;
+
 typedef struct sd_card_state_t {
     DSTATUS m_Status;       // Card status
     card_type_t card_type;  // Assigned dynamically
@@ -108,6 +137,8 @@ typedef struct sd_card_state_t {
     StaticSemaphore_t mutex_buffer;  // Guard semaphore storage, assigned dynamically
     TaskHandle_t owner;              // Assigned dynamically
     FF_Disk_t ff_disk;               // FreeRTOS+FAT "disk" using this device
+    struct ff_freemap_t *freemap_p;  // Free space summary (see ff_freemap.h)
+    sd_cache_stats_t cache_stats;    // IO manager cache statistics
 } sd_card_state_t;
 
 typedef struct sd_card_t sd_card_t;
@@ -127,7 +158,9 @@ struct sd_card_t {
     uint card_detected_true;  // Varies with card socket; ignored if !use_card_detect
     bool card_detect_use_pull;
     bool card_detect_pull_hi;
-    size_t cache_sectors;
+    size_t cache_sectors;     // Size of the IO manager cache in sectors; 0: default (4)
+    uint8_t *cache_p;         // Optional: cache memory of cache_sectors * 512 bytes.
+                              // NULL: allocate with ffconfigMALLOC.
 
     /* The following fields are state variables and not part of the configuration.
     They are dynamically assigned. */
@@ -159,6 +192,13 @@ bool sd_allocation_unit(sd_card_t *sd_card_p, size_t *au_size_bytes_p);
 sd_card_t *sd_get_by_name(const char *const name);
 sd_card_t *sd_get_by_mount_point(const char *const name);
 
+#if SD_FAST_RESUME
+void sd_resume_save(sd_card_t *sd_card_p);
+bool sd_resume_load(sd_card_t *sd_card_p);
+bool sd_resume_available(sd_card_t *sd_card_p);
+void sd_resume_forget(sd_card_t *sd_card_p);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
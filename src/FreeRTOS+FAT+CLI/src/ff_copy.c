@@ -0,0 +1,224 @@
+/*
+ * ff_copy.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "event_groups.h"
+#include "queue.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "FreeRTOS_strerror.h"
+#include "ff_direct.h"
+#include "ff_utils.h"
+#include "my_debug.h"
+//
+#include "ff_copy.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#define EV_READER_DONE (1 << 0)
+#define EV_WRITER_DONE (1 << 1)
+
+/* A buffer shorter than xBufferSize (possibly empty) is the last one */
+typedef struct {
+    uint8_t *pucData;
+    size_t xLength;
+} copy_buf_t;
+
+typedef struct {
+    ff_copy_config_t xConfig;
+    FF_FILE *pxSource;
+    FF_FILE *pxDest;
+    QueueHandle_t xEmpty;  // Buffers for the reader to fill
+    QueueHandle_t xFull;   // Buffers for the writer to empty
+    EventGroupHandle_t xEvents;
+    volatile bool bAbort;
+    int iError;            // errno of the first error
+    ff_copy_stats_t xStats;
+} copy_t;
+
+static inline uint64_t prvMicros(void) {
+    return to_us_since_boot(get_absolute_time());
+}
+
+static void prvFail(copy_t *pxCopy, int iError) {
+    taskENTER_CRITICAL();
+    if (!pxCopy->iError) pxCopy->iError = iError;
+    pxCopy->bAbort = true;
+    taskEXIT_CRITICAL();
+}
+
+static void prvReaderTask(void *pvParameters) {
+    copy_t *pxCopy = pvParameters;
+    const size_t xBufferSize = pxCopy->xConfig.xBufferSize;
+    copy_buf_t xBuf;
+    do {
+        if (pdTRUE != xQueueReceive(pxCopy->xEmpty, &xBuf, 0)) {
+            ++pxCopy->xStats.ulReaderWaits;
+            xQueueReceive(pxCopy->xEmpty, &xBuf, portMAX_DELAY);
+        }
+        if (pxCopy->bAbort) {
+            xBuf.xLength = 0;
+        } else {
+            uint64_t ullStart = prvMicros();
+            stdioSET_ERRNO(0);
+            xBuf.xLength = ff_fread_direct(xBuf.pucData, 1, xBufferSize, pxCopy->pxSource);
+            int iError = stdioGET_ERRNO();
+            pxCopy->xStats.ullReadUs += prvMicros() - ullStart;
+            if (xBuf.xLength < xBufferSize && iError) {
+                DBG_PRINTF("%s: ff_fread_direct: %s (%d)\n", __func__,
+                           FreeRTOS_strerror(iError), iError);
+                prvFail(pxCopy, iError);
+                xBuf.xLength = 0;
+            }
+        }
+        // Never blocks: there are only xBuffers buffers
+        xQueueSend(pxCopy->xFull, &xBuf, portMAX_DELAY);
+    } while (xBuf.xLength == xBufferSize);
+    xEventGroupSetBits(pxCopy->xEvents, EV_READER_DONE);
+    vTaskDelete(NULL);
+}
+
+static void prvWriterTask(void *pvParameters) {
+    copy_t *pxCopy = pvParameters;
+    const size_t xBufferSize = pxCopy->xConfig.xBufferSize;
+    copy_buf_t xBuf;
+    do {
+        if (pdTRUE != xQueueReceive(pxCopy->xFull, &xBuf, 0)) {
+            ++pxCopy->xStats.ulWriterWaits;
+            xQueueReceive(pxCopy->xFull, &xBuf, portMAX_DELAY);
+        }
+        // After an error, keep handing buffers back until the reader sends the last one
+        if (xBuf.xLength && !pxCopy->bAbort) {
+            uint64_t ullStart = prvMicros();
+            size_t xN = ff_fwrite_direct(xBuf.pucData, 1, xBuf.xLength, pxCopy->pxDest);
+            pxCopy->xStats.ullWriteUs += prvMicros() - ullStart;
+            pxCopy->xStats.ullBytes += xN;
+            if (xN != xBuf.xLength) {
+                int iError = stdioGET_ERRNO();
+                DBG_PRINTF("%s: ff_fwrite_direct: %s (%d)\n", __func__,
+                           FreeRTOS_strerror(iError), iError);
+                prvFail(pxCopy, iError ? iError : pdFREERTOS_ERRNO_EIO);
+            }
+        }
+        xQueueSend(pxCopy->xEmpty, &xBuf, portMAX_DELAY);
+    } while (xBuf.xLength == xBufferSize);
+    xEventGroupSetBits(pxCopy->xEvents, EV_WRITER_DONE);
+    vTaskDelete(NULL);
+}
+
+/* Runs the reader and writer tasks until the copy is done.
+Returns false if they couldn't be started. */
+static bool prvPipeline(copy_t *pxCopy) {
+    const ff_copy_config_t *pxConfig = &pxCopy->xConfig;
+    bool bOk = false;
+    uint8_t *pucBuffers = pvPortMalloc(pxConfig->xBuffers * pxConfig->xBufferSize);
+    pxCopy->xEmpty = xQueueCreate(pxConfig->xBuffers, sizeof(copy_buf_t));
+    pxCopy->xFull = xQueueCreate(pxConfig->xBuffers, sizeof(copy_buf_t));
+    pxCopy->xEvents = xEventGroupCreate();
+    if (pucBuffers && pxCopy->xEmpty && pxCopy->xFull && pxCopy->xEvents) {
+        for (size_t i = 0; i < pxConfig->xBuffers; ++i) {
+            copy_buf_t xBuf = {.pucData = pucBuffers + i * pxConfig->xBufferSize};
+            xQueueSend(pxCopy->xEmpty, &xBuf, 0);
+        }
+        if (pdPASS == xTaskCreate(prvWriterTask, "copy writer", 1024, pxCopy,
+                                  pxConfig->uxPriority, NULL)) {
+            if (pdPASS == xTaskCreate(prvReaderTask, "copy reader", 1024, pxCopy,
+                                      pxConfig->uxPriority, NULL)) {
+                xEventGroupWaitBits(pxCopy->xEvents, EV_READER_DONE | EV_WRITER_DONE, pdFALSE,
+                                    pdTRUE, portMAX_DELAY);
+                bOk = true;
+            } else {
+                // Stop the writer
+                pxCopy->bAbort = true;
+                copy_buf_t xBuf = {.xLength = 0};
+                xQueueReceive(pxCopy->xEmpty, &xBuf, 0);
+                xBuf.xLength = 0;
+                xQueueSend(pxCopy->xFull, &xBuf, 0);
+                xEventGroupWaitBits(pxCopy->xEvents, EV_WRITER_DONE, pdFALSE, pdTRUE,
+                                    portMAX_DELAY);
+            }
+        }
+    }
+    if (pxCopy->xEmpty) vQueueDelete(pxCopy->xEmpty);
+    if (pxCopy->xFull) vQueueDelete(pxCopy->xFull);
+    if (pxCopy->xEvents) vEventGroupDelete(pxCopy->xEvents);
+    vPortFree(pucBuffers);
+    return bOk;
+}
+
+int ff_copy(const char *pcSource, const char *pcDest, const ff_copy_config_t *pxConfig,
+            ff_copy_stats_t *pxStats) {
+    copy_t *pxCopy = pvPortMalloc(sizeof(copy_t));
+    if (!pxCopy) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        return -1;
+    }
+    memset(pxCopy, 0, sizeof *pxCopy);
+    if (pxConfig) {
+        pxCopy->xConfig = *pxConfig;
+    } else {
+        pxCopy->xConfig.xBufferSize = 16 * 1024;
+        pxCopy->xConfig.xBuffers = 4;
+        pxCopy->xConfig.uxPriority = uxTaskPriorityGet(NULL);
+    }
+    configASSERT(pxCopy->xConfig.xBufferSize && 0 == pxCopy->xConfig.xBufferSize % 512);
+    configASSERT(pxCopy->xConfig.xBuffers >= 2);
+
+    uint64_t ullStart = prvMicros();
+    int iError = 0;
+    pxCopy->pxSource = ff_fopen(pcSource, "r");
+    if (!pxCopy->pxSource) {
+        iError = stdioGET_ERRNO();
+    } else {
+        pxCopy->pxDest = ff_fopen(pcDest, "w");
+        if (!pxCopy->pxDest) iError = stdioGET_ERRNO();
+    }
+    if (!iError) {
+        // Not fatal: without a contiguous run, the file is just written the usual way
+        size_t xSize = ff_filelength(pxCopy->pxSource);
+        if (xSize && -1 == ff_fallocate(pxCopy->pxDest, xSize, false)) {
+            TRACE_PRINTF("%s: ff_fallocate: %s\n", __func__,
+                         FreeRTOS_strerror(stdioGET_ERRNO()));
+        }
+
+        if (!prvPipeline(pxCopy))
+            iError = pdFREERTOS_ERRNO_ENOMEM;
+        else
+            iError = pxCopy->iError;
+        ff_seteof(pxCopy->pxDest);  // Give back any unused reservation
+    }
+    if (pxCopy->pxDest && -1 == ff_fclose(pxCopy->pxDest) && !iError)
+        iError = stdioGET_ERRNO();
+    if (pxCopy->pxSource) ff_fclose(pxCopy->pxSource);
+    pxCopy->xStats.ullUs = prvMicros() - ullStart;
+    if (pxStats) *pxStats = pxCopy->xStats;
+    vPortFree(pxCopy);
+    if (iError) {
+        stdioSET_ERRNO(iError);
+        return -1;
+    }
+    return 0;
+}
+
+void ff_copy_print_stats(const ff_copy_stats_t *pxStats) {
+    double dSecs = pxStats->ullUs / 1e6;
+    printf("Copied %llu bytes in %.3f s (%.1f KiB/s)\n", pxStats->ullBytes, dSecs,
+           dSecs ? pxStats->ullBytes / dSecs / 1024 : 0);
+    // Reading and writing overlap, so their sum can be more than the elapsed time
+    printf("Reading: %.3f s; writing: %.3f s\n", pxStats->ullReadUs / 1e6,
+           pxStats->ullWriteUs / 1e6);
+    printf("Reader waited for the writer %lu times; writer waited for the reader %lu times\n",
+           (unsigned long)pxStats->ulReaderWaits, (unsigned long)pxStats->ulWriterWaits);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,174 @@
+/*
+ * ff_direct.c
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+//
+#include "FreeRTOS.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_extents.h"
+#include "my_debug.h"
+#include "sd_card.h"
+#include "sd_card_constants.h"
+//
+#include "ff_direct.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+int prvFFErrorToErrno(FF_Error_t xError);  // In ff_stdio.c
+
+static inline uint32_t prvMin(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+/* The fast path relies on FreeRTOS+FAT handling partial sectors of file data in
+the FF_FILE's own buffer rather than in the IO manager's sector cache.
+Whole sectors written with ff_fwrite can still be in the cache, though
+(e.g., new clusters that are written again later), so see prvDropCached. */
+static bool prvCanGoDirect(const FF_FILE *pxFile) {
+#if ffconfigOPTIMISE_UNALIGNED_ACCESS
+    if (pxFile->pxIOManager->xPartition.usBlkSize != sd_block_size) return false;
+    if (pxFile->ucState & FF_BUFSTATE_WRITTEN) return false;
+    return true;
+#else
+    (void)pxFile;
+    return false;
+#endif
+}
+
+/* Direct writes go around the IO manager, so any copy of the same sectors in its cache is stale.
+Drop them (even if modified: the data being written replaces them), so that a later read
+doesn't return old data and a later flush doesn't write it back over the new.
+The lock isn't held for the write itself, so other files aren't held up by a slow card;
+nothing else can read these sectors meanwhile, since a file open for writing can't be opened again. */
+static void prvDropCached(FF_IOManager_t *pxIOManager, uint32_t ulLBA, uint32_t ulCount) {
+    FF_PendSemaphore(pxIOManager->pvSemaphore);
+    for (uint16_t i = 0; i < pxIOManager->usCacheSize; ++i) {
+        FF_Buffer_t *pxBuffer = &pxIOManager->pxBuffers[i];
+        // A buffer in use can't be taken away; nothing else uses this file's sectors, though
+        if (pxBuffer->bValid && !pxBuffer->usNumHandles && pxBuffer->ulSector - ulLBA < ulCount) {
+            TRACE_PRINTF("%s: sector %lu\n", __func__, pxBuffer->ulSector);
+            pxBuffer->bValid = pdFALSE;
+            pxBuffer->bModified = pdFALSE;
+        }
+    }
+    FF_ReleaseSemaphore(pxIOManager->pvSemaphore);
+}
+
+/* Transfer up to ulSectors whole sectors, starting at the file pointer
+(which must be on a sector boundary), as long as they lie in one run of
+contiguous clusters. Returns the number of sectors transferred:
+0 if the file pointer is not in an allocated cluster, or on error. */
+static uint32_t prvTransfer(FF_FILE *pxFile, uint8_t *pucBuffer, uint32_t ulSectors, bool bWrite,
+                            FF_Error_t *pxError) {
+    FF_IOManager_t *pxIOManager = pxFile->pxIOManager;
+    sd_card_t *sd_card_p = pxIOManager->xBlkDevice.pxDisk->pvTag;
+    const uint32_t ulSectorsPerCluster = pxIOManager->xPartition.ulSectorsPerCluster;
+    const uint32_t ulClusterSize = ulSectorsPerCluster * sd_block_size;
+
+    uint32_t ulFileCluster = pxFile->ulFilePointer / ulClusterSize;
+    uint32_t ulSectorInCluster = (pxFile->ulFilePointer % ulClusterSize) / sd_block_size;
+    ff_extent_t xExtent;
+    if (!ff_extents_lookup(pxFile, ulFileCluster, &xExtent, pxError)) return 0;
+
+    uint32_t ulCount = xExtent.ulLength * ulSectorsPerCluster - ulSectorInCluster;
+    ulCount = prvMin(ulCount, ulSectors);
+    ulCount = prvMin(ulCount, FF_DIRECT_MAX_SECTORS);
+    uint32_t ulLBA = FF_Cluster2LBA(pxIOManager, xExtent.ulDiskCluster) + ulSectorInCluster;
+    TRACE_PRINTF("%s: %s %lu sectors at LBA %lu\n", __func__, bWrite ? "write" : "read",
+                 ulCount, ulLBA);
+
+    block_dev_err_t rc;
+    if (bWrite) {
+        prvDropCached(pxIOManager, ulLBA, ulCount);
+        rc = sd_card_p->write_blocks(sd_card_p, pucBuffer, ulLBA, ulCount);
+    } else {
+        rc = sd_card_p->read_blocks(sd_card_p, pucBuffer, ulLBA, ulCount);
+    }
+    if (SD_BLOCK_DEVICE_ERROR_NONE != rc) {
+        *pxError = FF_ERR_IOMAN_DRIVER_FATAL_ERROR | FF_ERRFLAG;
+        return 0;
+    }
+    pxFile->ulFilePointer += ulCount * sd_block_size;
+
+    /* Keep FreeRTOS+FAT's notion of the current cluster in step with the
+    file pointer, so that the next normal access doesn't walk the chain. */
+    uint32_t ulOffset = pxFile->ulFilePointer / ulClusterSize - ulFileCluster;
+    if (ulOffset >= xExtent.ulLength) ulOffset = xExtent.ulLength - 1;
+    pxFile->ulCurrentCluster = ulFileCluster + ulOffset;
+    pxFile->ulAddrCurrentCluster = xExtent.ulDiskCluster + ulOffset;
+#if ffconfigOPTIMISE_UNALIGNED_ACCESS
+    // The handle's sector buffer no longer matches the file pointer
+    pxFile->ucState = FF_BUFSTATE_INVALID;
+#endif
+    return ulCount;
+}
+
+static size_t prvDirect(uint8_t *pucBuffer, size_t xSize, size_t xItems, FF_FILE *pxFile,
+                        bool bWrite) {
+    if (!pxFile || !prvCanGoDirect(pxFile) ||
+        !(pxFile->ucMode & (bWrite ? FF_MODE_WRITE : FF_MODE_READ))) {
+        if (bWrite)
+            return ff_fwrite(pucBuffer, xSize, xItems, pxFile);
+        else
+            return ff_fread(pucBuffer, xSize, xItems, pxFile);
+    }
+    FF_Error_t xError = FF_ERR_NONE;
+    const size_t xBytes = xSize * xItems;
+    size_t xDone = 0;
+
+    if (bWrite && (pxFile->ucMode & FF_MODE_APPEND)) ff_fseek(pxFile, 0, FF_SEEK_END);
+    if (!bWrite) {
+        // Anything still dirty in the sector cache must be on the card before reading around it
+        xError = FF_FlushCache(pxFile->pxIOManager);
+    }
+    while (xDone < xBytes && !FF_isERR(xError)) {
+        size_t xRemaining = xBytes - xDone;
+        uint32_t ulSectors = 0;
+        uint32_t ulHead = pxFile->ulFilePointer % sd_block_size;
+        if (!ulHead) {
+            size_t xLimit = xRemaining;
+            if (!bWrite && pxFile->ulFilePointer + xLimit > pxFile->ulFileSize)
+                xLimit = pxFile->ulFileSize - pxFile->ulFilePointer;
+            ulSectors = xLimit / sd_block_size;
+        }
+        if (ulSectors) {
+            uint32_t ulDone = prvTransfer(pxFile, pucBuffer + xDone, ulSectors, bWrite, &xError);
+            if (ulDone) {
+                xDone += ulDone * sd_block_size;
+                if (bWrite && pxFile->ulFilePointer > pxFile->ulFileSize)
+                    pxFile->ulFileSize = pxFile->ulFilePointer;
+                continue;
+            }
+            if (FF_isERR(xError)) break;
+            // Not in an allocated cluster: let FreeRTOS+FAT extend the file
+            ulHead = 0;
+        }
+        /* Use the normal path up to the next sector boundary,
+        or for whatever can't be done directly */
+        size_t xChunk = ulHead ? sd_block_size - ulHead : xRemaining;
+        if (xChunk > xRemaining) xChunk = xRemaining;
+        size_t xCount;
+        if (bWrite)
+            xCount = ff_fwrite(pucBuffer + xDone, 1, xChunk, pxFile);
+        else
+            xCount = ff_fread(pucBuffer + xDone, 1, xChunk, pxFile);
+        xDone += xCount;
+        if (xCount < xChunk) return xDone / xSize;  // errno set by ff_fread or ff_fwrite
+    }
+    if (FF_isERR(xError)) stdioSET_ERRNO(prvFFErrorToErrno(xError));
+    return xDone / xSize;
+}
+
+size_t ff_fread_direct(void *pvBuffer, size_t xSize, size_t xItems, FF_FILE *pxStream) {
+    return prvDirect(pvBuffer, xSize, xItems, pxStream, false);
+}
+
+size_t ff_fwrite_direct(const void *pvBuffer, size_t xSize, size_t xItems, FF_FILE *pxStream) {
+    return prvDirect((uint8_t *)pvBuffer, xSize, xItems, pxStream, true);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,722 @@
+/*
+ * ff_dirindex.c
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+//
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "my_debug.h"
+//
+#include "ff_dirindex.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#define DI_EMPTY 0           // ulHash of a slot never used
+#define DI_TOMBSTONE 0xFFFF  // usEntry of a name that was removed
+#define DI_NO_ENTRY 0xFFFE   // usEntry of a name whose entry number isn't known
+
+typedef struct {
+    uint32_t ulHash;
+    uint32_t ulCluster;  // First cluster, or 0 if not known yet
+    uint32_t ulName;     // Offset of the name in pcNames
+    uint16_t usEntry;    // Number of the (short) directory entry
+    uint8_t ucAttrib;
+    uint8_t ucReserved;
+} di_slot_t;
+
+typedef struct {
+    char pcStem[8];   // "" if unused
+    char pcExt[4];
+    uint32_t ulNext;  // Next number to hand out
+} di_seq_t;
+
+typedef struct di_dir_t {
+    struct di_dir_t *pxPrev, *pxNext;  // Most recently used first
+    char *pcPath;                      // Absolute
+    FF_IOManager_t *pxIOManager;
+    uint32_t ulDirCluster;
+    di_slot_t *pxSlots;                // Open addressing, linear probing
+    size_t xSlots;                     // A power of 2
+    size_t xUsed;                      // Live names
+    size_t xTombstones;
+    char *pcNames;                     // '\0' terminated names
+    size_t xNamesSize;
+    size_t xNamesUsed;
+    size_t xNamesLive;                 // Bytes of pcNames still referenced
+    size_t xBytes;                     // All of the RAM for this directory
+    di_seq_t xSeqs[FF_DI_SEQS];        // Tail pointers for ff_di_next_name
+    size_t xNextSeq;                   // Next one to reuse
+} di_dir_t;
+
+typedef enum { DI_UNKNOWN, DI_ABSENT, DI_FOUND } di_result_t;
+
+static SemaphoreHandle_t xMutex;
+static di_dir_t *pxHead, *pxTail;
+static size_t xDirs;
+static ff_di_stats_t xStats;
+
+// Directories that mkdirhier made or found, most recently used first
+static char pcKnownDirs[FF_DI_KNOWN_DIRS][FF_DI_MAX_PATH];
+
+// Only used with xMutex held
+static char pcPathBuf[FF_DI_MAX_PATH];
+static FF_DirEnt_t xDirEnt;
+static FF_DirEnt_t xLongDirEnt;
+
+static void prvLock(void) {
+    if (!xMutex) {
+        SemaphoreHandle_t xNew = xSemaphoreCreateMutex();
+        configASSERT(xNew);
+        taskENTER_CRITICAL();
+        bool bMine = !xMutex;
+        if (bMine) xMutex = xNew;
+        taskEXIT_CRITICAL();
+        if (!bMine) vSemaphoreDelete(xNew);
+    }
+    xSemaphoreTake(xMutex, portMAX_DELAY);
+}
+static void prvUnlock(void) {
+    xSemaphoreGive(xMutex);
+}
+
+/* FNV-1a of the name, ignoring case like FAT does. Never DI_EMPTY. */
+static uint32_t prvHash(const char *pcName) {
+    uint32_t ulHash = 2166136261u;
+    for (; *pcName; ++pcName) {
+        ulHash ^= (uint8_t)tolower((unsigned char)*pcName);
+        ulHash *= 16777619u;
+    }
+    return DI_EMPTY == ulHash ? 1 : ulHash;
+}
+
+static bool prvIsTombstone(const di_slot_t *pxSlot) {
+    return DI_EMPTY != pxSlot->ulHash && DI_TOMBSTONE == pxSlot->usEntry;
+}
+
+static void prvUnlink(di_dir_t *pxDir) {
+    if (pxDir->pxPrev) pxDir->pxPrev->pxNext = pxDir->pxNext; else pxHead = pxDir->pxNext;
+    if (pxDir->pxNext) pxDir->pxNext->pxPrev = pxDir->pxPrev; else pxTail = pxDir->pxPrev;
+    pxDir->pxPrev = pxDir->pxNext = NULL;
+}
+static void prvPushFront(di_dir_t *pxDir) {
+    pxDir->pxPrev = NULL;
+    pxDir->pxNext = pxHead;
+    if (pxHead) pxHead->pxPrev = pxDir; else pxTail = pxDir;
+    pxHead = pxDir;
+}
+
+static void prvDropDir(di_dir_t *pxDir) {
+    TRACE_PRINTF("%s(%s)\n", __func__, pxDir->pcPath);
+    prvUnlink(pxDir);
+    --xDirs;
+    xStats.xBytes -= pxDir->xBytes;
+    vPortFree(pxDir->pxSlots);
+    vPortFree(pxDir->pcNames);
+    vPortFree(pxDir);
+}
+
+/* Drop least recently used directories (other than pxKeep)
+until there is room for xMore bytes */
+static bool prvReserve(size_t xMore, const di_dir_t *pxKeep) {
+    while (xStats.xBytes + xMore > FF_DI_MAX_BYTES) {
+        di_dir_t *pxVictim = pxTail;
+        if (pxVictim == pxKeep) pxVictim = pxVictim->pxPrev;
+        if (!pxVictim) return false;
+        prvDropDir(pxVictim);
+        ++xStats.ulEvictions;
+    }
+    return true;
+}
+
+/* Returns the slot holding pcName, or SIZE_MAX.
+If pxFree isn't NULL, it gets the first slot where pcName could go. */
+static size_t prvProbe(const di_dir_t *pxDir, const char *pcName, uint32_t ulHash,
+                       size_t *pxFree) {
+    const size_t xMask = pxDir->xSlots - 1;
+    size_t xFree = SIZE_MAX;
+    size_t xFound = SIZE_MAX;
+    // The load is kept under 3/4, so there is always an empty slot to stop at
+    for (size_t i = ulHash & xMask;; i = (i + 1) & xMask) {
+        const di_slot_t *pxSlot = &pxDir->pxSlots[i];
+        if (DI_EMPTY == pxSlot->ulHash) {
+            if (SIZE_MAX == xFree) xFree = i;
+            break;
+        }
+        if (prvIsTombstone(pxSlot)) {
+            if (SIZE_MAX == xFree) xFree = i;
+            continue;
+        }
+        if (pxSlot->ulHash == ulHash && !strcasecmp(pxDir->pcNames + pxSlot->ulName, pcName)) {
+            xFound = i;
+            break;
+        }
+    }
+    if (pxFree) *pxFree = xFree;
+    return xFound;
+}
+
+/* Rebuild the table with xSlots slots, dropping tombstones and compacting the names,
+with room for xExtra more bytes of names */
+static bool prvResize(di_dir_t *pxDir, size_t xSlots, size_t xExtra) {
+    size_t xNamesSize = pxDir->xNamesLive + xExtra;
+    xNamesSize += xNamesSize / 2;
+    if (xNamesSize < 256) xNamesSize = 256;
+    const size_t xNew = xSlots * sizeof(di_slot_t) + xNamesSize;
+    const size_t xOld = pxDir->xSlots * sizeof(di_slot_t) + pxDir->xNamesSize;
+    // The old table is freed at the end
+    if (xNew > xOld && !prvReserve(xNew - xOld, pxDir)) return false;
+    di_slot_t *pxSlots = pvPortMalloc(xSlots * sizeof(di_slot_t));
+    char *pcNames = pvPortMalloc(xNamesSize);
+    if (!pxSlots || !pcNames) {
+        vPortFree(pxSlots);
+        vPortFree(pcNames);
+        return false;
+    }
+    memset(pxSlots, 0, xSlots * sizeof(di_slot_t));
+    size_t xNamesUsed = 0;
+    for (size_t i = 0; i < pxDir->xSlots; ++i) {
+        const di_slot_t *pxOld = &pxDir->pxSlots[i];
+        if (DI_EMPTY == pxOld->ulHash || prvIsTombstone(pxOld)) continue;
+        size_t j = pxOld->ulHash & (xSlots - 1);
+        while (DI_EMPTY != pxSlots[j].ulHash) j = (j + 1) & (xSlots - 1);
+        pxSlots[j] = *pxOld;
+        const char *pcName = pxDir->pcNames + pxOld->ulName;
+        size_t xLen = strlen(pcName) + 1;
+        memcpy(pcNames + xNamesUsed, pcName, xLen);
+        pxSlots[j].ulName = xNamesUsed;
+        xNamesUsed += xLen;
+    }
+    vPortFree(pxDir->pxSlots);
+    vPortFree(pxDir->pcNames);
+    pxDir->pxSlots = pxSlots;
+    pxDir->xSlots = xSlots;
+    pxDir->xTombstones = 0;
+    pxDir->pcNames = pcNames;
+    pxDir->xNamesSize = xNamesSize;
+    pxDir->xNamesUsed = xNamesUsed;
+    pxDir->xBytes = pxDir->xBytes - xOld + xNew;
+    xStats.xBytes = xStats.xBytes - xOld + xNew;
+    return true;
+}
+
+/* Add or update a name. Returns false if there isn't enough memory. */
+static bool prvSet(di_dir_t *pxDir, const char *pcName, uint32_t ulEntry, uint32_t ulCluster,
+                   uint8_t ucAttrib) {
+    const uint32_t ulHash = prvHash(pcName);
+    const uint16_t usEntry = ulEntry < DI_NO_ENTRY ? ulEntry : DI_NO_ENTRY;
+    size_t xFree;
+    size_t i = prvProbe(pxDir, pcName, ulHash, &xFree);
+    if (SIZE_MAX != i) {
+        pxDir->pxSlots[i].usEntry = usEntry;
+        pxDir->pxSlots[i].ulCluster = ulCluster;
+        pxDir->pxSlots[i].ucAttrib = ucAttrib;
+        return true;
+    }
+    const size_t xLen = strlen(pcName) + 1;
+    if ((pxDir->xUsed + pxDir->xTombstones + 1) * 4 > pxDir->xSlots * 3 ||
+        pxDir->xNamesUsed + xLen > pxDir->xNamesSize) {
+        size_t xSlots = pxDir->xSlots;
+        // Grow well before the 3/4 limit, so dropping tombstones isn't needed again soon
+        while ((pxDir->xUsed + 1) * 8 > xSlots * 5) xSlots *= 2;
+        if (!prvResize(pxDir, xSlots, xLen)) return false;
+        prvProbe(pxDir, pcName, ulHash, &xFree);
+    }
+    di_slot_t *pxSlot = &pxDir->pxSlots[xFree];
+    if (prvIsTombstone(pxSlot)) --pxDir->xTombstones;
+    memcpy(pxDir->pcNames + pxDir->xNamesUsed, pcName, xLen);
+    pxSlot->ulName = pxDir->xNamesUsed;
+    pxDir->xNamesUsed += xLen;
+    pxDir->xNamesLive += xLen;
+    pxSlot->ulHash = ulHash;
+    pxSlot->usEntry = usEntry;
+    pxSlot->ulCluster = ulCluster;
+    pxSlot->ucAttrib = ucAttrib;
+    ++pxDir->xUsed;
+    return true;
+}
+
+static void prvForget(di_dir_t *pxDir, const char *pcName) {
+    size_t i = prvProbe(pxDir, pcName, prvHash(pcName), NULL);
+    if (SIZE_MAX == i) return;
+    pxDir->xNamesLive -= strlen(pxDir->pcNames + pxDir->pxSlots[i].ulName) + 1;
+    pxDir->pxSlots[i].usEntry = DI_TOMBSTONE;
+    --pxDir->xUsed;
+    ++pxDir->xTombstones;
+}
+
+/* Put the absolute form of pcPath in pcPathBuf.
+Returns its length, or 0 if it can't be indexed: too long, or not in a simple form
+(".", "..", and "//" are left to FreeRTOS+FAT). */
+static size_t prvAbsolute(const char *pcPath) {
+    size_t xLen = 0;
+    if ('/' != pcPath[0]) {
+        if (!ff_getcwd(pcPathBuf, sizeof pcPathBuf)) return 0;
+        xLen = strlen(pcPathBuf);
+        if (!xLen || '/' != pcPathBuf[xLen - 1]) {
+            if (xLen + 1 >= sizeof pcPathBuf) return 0;
+            pcPathBuf[xLen++] = '/';
+        }
+    }
+    size_t xPathLen = strlen(pcPath);
+    if (xLen + xPathLen >= sizeof pcPathBuf) return 0;
+    memcpy(pcPathBuf + xLen, pcPath, xPathLen + 1);
+    xLen += xPathLen;
+    if (xLen > 1 && '/' == pcPathBuf[xLen - 1]) pcPathBuf[--xLen] = '\0';
+    if (strstr(pcPathBuf, "//") || strstr(pcPathBuf, "/./") || strstr(pcPathBuf, "/../"))
+        return 0;
+    const char *pcLast = strrchr(pcPathBuf, '/') + 1;
+    if (!strcmp(pcLast, ".") || !strcmp(pcLast, "..")) return 0;
+    return xLen;
+}
+
+/* Split pcPath into its (absolute) directory and name, in pcPathBuf */
+static bool prvSplit(const char *pcPath, const char **ppcDir, const char **ppcName) {
+    if (!prvAbsolute(pcPath)) return false;
+    char *pcSlash = strrchr(pcPathBuf, '/');
+    // The root holds only mount points
+    if (pcSlash == pcPathBuf || !pcSlash[1]) return false;
+    *pcSlash = '\0';
+    *ppcDir = pcPathBuf;
+    *ppcName = pcSlash + 1;
+    return true;
+}
+
+static di_dir_t *prvFindDir(const char *pcDir) {
+    for (di_dir_t *pxDir = pxHead; pxDir; pxDir = pxDir->pxNext) {
+        if (!strcasecmp(pxDir->pcPath, pcDir)) {
+            prvUnlink(pxDir);
+            prvPushFront(pxDir);
+            return pxDir;
+        }
+    }
+    return NULL;
+}
+
+static di_dir_t *prvNewDir(const char *pcDir) {
+    if (FF_DI_MAX_DIRS == xDirs) {
+        prvDropDir(pxTail);
+        ++xStats.ulEvictions;
+    }
+    size_t xSize = sizeof(di_dir_t) + strlen(pcDir) + 1;
+    if (!prvReserve(xSize, NULL)) return NULL;
+    di_dir_t *pxDir = pvPortMalloc(xSize);
+    if (!pxDir) return NULL;
+    memset(pxDir, 0, sizeof *pxDir);
+    pxDir->pcPath = (char *)(pxDir + 1);
+    strcpy(pxDir->pcPath, pcDir);
+    pxDir->xBytes = xSize;
+    xStats.xBytes += xSize;
+    ++xDirs;
+    prvPushFront(pxDir);
+    if (!prvResize(pxDir, 64, 0)) {
+        prvDropDir(pxDir);
+        return NULL;
+    }
+    return pxDir;
+}
+
+/* Read the whole directory once */
+static di_dir_t *prvBuild(const char *pcDir) {
+    FF_FindData_t *pxFind = pvPortMalloc(sizeof(FF_FindData_t));
+    if (!pxFind) return NULL;
+    memset(pxFind, 0, sizeof *pxFind);
+    di_dir_t *pxDir = NULL;
+    if (FF_ERR_NONE == ff_findfirst(pcDir, pxFind)) pxDir = prvNewDir(pcDir);
+    if (pxDir) {
+        ++xStats.ulBuilds;
+        pxDir->pxIOManager = pxFind->xDirectoryHandler.pxManager;
+        pxDir->ulDirCluster = pxFind->xDirectoryEntry.ulDirCluster;
+        do {
+            const char *pcName = pxFind->pcFileName;
+            if (!strcmp(pcName, ".") || !strcmp(pcName, "..")) continue;
+            // FF_FindNext leaves usCurrentItem just past the entry it returned
+            if (!prvSet(pxDir, pcName, pxFind->xDirectoryEntry.usCurrentItem - 1u,
+                        pxFind->xDirectoryEntry.ulObjectCluster, pxFind->ucAttributes)) {
+                TRACE_PRINTF("%s: %s is too big to index\n", __func__, pcDir);
+                prvDropDir(pxDir);
+                pxDir = NULL;
+                break;
+            }
+        } while (FF_ERR_NONE == ff_findnext(pxFind));
+    }
+    vPortFree(pxFind);
+    return pxDir;
+}
+
+/* Is pcName the name of the entry just read into xDirEnt (number usEntry)?
+That's its 8.3 name, or else the long name in the slots just before it. */
+static bool prvSameName(const di_dir_t *pxDir, uint16_t usEntry, const char *pcName) {
+    if (!strcasecmp(xDirEnt.pcFileName, pcName)) return true;
+    const size_t xSlots = (strlen(pcName) + 12) / 13;  // 13 characters in each long name slot
+    if (usEntry < xSlots) return false;
+    FF_Error_t xError =
+        FF_GetEntry(pxDir->pxIOManager, usEntry - xSlots, pxDir->ulDirCluster, &xLongDirEnt);
+    return !FF_isERR(xError) && !strcasecmp(xLongDirEnt.pcFileName, pcName) &&
+           xLongDirEnt.ulObjectCluster == xDirEnt.ulObjectCluster;
+}
+
+/* Look pcPath up, filling in xDirEnt if it's DI_FOUND */
+static di_result_t prvLookup(const char *pcPath) {
+    ++xStats.ulLookups;
+    const char *pcDir, *pcName;
+    di_dir_t *pxDir = NULL;
+    if (prvSplit(pcPath, &pcDir, &pcName)) {
+        pxDir = prvFindDir(pcDir);
+        if (!pxDir) pxDir = prvBuild(pcDir);
+    }
+    if (!pxDir) {
+        ++xStats.ulFallbacks;
+        return DI_UNKNOWN;
+    }
+    size_t i = prvProbe(pxDir, pcName, prvHash(pcName), NULL);
+    if (SIZE_MAX == i) {
+        ++xStats.ulMisses;
+        return DI_ABSENT;
+    }
+    di_slot_t *pxSlot = &pxDir->pxSlots[i];
+    if (DI_NO_ENTRY == pxSlot->usEntry) {
+        ++xStats.ulFallbacks;
+        return DI_UNKNOWN;
+    }
+    // Check that the entry still holds this file
+    FF_Error_t xError =
+        FF_GetEntry(pxDir->pxIOManager, pxSlot->usEntry, pxDir->ulDirCluster, &xDirEnt);
+    bool bLive = !FF_isERR(xError) && 0xE5 != (uint8_t)xDirEnt.pcFileName[0] &&
+                 (xDirEnt.ucAttrib & FF_FAT_ATTR_DIR) == (pxSlot->ucAttrib & FF_FAT_ATTR_DIR) &&
+                 prvSameName(pxDir, pxSlot->usEntry, pcName);
+    if (bLive && !pxSlot->ulCluster)
+        pxSlot->ulCluster = xDirEnt.ulObjectCluster;  // Created empty; now we know
+    else if (bLive && pxSlot->ulCluster != xDirEnt.ulObjectCluster)
+        bLive = false;
+    if (!bLive) {
+        DBG_PRINTF("%s: index of %s is stale\n", __func__, pxDir->pcPath);
+        prvDropDir(pxDir);
+        ++xStats.ulFallbacks;
+        return DI_UNKNOWN;
+    }
+    ++xStats.ulHits;
+    return DI_FOUND;
+}
+
+/* Update the name's slot, if its directory is indexed */
+static void prvRecord(const char *pcPath, uint32_t ulEntry, uint32_t ulCluster, uint8_t ucAttrib) {
+    const char *pcDir, *pcName;
+    if (!prvSplit(pcPath, &pcDir, &pcName)) return;
+    di_dir_t *pxDir = prvFindDir(pcDir);
+    if (pxDir && !prvSet(pxDir, pcName, ulEntry, ulCluster, ucAttrib)) prvDropDir(pxDir);
+}
+
+static void prvForgetPath(const char *pcPath) {
+    const char *pcDir, *pcName;
+    if (!prvSplit(pcPath, &pcDir, &pcName)) return;
+    di_dir_t *pxDir = prvFindDir(pcDir);
+    if (pxDir) prvForget(pxDir, pcName);
+}
+
+static void prvDropAll(void) {
+    while (pxHead) prvDropDir(pxHead);
+    memset(pcKnownDirs, 0, sizeof pcKnownDirs);
+}
+
+/* Is pcDir pcPathBuf[0..xLen), or under it? */
+static bool prvIsUnder(const char *pcDir, size_t xLen) {
+    return !strncasecmp(pcDir, pcPathBuf, xLen) && ('\0' == pcDir[xLen] || '/' == pcDir[xLen]);
+}
+
+/* Drop what is known about directory pcPath and everything under it */
+static void prvDropUnder(const char *pcPath) {
+    size_t xLen = prvAbsolute(pcPath);
+    if (xLen <= 1) {
+        // The root, or can't tell what it refers to
+        prvDropAll();
+        return;
+    }
+    for (size_t i = 0; i < FF_DI_KNOWN_DIRS; ++i)
+        if (prvIsUnder(pcKnownDirs[i], xLen)) pcKnownDirs[i][0] = '\0';
+    di_dir_t *pxNext;
+    for (di_dir_t *pxDir = pxHead; pxDir; pxDir = pxNext) {
+        pxNext = pxDir->pxNext;
+        if (prvIsUnder(pxDir->pcPath, xLen)) prvDropDir(pxDir);
+    }
+}
+
+/* If pcName is pcStem, xDigits digits, and then "." pcExt (or nothing, if pcExt is ""),
+returns true and puts the number in *pulNumber */
+static bool prvParseSeqName(const char *pcName, const char *pcStem, size_t xDigits,
+                            const char *pcExt, uint32_t *pulNumber) {
+    const size_t xStemLen = strlen(pcStem);
+    if (strncasecmp(pcName, pcStem, xStemLen)) return false;
+    pcName += xStemLen;
+    uint32_t ulNumber = 0;
+    for (size_t i = 0; i < xDigits; ++i, ++pcName) {
+        if (!isdigit((unsigned char)*pcName)) return false;
+        ulNumber = ulNumber * 10 + (*pcName - '0');
+    }
+    if (*pcExt) {
+        if ('.' != *pcName++ || strcasecmp(pcName, pcExt)) return false;
+    } else if (*pcName) {
+        return false;
+    }
+    *pulNumber = ulNumber;
+    return true;
+}
+
+static di_seq_t *prvSeq(di_dir_t *pxDir, const char *pcStem, const char *pcExt) {
+    for (size_t i = 0; i < FF_DI_SEQS; ++i) {
+        di_seq_t *pxSeq = &pxDir->xSeqs[i];
+        if (!strcasecmp(pxSeq->pcStem, pcStem) && !strcasecmp(pxSeq->pcExt, pcExt)) return pxSeq;
+    }
+    di_seq_t *pxSeq = &pxDir->xSeqs[pxDir->xNextSeq++ % FF_DI_SEQS];
+    strcpy(pxSeq->pcStem, pcStem);
+    strcpy(pxSeq->pcExt, pcExt);
+    pxSeq->ulNext = 0;
+    // Start past the highest number there. The names are all in RAM, so this is a quick pass.
+    const size_t xDigits = 8 - strlen(pcStem);
+    for (size_t i = 0; i < pxDir->xSlots; ++i) {
+        const di_slot_t *pxSlot = &pxDir->pxSlots[i];
+        uint32_t ulNumber;
+        if (DI_EMPTY != pxSlot->ulHash && !prvIsTombstone(pxSlot) &&
+            prvParseSeqName(pxDir->pcNames + pxSlot->ulName, pcStem, xDigits, pcExt,
+                            &ulNumber) &&
+            ulNumber >= pxSeq->ulNext)
+            pxSeq->ulNext = ulNumber + 1;
+    }
+    return pxSeq;
+}
+
+static uint32_t prvFileTime(const FF_SystemTime_t *pxTime) {
+    FF_TimeStruct_t xTime;
+    memset(&xTime, 0, sizeof xTime);
+    xTime.tm_sec = pxTime->Second;
+    xTime.tm_min = pxTime->Minute;
+    xTime.tm_hour = pxTime->Hour;
+    xTime.tm_mday = pxTime->Day;
+    xTime.tm_mon = pxTime->Month - 1;
+    xTime.tm_year = pxTime->Year - 1900;
+    return FreeRTOS_mktime(&xTime);
+}
+
+int ff_di_stat(const char *pcPath, FF_Stat_t *pxStat) {
+    prvLock();
+    di_result_t xResult = prvLookup(pcPath);
+    if (DI_ABSENT == xResult) {
+        /* Not in the index, but it might have been created some other way
+        (e.g., a plain ff_fopen) since the index was built */
+        int iResult = ff_stat(pcPath, pxStat);
+        if (0 == iResult) {
+            const char *pcDir, *pcName;
+            if (prvSplit(pcPath, &pcDir, &pcName)) {
+                di_dir_t *pxDir = prvFindDir(pcDir);
+                if (pxDir) {
+                    DBG_PRINTF("%s: index of %s is stale\n", __func__, pxDir->pcPath);
+                    prvDropDir(pxDir);
+                }
+            }
+        }
+        prvUnlock();
+        return iResult;
+    }
+    if (DI_FOUND == xResult) {
+        memset(pxStat, 0, sizeof *pxStat);
+        pxStat->st_ino = xDirEnt.ulObjectCluster;
+        pxStat->st_size = xDirEnt.ulFileSize;
+        pxStat->st_mode = (xDirEnt.ucAttrib & FF_FAT_ATTR_DIR) ? FF_IFDIR : FF_IFREG;
+#if ffconfigTIME_SUPPORT == 1
+        pxStat->st_atime = prvFileTime(&xDirEnt.xAccessedTime);
+        pxStat->st_mtime = prvFileTime(&xDirEnt.xModifiedTime);
+        pxStat->st_ctime = prvFileTime(&xDirEnt.xCreateTime);
+#endif
+    }
+    prvUnlock();
+    if (DI_FOUND == xResult) return 0;
+    return ff_stat(pcPath, pxStat);
+}
+
+FF_FILE *ff_di_fopen(const char *pcPath, const char *pcMode) {
+    const bool bCreates = 'r' != pcMode[0];  // "w" and "a" create the file if need be
+    prvLock();
+    FF_FILE *pxFile = ff_fopen(pcPath, pcMode);
+    if (pxFile && bCreates) prvRecord(pcPath, pxFile->usDirEntry, pxFile->ulObjectCluster, 0);
+    prvUnlock();
+    return pxFile;
+}
+
+int ff_di_remove(const char *pcPath) {
+    prvLock();
+    int iResult = ff_remove(pcPath);
+    if (0 == iResult) prvForgetPath(pcPath);
+    prvUnlock();
+    return iResult;
+}
+
+int ff_di_rename(const char *pcOldName, const char *pcNewName, int bDeleteIfExists) {
+    prvLock();
+    int iResult = ff_rename(pcOldName, pcNewName, bDeleteIfExists);
+    if (0 == iResult) {
+        int iError = stdioGET_ERRNO();
+        prvForgetPath(pcOldName);
+        prvDropUnder(pcOldName);  // In case it was a directory
+        const char *pcDir, *pcName;
+        if (prvSplit(pcNewName, &pcDir, &pcName) && prvFindDir(pcDir)) {
+            /* The new entry's number isn't returned by ff_rename.
+            A directory can't be opened, so for one it stays unknown. */
+            FF_FILE *pxFile = ff_fopen(pcNewName, "r");
+            if (pxFile) {
+                prvRecord(pcNewName, pxFile->usDirEntry, pxFile->ulObjectCluster, 0);
+                ff_fclose(pxFile);
+            } else {
+                prvRecord(pcNewName, DI_NO_ENTRY, 0, FF_FAT_ATTR_DIR);
+            }
+        }
+        stdioSET_ERRNO(iError);
+    }
+    prvUnlock();
+    return iResult;
+}
+
+int ff_di_mkdir(const char *pcPath) {
+    prvLock();
+    int iResult = ff_mkdir(pcPath);
+    if (0 == iResult) prvRecord(pcPath, DI_NO_ENTRY, 0, FF_FAT_ATTR_DIR);
+    prvUnlock();
+    return iResult;
+}
+
+int ff_di_rmdir(const char *pcPath) {
+    prvLock();
+    int iResult = ff_rmdir(pcPath);
+    if (0 == iResult) {
+        prvForgetPath(pcPath);
+        prvDropUnder(pcPath);
+    }
+    prvUnlock();
+    return iResult;
+}
+
+int ff_di_next_name(const char *pcDir, const char *pcStem, const char *pcExt, char *pcPath,
+                    size_t xPathSize) {
+    const size_t xStemLen = strlen(pcStem);
+    if (!xStemLen || xStemLen > 7 || strlen(pcExt) > 3 || strchr(pcStem, '.') ||
+        strchr(pcExt, '.')) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        return -1;
+    }
+    const int iDigits = 8 - xStemLen;
+    uint32_t ulLimit = 1;
+    for (int i = 0; i < iDigits; ++i) ulLimit *= 10;
+
+    int iResult = -1;
+    int iError = 0;
+    prvLock();
+    di_dir_t *pxDir = NULL;
+    size_t xLen = prvAbsolute(pcDir);
+    if (xLen > 1) {  // The root holds only mount points
+        pxDir = prvFindDir(pcPathBuf);
+        if (!pxDir) {
+            stdioSET_ERRNO(0);
+            pxDir = prvBuild(pcPathBuf);
+            // ff_findfirst sets errno if pcDir isn't there
+            if (!pxDir) iError = stdioGET_ERRNO() ? stdioGET_ERRNO() : pdFREERTOS_ERRNO_ENOMEM;
+        }
+    } else {
+        iError = pdFREERTOS_ERRNO_EINVAL;
+    }
+    if (pxDir) {
+        di_seq_t *pxSeq = prvSeq(pxDir, pcStem, pcExt);
+        char pcName[13];
+        uint32_t ulNumber;
+        for (ulNumber = pxSeq->ulNext; ulNumber < ulLimit; ++ulNumber) {
+            snprintf(pcName, sizeof pcName, "%s%0*lu%s%s", pcStem, iDigits,
+                     (unsigned long)ulNumber, *pcExt ? "." : "", pcExt);
+            if (SIZE_MAX != prvProbe(pxDir, pcName, prvHash(pcName), NULL)) continue;
+            // Not in the index, but it could have been created some other way
+            if ((size_t)snprintf(pcPath, xPathSize, "%s/%s", pxDir->pcPath, pcName) >= xPathSize) {
+                iError = pdFREERTOS_ERRNO_ENAMETOOLONG;
+                break;
+            }
+            FF_Stat_t xStat;
+            if (0 != ff_stat(pcPath, &xStat)) break;
+            if (!prvSet(pxDir, pcName, DI_NO_ENTRY, xStat.st_ino,
+                        FF_IFDIR == xStat.st_mode ? FF_FAT_ATTR_DIR : 0)) {
+                prvDropDir(pxDir);
+                iError = pdFREERTOS_ERRNO_ENOMEM;
+                break;
+            }
+        }
+        if (!iError) {
+            if (ulNumber == ulLimit) {
+                iError = pdFREERTOS_ERRNO_ENOSPC;
+            } else {
+                // Not used up until the file is created: the next call skips it then
+                pxSeq->ulNext = ulNumber;
+                iResult = ulNumber;
+            }
+        }
+    }
+    prvUnlock();
+    if (iError) stdioSET_ERRNO(iError);
+    return iResult;
+}
+
+/* Move known directory i (or, if i is FF_DI_KNOWN_DIRS, the one in pcPathBuf) to the front */
+static void prvKnownToFront(size_t i) {
+    if (FF_DI_KNOWN_DIRS == i) i = FF_DI_KNOWN_DIRS - 1;  // Replace the least recently used
+    memmove(pcKnownDirs[1], pcKnownDirs[0], i * sizeof pcKnownDirs[0]);
+    strcpy(pcKnownDirs[0], pcPathBuf);
+}
+
+bool ff_di_known_dir(const char *pcDir) {
+    bool bKnown = false;
+    prvLock();
+    if (prvAbsolute(pcDir)) {
+        for (size_t i = 0; i < FF_DI_KNOWN_DIRS; ++i) {
+            if (!strcasecmp(pcKnownDirs[i], pcPathBuf)) {
+                prvKnownToFront(i);
+                ++xStats.ulKnownHits;
+                bKnown = true;
+                break;
+            }
+        }
+    }
+    prvUnlock();
+    return bKnown;
+}
+
+void ff_di_add_known_dir(const char *pcDir) {
+    prvLock();
+    if (prvAbsolute(pcDir)) {
+        size_t i;
+        for (i = 0; i < FF_DI_KNOWN_DIRS; ++i)
+            if (!strcasecmp(pcKnownDirs[i], pcPathBuf)) break;
+        prvKnownToFront(i);
+    }
+    prvUnlock();
+}
+
+void ff_di_invalidate(const char *pcDir) {
+    prvLock();
+    if (pcDir)
+        prvDropUnder(pcDir);
+    else
+        prvDropAll();
+    prvUnlock();
+}
+
+void ff_di_get_stats(ff_di_stats_t *pxStats) {
+    prvLock();
+    *pxStats = xStats;
+    prvUnlock();
+}
+
+/* [] END OF FILE */
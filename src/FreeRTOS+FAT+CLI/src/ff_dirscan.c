@@ -0,0 +1,334 @@
+/*
+ * ff_dirscan.c
+ */
+
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+//
+#include "FreeRTOS.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "my_debug.h"
+#include "sd_card.h"
+#include "sd_card_constants.h"
+//
+#include "ff_dirscan.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#define DS_SLOT_SIZE 32
+#define DS_LFN_CHARS 13       // Characters in each long name slot
+#define DS_LFN_MAX_SLOTS 20   // For the longest name FAT allows (255 characters)
+#define DS_ATTR_LFN 0x0F
+#define DS_ATTR_VOLID 0x08
+#define DS_LFN_LAST 0x40      // Flags the first slot of a long name (its last piece)
+#define DS_CASE_LOWER_BASE 0x08
+#define DS_CASE_LOWER_EXT 0x10
+
+int prvFFErrorToErrno(FF_Error_t xError);  // In ff_stdio.c
+
+struct ff_ds_t {
+    FF_IOManager_t *pxIOManager;
+    FF_FindData_t *pxFind;     // Used instead of reading clusters, when that isn't possible
+    bool bFindStarted;
+    uint32_t ulCluster;        // Next cluster to read, or 0 at the end of the chain
+    uint32_t ulSector;         // Next sector to read in ulCluster
+    bool bEnd;                 // Reached the end of the directory
+    size_t xSlots;             // Slots in pucBuffer
+    size_t xNext;              // Next slot to decode
+    // The long name being put together
+    char pcLongName[ffconfigMAX_FILENAME];
+    uint8_t ucLongSeq;         // Sequence number of the slot expected next (0 if none)
+    uint8_t ucLongChecksum;
+    bool bLongComplete;        // All of its slots were seen, in order
+    ff_ds_stats_t xStats;
+    uint8_t pucBuffer[FF_DS_READ_SECTORS * 512] __attribute__((aligned(4)));
+};
+
+static inline uint16_t prvGet16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t prvGet32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* FAT date and time to seconds since 1970 */
+static uint32_t prvTime(uint16_t usDate, uint16_t usTime) {
+    if (!usDate) return 0;
+    FF_TimeStruct_t xTime;
+    memset(&xTime, 0, sizeof xTime);
+    xTime.tm_year = (usDate >> 9) + 1980 - 1900;
+    xTime.tm_mon = ((usDate >> 5) & 0x0F) - 1;
+    xTime.tm_mday = usDate & 0x1F;
+    xTime.tm_hour = usTime >> 11;
+    xTime.tm_min = (usTime >> 5) & 0x3F;
+    xTime.tm_sec = (usTime & 0x1F) * 2;
+    return FreeRTOS_mktime(&xTime);
+}
+
+static uint8_t prvShortNameChecksum(const uint8_t *pucName) {
+    uint8_t ucSum = 0;
+    for (size_t i = 0; i < 11; ++i) ucSum = ((ucSum & 1) << 7) + (ucSum >> 1) + pucName[i];
+    return ucSum;
+}
+
+/* Put the piece of long name in slot pucSlot in its place */
+static void prvLongNamePiece(ff_ds_t *pxScan, const uint8_t *pucSlot) {
+    static const uint8_t pucOffsets[DS_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    uint8_t ucOrder = pucSlot[0];
+    uint8_t ucSeq = ucOrder & 0x1F;
+    pxScan->bLongComplete = false;
+    if (!ucSeq || ucSeq > DS_LFN_MAX_SLOTS ||
+        (!(ucOrder & DS_LFN_LAST) &&
+         (ucSeq != pxScan->ucLongSeq || pucSlot[13] != pxScan->ucLongChecksum))) {
+        pxScan->ucLongSeq = 0;  // Out of order: an orphan
+        return;
+    }
+    if (ucOrder & DS_LFN_LAST) {
+        pxScan->ucLongChecksum = pucSlot[13];
+        // Terminated here unless the name fills its last slot
+        size_t xEnd = ucSeq * DS_LFN_CHARS;
+        if (xEnd > sizeof pxScan->pcLongName - 1) xEnd = sizeof pxScan->pcLongName - 1;
+        pxScan->pcLongName[xEnd] = '\0';
+    }
+    // The last slot is padded past the end of the name, so only the name itself has to fit
+    size_t xPos = (ucSeq - 1) * DS_LFN_CHARS;
+    for (size_t i = 0; i < DS_LFN_CHARS; ++i, ++xPos) {
+        uint16_t usChar = prvGet16(pucSlot + pucOffsets[i]);
+        if (xPos >= sizeof pxScan->pcLongName - 1) {
+            if (usChar) {
+                pxScan->ucLongSeq = 0;  // Longer than ffconfigMAX_FILENAME allows: an orphan
+                return;
+            }
+            break;
+        }
+        if (!usChar) {
+            pxScan->pcLongName[xPos] = '\0';
+            break;
+        }
+        // Like FreeRTOS+FAT without Unicode support: keep the low byte
+        pxScan->pcLongName[xPos] = usChar <= 0xFF ? (char)usChar : '?';
+    }
+    pxScan->ucLongSeq = ucSeq - 1;
+    pxScan->bLongComplete = 1 == ucSeq;
+}
+
+/* "NAME    EXT" to "NAME.EXT", with the lower case flags that Windows sets */
+static void prvShortName(const uint8_t *pucSlot, char *pcName) {
+    const uint8_t ucCase = pucSlot[12];
+    size_t n = 0;
+    for (size_t i = 0; i < 8 && ' ' != pucSlot[i]; ++i) {
+        char c = (0 == i && 0x05 == pucSlot[i]) ? (char)0xE5 : pucSlot[i];
+        pcName[n++] = (ucCase & DS_CASE_LOWER_BASE) ? tolower((unsigned char)c) : c;
+    }
+    if (' ' != pucSlot[8]) {
+        pcName[n++] = '.';
+        for (size_t i = 8; i < 11 && ' ' != pucSlot[i]; ++i)
+            pcName[n++] = (ucCase & DS_CASE_LOWER_EXT) ? tolower(pucSlot[i]) : pucSlot[i];
+    }
+    pcName[n] = '\0';
+}
+
+/* Read the next sectors of the directory: up to FF_DS_READ_SECTORS,
+from as many contiguous clusters as fit */
+static FF_Error_t prvFill(ff_ds_t *pxScan) {
+    FF_IOManager_t *pxIOManager = pxScan->pxIOManager;
+    sd_card_t *sd_card_p = pxIOManager->xBlkDevice.pxDisk->pvTag;
+    const uint32_t ulSectorsPerCluster = pxIOManager->xPartition.ulSectorsPerCluster;
+    FF_Error_t xError = FF_ERR_NONE;
+
+    uint32_t ulLBA = FF_Cluster2LBA(pxIOManager, pxScan->ulCluster) + pxScan->ulSector;
+    uint32_t ulCount = ulSectorsPerCluster - pxScan->ulSector;
+    if (ulCount > FF_DS_READ_SECTORS) ulCount = FF_DS_READ_SECTORS;
+    if (pxScan->ulSector + ulCount < ulSectorsPerCluster) {
+        pxScan->ulSector += ulCount;
+    } else {
+        // On to the next cluster, taking in any that follow it on the card
+        FF_FATBuffers_t xFATBuffers;
+        FF_InitFATBuffers(&xFATBuffers, FF_MODE_READ);
+        uint32_t ulLast = pxScan->ulCluster;
+        uint32_t ulNext;
+        FF_LockFAT(pxIOManager);
+        for (;;) {
+            ulNext = FF_getFATEntry(pxIOManager, ulLast, &xError, &xFATBuffers);
+            if (FF_isERR(xError)) break;
+            if (FF_isEndOfChain(pxIOManager, ulNext) || ulNext < 2) {
+                ulNext = 0;
+                break;
+            }
+            if (ulNext != ulLast + 1 || ulCount + ulSectorsPerCluster > FF_DS_READ_SECTORS)
+                break;
+            ulLast = ulNext;
+            ulCount += ulSectorsPerCluster;
+        }
+        FF_Error_t xTempError = FF_ReleaseFATBuffers(pxIOManager, &xFATBuffers);
+        FF_UnlockFAT(pxIOManager);
+        if (!FF_isERR(xError)) xError = xTempError;
+        if (FF_isERR(xError)) return xError;
+        pxScan->ulCluster = ulNext;
+        pxScan->ulSector = 0;
+    }
+    TRACE_PRINTF("%s: %lu sectors at LBA %lu\n", __func__, ulCount, ulLBA);
+
+    // Anything still dirty in the sector cache must be on the card before reading around it
+    FF_LockDirectory(pxIOManager);
+    xError = FF_FlushCache(pxIOManager);
+    if (!FF_isERR(xError) &&
+        SD_BLOCK_DEVICE_ERROR_NONE !=
+            sd_card_p->read_blocks(sd_card_p, pxScan->pucBuffer, ulLBA, ulCount))
+        xError = FF_ERR_IOMAN_DRIVER_FATAL_ERROR | FF_ERRFLAG;
+    FF_UnlockDirectory(pxIOManager);
+    if (FF_isERR(xError)) return xError;
+
+    ++pxScan->xStats.ulReads;
+    pxScan->xStats.ulSectors += ulCount;
+    pxScan->xSlots = ulCount * sd_block_size / DS_SLOT_SIZE;
+    pxScan->xNext = 0;
+    return FF_ERR_NONE;
+}
+
+/* The other way: through ff_findfirst/ff_findnext */
+static int prvNextFound(ff_ds_t *pxScan, ff_ds_entry_t *pxEntry) {
+    FF_FindData_t *pxFind = pxScan->pxFind;
+    do {
+        if (pxScan->bFindStarted) {
+            if (FF_ERR_NONE != ff_findnext(pxFind)) {
+                pxScan->bEnd = true;
+                return 0;
+            }
+        }
+        pxScan->bFindStarted = true;  // ff_ds_open did the ff_findfirst
+    } while (!strcmp(pxFind->pcFileName, ".") || !strcmp(pxFind->pcFileName, ".."));
+    strlcpy(pxEntry->pcName, pxFind->pcFileName, sizeof pxEntry->pcName);
+    pxEntry->ulSize = pxFind->ulFileSize;
+    pxEntry->ulCluster = pxFind->xDirectoryEntry.ulObjectCluster;
+    pxEntry->ucAttrib = pxFind->ucAttributes;
+    pxEntry->ulMTime = pxEntry->ulCTime = 0;
+#if ffconfigTIME_SUPPORT == 1
+    const FF_SystemTime_t *pxTimes[] = {&pxFind->xDirectoryEntry.xModifiedTime,
+                                        &pxFind->xDirectoryEntry.xCreateTime};
+    uint32_t *pulTimes[] = {&pxEntry->ulMTime, &pxEntry->ulCTime};
+    for (size_t i = 0; i < 2; ++i) {
+        FF_TimeStruct_t xTime;
+        memset(&xTime, 0, sizeof xTime);
+        xTime.tm_year = pxTimes[i]->Year - 1900;
+        xTime.tm_mon = pxTimes[i]->Month - 1;
+        xTime.tm_mday = pxTimes[i]->Day;
+        xTime.tm_hour = pxTimes[i]->Hour;
+        xTime.tm_min = pxTimes[i]->Minute;
+        xTime.tm_sec = pxTimes[i]->Second;
+        *pulTimes[i] = FreeRTOS_mktime(&xTime);
+    }
+#endif
+    ++pxScan->xStats.ulEntries;
+    return 1;
+}
+
+ff_ds_t *ff_ds_open(const char *pcPath) {
+    ff_ds_t *pxScan = pvPortMalloc(sizeof(ff_ds_t));
+    FF_FindData_t *pxFind = pvPortMalloc(sizeof(FF_FindData_t));
+    if (!pxScan || !pxFind) {
+        vPortFree(pxScan);
+        vPortFree(pxFind);
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        return NULL;
+    }
+    memset(pxScan, 0, offsetof(ff_ds_t, pucBuffer));
+    memset(pxFind, 0, sizeof *pxFind);
+    // This finds the directory and its first cluster, from one sector of it
+    if (FF_ERR_NONE != ff_findfirst(pcPath, pxFind)) {
+        vPortFree(pxFind);
+        if (pdFREERTOS_ERRNO_ENMFILE == stdioGET_ERRNO()) {
+            /* The directory is there, but has nothing in it (not even "." and "..":
+            it's the root directory) */
+            stdioSET_ERRNO(0);
+            pxScan->bEnd = true;
+            return pxScan;
+        }
+        vPortFree(pxScan);
+        return NULL;  // ff_findfirst set errno
+    }
+    FF_IOManager_t *pxIOManager = pxFind->xDirectoryHandler.pxManager;
+    uint32_t ulDirCluster = pxFind->xDirectoryEntry.ulDirCluster;
+    pxScan->pxIOManager = pxIOManager;
+    if (pxIOManager && ulDirCluster >= 2 &&
+        pxIOManager->xPartition.usBlkSize == sd_block_size &&
+        (FF_T_FAT32 == pxIOManager->xPartition.ucType ||
+         ulDirCluster != pxIOManager->xPartition.ulRootDirCluster)) {
+        vPortFree(pxFind);
+        pxScan->ulCluster = ulDirCluster;
+    } else {
+        TRACE_PRINTF("%s: listing %s with ff_findnext\n", __func__, pcPath);
+        pxScan->pxFind = pxFind;
+    }
+    return pxScan;
+}
+
+int ff_ds_next(ff_ds_t *pxScan, ff_ds_entry_t *pxEntry) {
+    if (pxScan->bEnd) return 0;
+    if (pxScan->pxFind) return prvNextFound(pxScan, pxEntry);
+    for (;;) {
+        if (pxScan->xNext == pxScan->xSlots) {
+            if (!pxScan->ulCluster) {
+                pxScan->bEnd = true;
+                return 0;
+            }
+            FF_Error_t xError = prvFill(pxScan);
+            if (FF_isERR(xError)) {
+                DBG_PRINTF("%s: %s\n", __func__, (const char *)FF_GetErrMessage(xError));
+                stdioSET_ERRNO(prvFFErrorToErrno(xError));
+                return -1;
+            }
+        }
+        const uint8_t *pucSlot = pxScan->pucBuffer + pxScan->xNext++ * DS_SLOT_SIZE;
+        ++pxScan->xStats.ulSlots;
+        if (0x00 == pucSlot[0]) {
+            // No entries after this one
+            pxScan->bEnd = true;
+            return 0;
+        }
+        if (0xE5 == pucSlot[0]) {
+            pxScan->ucLongSeq = 0;
+            pxScan->bLongComplete = false;
+            continue;
+        }
+        const uint8_t ucAttrib = pucSlot[11];
+        if (DS_ATTR_LFN == (ucAttrib & 0x3F)) {
+            prvLongNamePiece(pxScan, pucSlot);
+            continue;
+        }
+        // The long name (if any) belongs to this entry only if it checks out
+        bool bLongName = pxScan->bLongComplete &&
+                         prvShortNameChecksum(pucSlot) == pxScan->ucLongChecksum;
+        pxScan->ucLongSeq = 0;
+        pxScan->bLongComplete = false;
+        if (ucAttrib & DS_ATTR_VOLID) continue;
+        if ('.' == pucSlot[0] && (' ' == pucSlot[1] || ('.' == pucSlot[1] && ' ' == pucSlot[2])))
+            continue;
+        if (bLongName)
+            strlcpy(pxEntry->pcName, pxScan->pcLongName, sizeof pxEntry->pcName);
+        else
+            prvShortName(pucSlot, pxEntry->pcName);
+        pxEntry->ucAttrib = ucAttrib;
+        pxEntry->ulCluster = ((uint32_t)prvGet16(pucSlot + 20) << 16) | prvGet16(pucSlot + 26);
+        pxEntry->ulSize = prvGet32(pucSlot + 28);
+        pxEntry->ulCTime = prvTime(prvGet16(pucSlot + 16), prvGet16(pucSlot + 14));
+        pxEntry->ulMTime = prvTime(prvGet16(pucSlot + 24), prvGet16(pucSlot + 22));
+        ++pxScan->xStats.ulEntries;
+        return 1;
+    }
+}
+
+void ff_ds_get_stats(const ff_ds_t *pxScan, ff_ds_stats_t *pxStats) {
+    *pxStats = pxScan->xStats;
+}
+
+void ff_ds_close(ff_ds_t *pxScan) {
+    if (!pxScan) return;
+    vPortFree(pxScan->pxFind);
+    vPortFree(pxScan);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,204 @@
+/*
+ * ff_extents.c
+ */
+
+#include <string.h>
+//
+#include "FreeRTOS.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "my_debug.h"
+//
+#include "ff_extents.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+typedef struct ff_extent_map_t {
+    FF_FILE *pxFile;             // NULL if the map is free
+    uint32_t ulObjectCluster;    // First cluster of the file when the map was built
+    size_t xCount;               // Number of valid entries in xExtents
+    ff_extent_t xExtents[FF_EXTENTS_PER_MAP];
+} ff_extent_map_t;
+
+static ff_extent_map_t maps[FF_EXTENT_MAPS];
+
+static ff_extent_map_t *prvFindMap(const FF_FILE *pxFile) {
+    for (size_t i = 0; i < FF_EXTENT_MAPS; ++i)
+        if (maps[i].pxFile == pxFile) return &maps[i];
+    return NULL;
+}
+
+bool ff_extents_attach(FF_FILE *pxFile) {
+    configASSERT(pxFile);
+    ff_extent_map_t *pxMap;
+    taskENTER_CRITICAL();
+    pxMap = prvFindMap(pxFile);
+    if (!pxMap) {
+        pxMap = prvFindMap(NULL);
+        if (pxMap) {
+            pxMap->pxFile = pxFile;
+            pxMap->ulObjectCluster = 0;
+            pxMap->xCount = 0;
+        }
+    }
+    taskEXIT_CRITICAL();
+    return pxMap != NULL;
+}
+
+void ff_extents_detach(FF_FILE *pxFile) {
+    if (!pxFile) return;
+    taskENTER_CRITICAL();
+    ff_extent_map_t *pxMap = prvFindMap(pxFile);
+    if (pxMap) pxMap->pxFile = NULL;
+    taskEXIT_CRITICAL();
+}
+
+static inline uint32_t prvClusterSize(const FF_IOManager_t *pxIOManager) {
+    return pxIOManager->xPartition.ulSectorsPerCluster * pxIOManager->xPartition.usBlkSize;
+}
+
+/* Drop what no longer describes the file:
+everything if the file was truncated to nothing and got a new chain,
+and any runs beyond the end of the file if it was truncated. */
+static void prvValidate(ff_extent_map_t *pxMap, const FF_FILE *pxFile) {
+    if (pxMap->ulObjectCluster != pxFile->ulObjectCluster) {
+        pxMap->ulObjectCluster = pxFile->ulObjectCluster;
+        pxMap->xCount = 0;
+        return;
+    }
+    /* Clusters beyond the file size may be a reservation (see ff_fallocate),
+    so only trim when the chain is known to be shorter. */
+    if (pxFile->ulChainLength) {
+        while (pxMap->xCount) {
+            ff_extent_t *pxLast = &pxMap->xExtents[pxMap->xCount - 1];
+            if (pxLast->ulFileCluster >= pxFile->ulChainLength) {
+                --pxMap->xCount;
+            } else {
+                if (pxLast->ulFileCluster + pxLast->ulLength > pxFile->ulChainLength)
+                    pxLast->ulLength = pxFile->ulChainLength - pxLast->ulFileCluster;
+                break;
+            }
+        }
+    }
+}
+
+/* Binary search the remembered runs */
+static const ff_extent_t *prvSearch(const ff_extent_map_t *pxMap, uint32_t ulFileCluster) {
+    size_t lo = 0, hi = pxMap->xCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const ff_extent_t *pxExtent = &pxMap->xExtents[mid];
+        if (ulFileCluster < pxExtent->ulFileCluster)
+            hi = mid;
+        else if (ulFileCluster >= pxExtent->ulFileCluster + pxExtent->ulLength)
+            lo = mid + 1;
+        else
+            return pxExtent;
+    }
+    return NULL;
+}
+
+/* Walk the cluster chain from the end of what is known until the run
+containing ulFileCluster is complete, recording runs in the map while
+there is room for them. */
+static bool prvWalk(FF_FILE *pxFile, ff_extent_map_t *pxMap, uint32_t ulFileCluster,
+                    ff_extent_t *pxExtent, FF_Error_t *pxError) {
+    FF_IOManager_t *pxIOManager = pxFile->pxIOManager;
+    ff_extent_t xRun;
+
+    if (pxMap && pxMap->xCount) {
+        xRun = pxMap->xExtents[--pxMap->xCount];  // Reopen the last run
+    } else if (!pxMap && pxFile->ulAddrCurrentCluster &&
+               ulFileCluster >= pxFile->ulCurrentCluster) {
+        // Without a map, start where FreeRTOS+FAT last was, as FF_SetCluster does
+        xRun.ulFileCluster = pxFile->ulCurrentCluster;
+        xRun.ulDiskCluster = pxFile->ulAddrCurrentCluster;
+        xRun.ulLength = 1;
+    } else {
+        xRun.ulFileCluster = 0;
+        xRun.ulDiskCluster = pxFile->ulObjectCluster;
+        xRun.ulLength = 1;
+    }
+    bool bFound = false;
+    FF_FATBuffers_t xFATBuffers;
+    FF_InitFATBuffers(&xFATBuffers, FF_MODE_READ);
+
+    FF_LockFAT(pxIOManager);
+    for (;;) {
+        uint32_t ulLastDisk = xRun.ulDiskCluster + xRun.ulLength - 1;
+        uint32_t ulNext = FF_getFATEntry(pxIOManager, ulLastDisk, pxError, &xFATBuffers);
+        if (FF_isERR(*pxError)) break;
+        bool bEnd = FF_isEndOfChain(pxIOManager, ulNext) || ulNext < 2;
+        if (!bEnd && ulNext == ulLastDisk + 1) {
+            ++xRun.ulLength;
+            continue;
+        }
+        // The run is complete
+        if (ulFileCluster < xRun.ulFileCluster + xRun.ulLength) {
+            *pxExtent = xRun;
+            bFound = true;
+        }
+        if (pxMap && pxMap->xCount < FF_EXTENTS_PER_MAP) {
+            pxMap->xExtents[pxMap->xCount++] = xRun;
+        }
+        if (bFound || bEnd) break;
+        xRun.ulFileCluster += xRun.ulLength;
+        xRun.ulDiskCluster = ulNext;
+        xRun.ulLength = 1;
+    }
+    FF_Error_t xTempError = FF_ReleaseFATBuffers(pxIOManager, &xFATBuffers);
+    FF_UnlockFAT(pxIOManager);
+    if (!FF_isERR(*pxError)) *pxError = xTempError;
+    return bFound && !FF_isERR(*pxError);
+}
+
+bool ff_extents_lookup(FF_FILE *pxFile, uint32_t ulFileCluster, ff_extent_t *pxExtent,
+                       FF_Error_t *pxError) {
+    *pxError = FF_ERR_NONE;
+    if (!pxFile->ulObjectCluster) return false;
+
+    ff_extent_map_t *pxMap = prvFindMap(pxFile);
+    const ff_extent_t *pxKnown = NULL;
+    if (pxMap) {
+        prvValidate(pxMap, pxFile);
+        pxKnown = prvSearch(pxMap, ulFileCluster);
+    }
+    bool bFound;
+    if (pxKnown) {
+        *pxExtent = *pxKnown;
+        bFound = true;
+    } else {
+        bFound = prvWalk(pxFile, pxMap, ulFileCluster, pxExtent, pxError);
+    }
+    if (bFound) {
+        uint32_t ulSkip = ulFileCluster - pxExtent->ulFileCluster;
+        pxExtent->ulFileCluster += ulSkip;
+        pxExtent->ulDiskCluster += ulSkip;
+        pxExtent->ulLength -= ulSkip;
+    }
+    TRACE_PRINTF("%s(%lu): %s\n", __func__, ulFileCluster, bFound ? "found" : "not found");
+    return bFound;
+}
+
+int ff_extents_fseek(FF_FILE *pxFile, long lOffset, int iWhence) {
+    int iResult = ff_fseek(pxFile, lOffset, iWhence);
+    if (iResult || !prvFindMap(pxFile)) return iResult;
+
+    /* Position the file on the cluster that holds the new file pointer,
+    so FreeRTOS+FAT doesn't have to traverse the FAT to find it. */
+    uint32_t ulFileCluster = pxFile->ulFilePointer / prvClusterSize(pxFile->pxIOManager);
+    if (ulFileCluster == pxFile->ulCurrentCluster) return iResult;
+    ff_extent_t xExtent;
+    FF_Error_t xError;
+    if (ff_extents_lookup(pxFile, ulFileCluster, &xExtent, &xError)) {
+        pxFile->ulCurrentCluster = ulFileCluster;
+        pxFile->ulAddrCurrentCluster = xExtent.ulDiskCluster;
+    }
+    return iResult;
+}
+
+/* [] END OF FILE */
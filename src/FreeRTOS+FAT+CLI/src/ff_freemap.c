@@ -0,0 +1,280 @@
+/*
+ * ff_freemap.c
+ */
+
+#include <string.h>
+//
+#include "FreeRTOS.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+//
+#include "delays.h"
+#include "my_debug.h"
+#include "sd_card.h"
+#include "sd_card_constants.h"
+#include "task_config.h"
+//
+#include "ff_freemap.h"
+
+#if defined(NDEBUG) || !USE_DBG_PRINTF
+#  pragma GCC diagnostic ignored "-Wunused-variable"
+#endif
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+struct ff_freemap_t {
+    FF_Disk_t *pxDisk;
+    volatile TaskHandle_t xTask;  // Builder task; NULL when it isn't running
+    TaskHandle_t xStopper;     // Task waiting in ff_freemap_stop for the builder to finish
+    volatile bool bAbort;      // Tells the builder task to give up
+    volatile bool bReady;      // Summary is complete
+    uint32_t ulEntriesPerGroup;
+    uint32_t ulGroups;
+    uint32_t ulFATSectors;     // Sectors in one copy of the FAT that hold cluster entries
+    uint32_t ulFreeClusters;   // Total found by the builder
+    uint32_t *pulGroupFree;    // Free clusters in each group (see ff_freemap.h)
+};
+
+static inline struct ff_freemap_t *prvGet(FF_Disk_t *pxDisk) {
+    sd_card_t *sd_card_p = pxDisk->pvTag;
+    return sd_card_p ? sd_card_p->state.freemap_p : NULL;
+}
+
+/* Count the free entries in a buffer full of FAT, skipping the entries for
+clusters 0 and 1 and anything past the last cluster. */
+static uint32_t prvCountFree(const uint8_t *pucBuffer, uint32_t ulFirstEntry, uint32_t ulEntries,
+                             uint32_t ulLastCluster, bool bFAT32) {
+    uint32_t ulFree = 0;
+    for (uint32_t i = 0; i < ulEntries; ++i) {
+        uint32_t ulCluster = ulFirstEntry + i;
+        if (ulCluster < 2) continue;
+        if (ulCluster > ulLastCluster) break;
+        uint32_t ulValue;
+        if (bFAT32) {
+            memcpy(&ulValue, pucBuffer + 4 * i, 4);
+            ulValue &= 0x0FFFFFFF;
+        } else {
+            uint16_t usValue;
+            memcpy(&usValue, pucBuffer + 2 * i, 2);
+            ulValue = usValue;
+        }
+        if (!ulValue) ++ulFree;
+    }
+    return ulFree;
+}
+
+/* Count a group's free clusters, reading its sectors of the FAT
+with one multiple block read into pucBuffer (FF_FREEMAP_READ_SECTORS sectors).
+The caller must hold the FAT lock, so that the FAT holds still while it is read.
+Returns false on error. */
+static bool prvCountGroup(struct ff_freemap_t *pxMap, uint32_t ulGroup, uint8_t *pucBuffer,
+                          uint32_t *pulFree) {
+    FF_IOManager_t *pxIOManager = pxMap->pxDisk->pxIOManager;
+    sd_card_t *sd_card_p = pxMap->pxDisk->pvTag;
+    const bool bFAT32 = FF_T_FAT32 == pxIOManager->xPartition.ucType;
+    const uint32_t ulEntriesPerSector = sd_block_size / (bFAT32 ? 4 : 2);
+    uint32_t ulSector = ulGroup * FF_FREEMAP_READ_SECTORS;
+    uint32_t ulCount = pxMap->ulFATSectors - ulSector;
+    if (ulCount > FF_FREEMAP_READ_SECTORS) ulCount = FF_FREEMAP_READ_SECTORS;
+
+    // Anything in the sector cache that hasn't been written yet has to go first
+    if (FF_isERR(FF_FlushCache(pxIOManager))) return false;
+    block_dev_err_t rc = sd_card_p->read_blocks(
+        sd_card_p, pucBuffer, pxIOManager->xPartition.ulFATBeginLBA + ulSector, ulCount);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != rc) return false;
+    *pulFree = prvCountFree(pucBuffer, ulGroup * pxMap->ulEntriesPerGroup,
+                            ulCount * ulEntriesPerSector,
+                            pxIOManager->xPartition.ulNumClusters + 1, bFAT32);
+    return true;
+}
+
+static void prvBuilderTask(void *arg) {
+    struct ff_freemap_t *pxMap = arg;
+    FF_IOManager_t *pxIOManager = pxMap->pxDisk->pxIOManager;
+    sd_card_t *sd_card_p = pxMap->pxDisk->pvTag;
+    uint32_t ulTotal = 0;
+    uint32_t ulStart = millis();
+
+    uint8_t *pucBuffer = pvPortMalloc(FF_FREEMAP_READ_SECTORS * sd_block_size);
+    bool bOK = pucBuffer != NULL;
+    for (uint32_t ulGroup = 0; bOK && ulGroup < pxMap->ulGroups && !pxMap->bAbort; ++ulGroup) {
+        uint32_t ulFree;
+        FF_LockFAT(pxIOManager);
+        bOK = prvCountGroup(pxMap, ulGroup, pucBuffer, &ulFree);
+        FF_UnlockFAT(pxIOManager);
+        if (!bOK) break;
+
+        pxMap->pulGroupFree[ulGroup] = ulFree;
+        ulTotal += ulFree;
+        taskYIELD();
+    }
+    vPortFree(pucBuffer);
+
+    if (bOK && !pxMap->bAbort) {
+        FF_LockFAT(pxIOManager);
+        /* If FreeRTOS+FAT counted the free clusters itself in the meantime
+        (e.g., because something was allocated), its count is the one to trust. */
+        if (!pxIOManager->xPartition.ulFreeClusterCount)
+            pxIOManager->xPartition.ulFreeClusterCount = ulTotal;
+        /* Start FreeRTOS+FAT's own search for free clusters at the first group with space.
+        This is a one-time seed: its allocator doesn't consult the summary after this. */
+        for (uint32_t ulGroup = 0; ulGroup < pxMap->ulGroups; ++ulGroup) {
+            if (pxMap->pulGroupFree[ulGroup]) {
+                uint32_t ulCluster = ulGroup * pxMap->ulEntriesPerGroup;
+                pxIOManager->xPartition.ulLastFreeCluster = ulCluster < 2 ? 2 : ulCluster;
+                break;
+            }
+        }
+        FF_UnlockFAT(pxIOManager);
+        pxMap->ulFreeClusters = ulTotal;
+        pxMap->bReady = true;
+        DBG_PRINTF("%s: %lu free clusters found in %lu ms\n", sd_card_p->device_name,
+                   ulTotal, millis() - ulStart);
+    }
+    taskENTER_CRITICAL();
+    pxMap->xTask = NULL;
+    TaskHandle_t xStopper = pxMap->xStopper;
+    taskEXIT_CRITICAL();
+    // pxMap may be freed as soon as the stopper is notified
+    if (xStopper) xTaskNotifyGiveIndexed(xStopper, NOTIFICATION_IX_FREEMAP);
+    vTaskDelete(NULL);
+}
+
+bool ff_freemap_start(FF_Disk_t *pxDisk) {
+    sd_card_t *sd_card_p = pxDisk->pvTag;
+    FF_IOManager_t *pxIOManager = pxDisk->pxIOManager;
+    configASSERT(sd_card_p);
+    if (sd_card_p->state.freemap_p) return true;
+    switch (pxIOManager->xPartition.ucType) {
+        case FF_T_FAT16:
+        case FF_T_FAT32:
+            break;
+        default:
+            return false;  // FAT12 volumes are small enough to scan
+    }
+    struct ff_freemap_t *pxMap = pvPortMalloc(sizeof(struct ff_freemap_t));
+    if (!pxMap) return false;
+    memset(pxMap, 0, sizeof *pxMap);
+    pxMap->pxDisk = pxDisk;
+    pxMap->ulEntriesPerGroup = FF_FREEMAP_READ_SECTORS * sd_block_size /
+                               (FF_T_FAT32 == pxIOManager->xPartition.ucType ? 4 : 2);
+    uint32_t ulEntries = pxIOManager->xPartition.ulNumClusters + 2;
+    pxMap->ulGroups = (ulEntries + pxMap->ulEntriesPerGroup - 1) / pxMap->ulEntriesPerGroup;
+    uint32_t ulEntriesPerSector = pxMap->ulEntriesPerGroup / FF_FREEMAP_READ_SECTORS;
+    pxMap->ulFATSectors = (ulEntries + ulEntriesPerSector - 1) / ulEntriesPerSector;
+    pxMap->pulGroupFree = pvPortMalloc(pxMap->ulGroups * sizeof(uint32_t));
+    if (!pxMap->pulGroupFree) {
+        vPortFree(pxMap);
+        return false;
+    }
+    sd_card_p->state.freemap_p = pxMap;
+    BaseType_t rc = xTaskCreate(prvBuilderTask, "freemap", 512, pxMap, PRIORITY_freemapTask,
+                                &pxMap->xTask);
+    if (pdPASS != rc) {
+        pxMap->xTask = NULL;
+        ff_freemap_stop(pxDisk);
+        return false;
+    }
+    return true;
+}
+
+void ff_freemap_stop(FF_Disk_t *pxDisk) {
+    sd_card_t *sd_card_p = pxDisk->pvTag;
+    struct ff_freemap_t *pxMap = prvGet(pxDisk);
+    if (!pxMap) return;
+    pxMap->bAbort = true;
+    taskENTER_CRITICAL();
+    bool bRunning = pxMap->xTask != NULL;
+    if (bRunning) pxMap->xStopper = xTaskGetCurrentTaskHandle();
+    taskEXIT_CRITICAL();
+    // The builder notices bAbort after the group it is counting, and notifies this task
+    while (bRunning && pxMap->xTask)
+        ulTaskNotifyTakeIndexed(NOTIFICATION_IX_FREEMAP, pdTRUE, portMAX_DELAY);
+    sd_card_p->state.freemap_p = NULL;
+    vPortFree(pxMap->pulGroupFree);
+    vPortFree(pxMap);
+}
+
+bool ff_freemap_ready(FF_Disk_t *pxDisk) {
+    struct ff_freemap_t *pxMap = prvGet(pxDisk);
+    return pxMap && pxMap->bReady;
+}
+
+uint32_t ff_freemap_free_clusters(FF_Disk_t *pxDisk, FF_Error_t *pxError) {
+    FF_IOManager_t *pxIOManager = pxDisk->pxIOManager;
+    *pxError = FF_ERR_NONE;
+    /* Once the summary is ready, FreeRTOS+FAT's own count is valid
+    and kept up to date as clusters are allocated and freed,
+    so only scan if neither is available. */
+    if (!ff_freemap_ready(pxDisk)) FF_GetFreeSize(pxIOManager, pxError);
+    return pxIOManager->xPartition.ulFreeClusterCount;
+}
+
+/* Count a group's free clusters again, from the FAT as it is now.
+*ppucBuffer is allocated on first use; the caller frees it.
+The caller must hold the FAT lock. Returns false on error. */
+static bool prvRecount(struct ff_freemap_t *pxMap, uint32_t ulGroup, uint8_t **ppucBuffer) {
+    if (!*ppucBuffer) *ppucBuffer = pvPortMalloc(FF_FREEMAP_READ_SECTORS * sd_block_size);
+    uint32_t ulFree;
+    if (!*ppucBuffer || !prvCountGroup(pxMap, ulGroup, *ppucBuffer, &ulFree)) return false;
+    TRACE_PRINTF("%s: group %lu: %lu -> %lu\n", __func__, ulGroup, pxMap->pulGroupFree[ulGroup],
+                 ulFree);
+    pxMap->pulGroupFree[ulGroup] = ulFree;
+    return true;
+}
+
+uint32_t ff_freemap_hint(FF_Disk_t *pxDisk, uint32_t ulCount) {
+    struct ff_freemap_t *pxMap = prvGet(pxDisk);
+    if (!pxMap || !pxMap->bReady) return 0;
+    /* A run that fits in a group can start in any group with that many free clusters;
+    a longer one needs a sequence of completely free groups.
+    A group's count only comes down with ff_freemap_claim, so it's counted again
+    before it's suggested, in case FreeRTOS+FAT has allocated clusters in it since. */
+    uint32_t ulNeed = ulCount < pxMap->ulEntriesPerGroup ? ulCount : pxMap->ulEntriesPerGroup;
+    uint32_t ulGroupsInRow = (ulCount + pxMap->ulEntriesPerGroup - 1) / pxMap->ulEntriesPerGroup;
+    uint8_t *pucBuffer = NULL;  // For recounting
+    uint32_t ulHint = 0;
+    uint32_t ulRow = 0;
+    for (uint32_t ulGroup = 0; !ulHint && ulGroup < pxMap->ulGroups; ++ulGroup) {
+        if (ulGroupsInRow <= 1) {
+            if (pxMap->pulGroupFree[ulGroup] >= ulNeed) {
+                if (!prvRecount(pxMap, ulGroup, &pucBuffer)) break;
+                if (pxMap->pulGroupFree[ulGroup] >= ulNeed)
+                    ulHint = ulGroup ? ulGroup * pxMap->ulEntriesPerGroup : 2;
+            }
+            continue;
+        }
+        if (pxMap->pulGroupFree[ulGroup] == pxMap->ulEntriesPerGroup) {
+            if (!prvRecount(pxMap, ulGroup, &pucBuffer)) break;
+        }
+        if (pxMap->pulGroupFree[ulGroup] == pxMap->ulEntriesPerGroup) {
+            if (++ulRow == ulGroupsInRow)
+                ulHint = (ulGroup + 1 - ulRow) * pxMap->ulEntriesPerGroup;
+        } else {
+            ulRow = 0;
+        }
+    }
+    vPortFree(pucBuffer);
+    return ulHint;
+}
+
+void ff_freemap_claim(FF_Disk_t *pxDisk, uint32_t ulCluster, uint32_t ulCount) {
+    struct ff_freemap_t *pxMap = prvGet(pxDisk);
+    if (!pxMap || !pxMap->bReady) return;
+    while (ulCount) {
+        uint32_t ulGroup = ulCluster / pxMap->ulEntriesPerGroup;
+        if (ulGroup >= pxMap->ulGroups) break;
+        uint32_t ulInGroup = pxMap->ulEntriesPerGroup - ulCluster % pxMap->ulEntriesPerGroup;
+        if (ulInGroup > ulCount) ulInGroup = ulCount;
+        if (pxMap->pulGroupFree[ulGroup] >= ulInGroup)
+            pxMap->pulGroupFree[ulGroup] -= ulInGroup;
+        else
+            pxMap->pulGroupFree[ulGroup] = 0;
+        ulCluster += ulInGroup;
+        ulCount -= ulInGroup;
+    }
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,322 @@
+/*
+ * ff_logger.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "FreeRTOS_strerror.h"
+#include "ff_direct.h"
+#include "ff_dirindex.h"
+#include "ff_utils.h"
+#include "my_debug.h"
+//
+#include "ff_logger.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+struct ff_logger_t {
+    ff_logger_config_t xConfig;
+
+    /* The ring. head and tail count bytes from the start, and are never wrapped.
+    Only producers (inside a critical section) change head;
+    only the writer task changes tail. */
+    uint8_t *pucRing;
+    volatile size_t xHead;
+    volatile size_t xTail;
+
+    uint8_t *pucChunk;     // Data on its way to the file
+    size_t xChunkFill;     // Bytes in pucChunk
+    uint32_t ulChunkOffs;  // File offset of pucChunk[0]
+
+    FF_FILE *pxFile;
+    TickType_t xMaxFileTicks;  // ulMaxFileSeconds, in ticks
+    TickType_t xFileOpened;
+    TickType_t xLastCommit;
+
+    TaskHandle_t xTask;
+    volatile bool bStop;
+    ff_logger_stats_t xStats;
+};
+
+static inline size_t prvAvailable(ff_logger_t *pxLogger) {
+    return pxLogger->xHead - pxLogger->xTail;
+}
+
+/* Must be called with interrupts masked. Returns true if the writer should be woken. */
+static bool prvPut(ff_logger_t *pxLogger, const void *pvRecord, size_t xLength) {
+    size_t xUsed = prvAvailable(pxLogger);
+    if (xLength > pxLogger->xConfig.xRingSize - xUsed) {
+        ++pxLogger->xStats.ulDroppedRecords;
+        pxLogger->xStats.ullDroppedBytes += xLength;
+        return false;
+    }
+    size_t xOffs = pxLogger->xHead % pxLogger->xConfig.xRingSize;
+    size_t xFirst = pxLogger->xConfig.xRingSize - xOffs;
+    if (xFirst > xLength) xFirst = xLength;
+    memcpy(pxLogger->pucRing + xOffs, pvRecord, xFirst);
+    memcpy(pxLogger->pucRing, (const uint8_t *)pvRecord + xFirst, xLength - xFirst);
+    pxLogger->xHead += xLength;
+    ++pxLogger->xStats.ulRecords;
+    pxLogger->xStats.ullBytes += xLength;
+    if (xUsed + xLength > pxLogger->xStats.xRingHighWater)
+        pxLogger->xStats.xRingHighWater = xUsed + xLength;
+    // Wake the writer when a chunk's worth has piled up
+    return xUsed < pxLogger->xConfig.xChunkSize &&
+           xUsed + xLength >= pxLogger->xConfig.xChunkSize;
+}
+
+bool ff_logger_write(ff_logger_t *pxLogger, const void *pvRecord, size_t xLength) {
+    taskENTER_CRITICAL();
+    uint32_t ulDropped = pxLogger->xStats.ulDroppedRecords;
+    bool bWake = prvPut(pxLogger, pvRecord, xLength);
+    bool bOk = ulDropped == pxLogger->xStats.ulDroppedRecords;
+    taskEXIT_CRITICAL();
+    if (bWake) xTaskNotifyGive(pxLogger->xTask);
+    return bOk;
+}
+
+bool ff_logger_write_from_isr(ff_logger_t *pxLogger, const void *pvRecord, size_t xLength) {
+    UBaseType_t uxSaved = taskENTER_CRITICAL_FROM_ISR();
+    uint32_t ulDropped = pxLogger->xStats.ulDroppedRecords;
+    bool bWake = prvPut(pxLogger, pvRecord, xLength);
+    bool bOk = ulDropped == pxLogger->xStats.ulDroppedRecords;
+    taskEXIT_CRITICAL_FROM_ISR(uxSaved);
+    if (bWake) {
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(pxLogger->xTask, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
+    return bOk;
+}
+
+/* Move up to xLimit bytes from the ring into the chunk buffer */
+static void prvTake(ff_logger_t *pxLogger, size_t xLimit) {
+    size_t xN = pxLogger->xConfig.xChunkSize - pxLogger->xChunkFill;
+    if (xN > xLimit) xN = xLimit;
+    size_t xOffs = pxLogger->xTail % pxLogger->xConfig.xRingSize;
+    size_t xFirst = pxLogger->xConfig.xRingSize - xOffs;
+    if (xFirst > xN) xFirst = xN;
+    memcpy(pxLogger->pucChunk + pxLogger->xChunkFill, pxLogger->pucRing + xOffs, xFirst);
+    memcpy(pxLogger->pucChunk + pxLogger->xChunkFill + xFirst, pxLogger->pucRing, xN - xFirst);
+    pxLogger->xChunkFill += xN;
+    __sync_synchronize();  // Finish reading before giving the space back
+    pxLogger->xTail += xN;
+}
+
+/* Write the chunk buffer at its place in the file.
+A partial chunk stays in the buffer and is written again, whole, when it fills,
+so the file is always written in whole, aligned chunks. */
+static bool prvWriteChunk(ff_logger_t *pxLogger) {
+    if (!pxLogger->pxFile || !pxLogger->xChunkFill) return true;
+    if ((uint32_t)ff_ftell(pxLogger->pxFile) != pxLogger->ulChunkOffs &&
+        ff_fseek(pxLogger->pxFile, pxLogger->ulChunkOffs, FF_SEEK_SET)) {
+        ++pxLogger->xStats.ulErrors;
+        return false;
+    }
+    uint64_t ullStart = to_us_since_boot(get_absolute_time());
+    size_t xN = ff_fwrite_direct(pxLogger->pucChunk, 1, pxLogger->xChunkFill, pxLogger->pxFile);
+    if (xN != pxLogger->xChunkFill) {
+        DBG_PRINTF("%s: ff_fwrite_direct: %s (%d)\n", __func__,
+                   FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+        ++pxLogger->xStats.ulErrors;
+        return false;
+    }
+    if (pxLogger->xChunkFill == pxLogger->xConfig.xChunkSize) {
+        uint32_t ulUs = to_us_since_boot(get_absolute_time()) - ullStart;
+        if (ulUs > pxLogger->xStats.ulMaxChunkWriteUs) pxLogger->xStats.ulMaxChunkWriteUs = ulUs;
+        ++pxLogger->xStats.ulChunks;
+        pxLogger->ulChunkOffs += pxLogger->xChunkFill;
+        pxLogger->xChunkFill = 0;
+    }
+    return true;
+}
+
+/* Make everything written so far durable: update the directory entry and flush */
+static void prvCommit(ff_logger_t *pxLogger) {
+    pxLogger->xLastCommit = xTaskGetTickCount();
+    if (!pxLogger->pxFile) return;
+    prvWriteChunk(pxLogger);
+    if (ff_set_fsize(pxLogger->pxFile)) ++pxLogger->xStats.ulErrors;
+    FF_FlushCache(pxLogger->pxFile->pxIOManager);
+    ++pxLogger->xStats.ulCommits;
+}
+
+static void prvClose(ff_logger_t *pxLogger) {
+    if (!pxLogger->pxFile) return;
+    prvCommit(pxLogger);
+    // Give back what's left of the preallocation, past the end of the data
+    if (ff_seteof(pxLogger->pxFile)) ++pxLogger->xStats.ulErrors;
+    if (ff_fclose(pxLogger->pxFile)) ++pxLogger->xStats.ulErrors;
+    pxLogger->pxFile = NULL;
+    pxLogger->xChunkFill = 0;
+}
+
+/* Name the next file from an 8.3 pattern like "LOG.BIN": LOG00000.BIN, LOG00001.BIN, ... */
+static bool prvSequenceName(ff_logger_t *pxLogger, char *pcPath, size_t xSize) {
+    char pcStem[8];
+    const char *pcPattern = pxLogger->xConfig.pcNamePattern;
+    const char *pcDot = strchr(pcPattern, '.');
+    size_t xStemLen = pcDot ? (size_t)(pcDot - pcPattern) : strlen(pcPattern);
+    if (xStemLen >= sizeof pcStem) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        return false;
+    }
+    memcpy(pcStem, pcPattern, xStemLen);
+    pcStem[xStemLen] = '\0';
+    return -1 != ff_di_next_name(pxLogger->xConfig.pcDirectory, pcStem, pcDot ? pcDot + 1 : "",
+                                 pcPath, xSize);
+}
+
+static bool prvOpen(ff_logger_t *pxLogger) {
+    char pcPath[128];
+    int n = snprintf(pcPath, sizeof pcPath, "%s", pxLogger->xConfig.pcDirectory);
+    if (n < 0 || n >= (int)sizeof pcPath - 2) return false;
+    if (-1 == mkdirhier(pcPath) && stdioGET_ERRNO() != pdFREERTOS_ERRNO_EEXIST) {
+        ++pxLogger->xStats.ulErrors;
+        return false;
+    }
+    if (!strchr(pxLogger->xConfig.pcNamePattern, '%')) {
+        if (!prvSequenceName(pxLogger, pcPath, sizeof pcPath)) {
+            DBG_PRINTF("%s: ff_di_next_name(%s, %s): %s (%d)\n", __func__,
+                       pxLogger->xConfig.pcDirectory, pxLogger->xConfig.pcNamePattern,
+                       FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+            ++pxLogger->xStats.ulErrors;
+            return false;
+        }
+    } else {
+        pcPath[n++] = '/';
+        const time_t xTime = FreeRTOS_time(NULL);
+        struct tm xTm;
+        localtime_r(&xTime, &xTm);
+        size_t xLen =
+            n + strftime(pcPath + n, sizeof pcPath - n, pxLogger->xConfig.pcNamePattern, &xTm);
+        if ((size_t)n == xLen) return false;
+        // Don't overwrite a file from an earlier rotation in the same second
+        FF_Stat_t xStat;
+        for (unsigned i = 1; 0 == ff_di_stat(pcPath, &xStat); ++i)
+            snprintf(pcPath + xLen, sizeof pcPath - xLen, ".%u", i);
+    }
+
+    pxLogger->pxFile = ff_fopen(pcPath, "w");
+    if (!pxLogger->pxFile) {
+        DBG_PRINTF("%s: ff_fopen(%s): %s (%d)\n", __func__, pcPath,
+                   FreeRTOS_strerror(stdioGET_ERRNO()), stdioGET_ERRNO());
+        ++pxLogger->xStats.ulErrors;
+        return false;
+    }
+    if (pxLogger->xConfig.xPreallocate)
+        ff_fallocate(pxLogger->pxFile, pxLogger->xConfig.xPreallocate, false);  // Not fatal
+    pxLogger->ulChunkOffs = 0;
+    pxLogger->xChunkFill = 0;
+    pxLogger->xFileOpened = xTaskGetTickCount();
+    ++pxLogger->xStats.ulFiles;
+    TRACE_PRINTF("%s: opened %s\n", __func__, pcPath);
+    return true;
+}
+
+static bool prvRotateDue(ff_logger_t *pxLogger) {
+    if (!pxLogger->pxFile) return false;
+    if (pxLogger->xConfig.xMaxFileSize &&
+        pxLogger->ulChunkOffs + pxLogger->xChunkFill >= pxLogger->xConfig.xMaxFileSize)
+        return true;
+    if (pxLogger->xMaxFileTicks &&
+        xTaskGetTickCount() - pxLogger->xFileOpened >= pxLogger->xMaxFileTicks)
+        return true;
+    return false;
+}
+
+static void prvWriterTask(void *pvParameters) {
+    ff_logger_t *pxLogger = pvParameters;
+    const TickType_t xCommitTicks = pdMS_TO_TICKS(pxLogger->xConfig.ulCommitMs);
+
+    prvOpen(pxLogger);
+    pxLogger->xLastCommit = xTaskGetTickCount();
+    for (;;) {
+        TickType_t xElapsed = xTaskGetTickCount() - pxLogger->xLastCommit;
+        ulTaskNotifyTake(pdTRUE, xElapsed < xCommitTicks ? xCommitTicks - xElapsed : 0);
+        bool bStop = pxLogger->bStop;
+
+        if (!pxLogger->pxFile && !prvOpen(pxLogger)) {
+            // Can't write anything; discard, so producers see drops rather than stalls
+            pxLogger->xTail = pxLogger->xHead;
+            if (bStop) break;
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        // Write whole chunks while there are any
+        while (pxLogger->xChunkFill + prvAvailable(pxLogger) >= pxLogger->xConfig.xChunkSize &&
+               !prvRotateDue(pxLogger)) {
+            prvTake(pxLogger, SIZE_MAX);
+            if (!prvWriteChunk(pxLogger)) break;
+        }
+        if (bStop || prvRotateDue(pxLogger)) {
+            /* Everything up to this head was put by whole records,
+            so the file ends on a record boundary. */
+            size_t xHead = pxLogger->xHead;
+            while (xHead != pxLogger->xTail) {
+                prvTake(pxLogger, xHead - pxLogger->xTail);
+                if (!prvWriteChunk(pxLogger)) break;
+            }
+            prvClose(pxLogger);
+            if (bStop) break;
+            prvOpen(pxLogger);
+        } else if (xTaskGetTickCount() - pxLogger->xLastCommit >= xCommitTicks) {
+            prvTake(pxLogger, prvAvailable(pxLogger));
+            prvCommit(pxLogger);
+        }
+    }
+    pxLogger->xTask = NULL;
+    vTaskDelete(NULL);
+}
+
+ff_logger_t *ff_logger_start(const ff_logger_config_t *pxConfig) {
+    configASSERT(pxConfig->xChunkSize && 0 == pxConfig->xChunkSize % 512);
+    configASSERT(pxConfig->xRingSize >= pxConfig->xChunkSize);
+    ff_logger_t *pxLogger = pvPortMalloc(sizeof(ff_logger_t));
+    if (!pxLogger) return NULL;
+    memset(pxLogger, 0, sizeof *pxLogger);
+    pxLogger->xConfig = *pxConfig;
+    if (!pxLogger->xConfig.ulCommitMs) pxLogger->xConfig.ulCommitMs = 1000;
+    // Limited to the longest age that a tick count can measure
+    uint64_t ullTicks = (uint64_t)pxConfig->ulMaxFileSeconds * configTICK_RATE_HZ;
+    pxLogger->xMaxFileTicks = ullTicks < portMAX_DELAY ? (TickType_t)ullTicks : portMAX_DELAY;
+    pxLogger->pucRing = pvPortMalloc(pxConfig->xRingSize);
+    pxLogger->pucChunk = pvPortMalloc(pxConfig->xChunkSize);
+    if (!pxLogger->pucRing || !pxLogger->pucChunk ||
+        pdPASS != xTaskCreate(prvWriterTask, "logger", 1024, pxLogger, pxConfig->uxPriority,
+                              &pxLogger->xTask)) {
+        vPortFree(pxLogger->pucChunk);
+        vPortFree(pxLogger->pucRing);
+        vPortFree(pxLogger);
+        return NULL;
+    }
+    return pxLogger;
+}
+
+void ff_logger_stop(ff_logger_t *pxLogger) {
+    pxLogger->bStop = true;
+    xTaskNotifyGive(pxLogger->xTask);
+    while (pxLogger->xTask) vTaskDelay(pdMS_TO_TICKS(1));
+    vPortFree(pxLogger->pucChunk);
+    vPortFree(pxLogger->pucRing);
+    vPortFree(pxLogger);
+}
+
+void ff_logger_get_stats(ff_logger_t *pxLogger, ff_logger_stats_t *pxStats) {
+    taskENTER_CRITICAL();
+    *pxStats = pxLogger->xStats;
+    taskEXIT_CRITICAL();
+}
+
+/* [] END OF FILE */
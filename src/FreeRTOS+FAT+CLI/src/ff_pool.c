@@ -0,0 +1,172 @@
+/*
+ * ff_pool.c
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "task.h"
+//
+#include "my_debug.h"
+//
+#include "ff_pool.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#if FF_USE_POOL
+
+typedef struct pool_block_t {
+    struct pool_block_t *pxNext;
+} pool_block_t;
+
+typedef struct {
+    size_t xBlockSize;
+    size_t xCount;
+    uint8_t *pucStart;
+    pool_block_t *pxFree;
+    size_t xInUse;
+    size_t xHighWater;
+    size_t xFallbacks;
+} pool_t;
+
+static uint8_t ucPool32[FF_POOL_COUNT_32 * 32] __attribute__((aligned(8)));
+static uint8_t ucPool64[FF_POOL_COUNT_64 * 64] __attribute__((aligned(8)));
+static uint8_t ucPool128[FF_POOL_COUNT_128 * 128] __attribute__((aligned(8)));
+static uint8_t ucPool256[FF_POOL_COUNT_256 * 256] __attribute__((aligned(8)));
+static uint8_t ucPool512[FF_POOL_COUNT_512 * 512] __attribute__((aligned(8)));
+
+// In ascending order of block size
+static pool_t xPools[] = {
+    {32, FF_POOL_COUNT_32, ucPool32},
+    {64, FF_POOL_COUNT_64, ucPool64},
+    {128, FF_POOL_COUNT_128, ucPool128},
+    {256, FF_POOL_COUNT_256, ucPool256},
+    {512, FF_POOL_COUNT_512, ucPool512},
+};
+
+/* Arena blocks have a header that gives their size and the size of the block
+before them, so that the top of the arena can be walked back down
+over blocks that were freed out of order. */
+typedef struct {
+    uint32_t ulSize;  // Including this header. Bit 0 is set when the block is free.
+    uint32_t ulPrev;  // Size of the previous block; 0 for the first block
+} arena_hdr_t;
+
+#define ARENA_NONE SIZE_MAX
+
+static uint8_t ucArena[FF_POOL_ARENA_SIZE] __attribute__((aligned(8)));
+static size_t xArenaTop;               // Offset of the first unused byte
+static size_t xArenaLast = ARENA_NONE; // Offset of the header of the topmost block
+static size_t xArenaHighWater;
+static size_t xArenaFallbacks;
+
+static bool bInitialized;
+
+static void prvInit(void) {
+    for (size_t i = 0; i < count_of(xPools); ++i) {
+        pool_t *pxPool = &xPools[i];
+        pxPool->pxFree = NULL;
+        for (size_t j = pxPool->xCount; j > 0; --j) {
+            pool_block_t *pxBlock = (pool_block_t *)(pxPool->pucStart + (j - 1) * pxPool->xBlockSize);
+            pxBlock->pxNext = pxPool->pxFree;
+            pxPool->pxFree = pxBlock;
+        }
+    }
+    bInitialized = true;
+}
+
+static void *prvArenaAlloc(size_t xSize) {
+    size_t xBlockSize = sizeof(arena_hdr_t) + ((xSize + 7) & ~(size_t)7);
+    if (xArenaTop + xBlockSize > sizeof ucArena) return NULL;
+    arena_hdr_t *pxHdr = (arena_hdr_t *)&ucArena[xArenaTop];
+    pxHdr->ulSize = xBlockSize;
+    pxHdr->ulPrev = ARENA_NONE == xArenaLast ? 0 : xArenaTop - xArenaLast;
+    xArenaLast = xArenaTop;
+    xArenaTop += xBlockSize;
+    if (xArenaTop > xArenaHighWater) xArenaHighWater = xArenaTop;
+    return pxHdr + 1;
+}
+
+static void prvArenaFree(void *pv) {
+    arena_hdr_t *pxHdr = (arena_hdr_t *)pv - 1;
+    myASSERT(!(pxHdr->ulSize & 1));
+    pxHdr->ulSize |= 1;
+    // Give back any free blocks at the top
+    while (ARENA_NONE != xArenaLast) {
+        arena_hdr_t *pxTop = (arena_hdr_t *)&ucArena[xArenaLast];
+        if (!(pxTop->ulSize & 1)) break;
+        xArenaTop = xArenaLast;
+        xArenaLast = pxTop->ulPrev ? xArenaLast - pxTop->ulPrev : ARENA_NONE;
+    }
+}
+
+void *ff_pool_malloc(size_t xSize) {
+    void *pv = NULL;
+    taskENTER_CRITICAL();
+    if (!bInitialized) prvInit();
+    size_t i;
+    for (i = 0; i < count_of(xPools) && xSize > xPools[i].xBlockSize; ++i);
+    if (i < count_of(xPools)) {
+        pool_t *pxPool = &xPools[i];
+        if (pxPool->pxFree) {
+            pv = pxPool->pxFree;
+            pxPool->pxFree = pxPool->pxFree->pxNext;
+            if (++pxPool->xInUse > pxPool->xHighWater) pxPool->xHighWater = pxPool->xInUse;
+        } else {
+            ++pxPool->xFallbacks;
+        }
+    } else {
+        pv = prvArenaAlloc(xSize);
+        if (!pv) ++xArenaFallbacks;
+    }
+    taskEXIT_CRITICAL();
+    if (!pv) {
+        TRACE_PRINTF("%s(%zu): falling back to pvPortMalloc\n", __func__, xSize);
+        pv = pvPortMalloc(xSize);
+    }
+    return pv;
+}
+
+void ff_pool_free(void *pv) {
+    if (!pv) return;
+    uint8_t *puc = pv;
+    taskENTER_CRITICAL();
+    for (size_t i = 0; i < count_of(xPools); ++i) {
+        pool_t *pxPool = &xPools[i];
+        if (pxPool->pucStart <= puc && puc < pxPool->pucStart + pxPool->xCount * pxPool->xBlockSize) {
+            pool_block_t *pxBlock = pv;
+            pxBlock->pxNext = pxPool->pxFree;
+            pxPool->pxFree = pxBlock;
+            --pxPool->xInUse;
+            taskEXIT_CRITICAL();
+            return;
+        }
+    }
+    if (ucArena <= puc && puc < ucArena + sizeof ucArena) {
+        prvArenaFree(pv);
+        taskEXIT_CRITICAL();
+        return;
+    }
+    taskEXIT_CRITICAL();
+    vPortFree(pv);
+}
+
+void ff_pool_stats(void) {
+    printf("%10s %8s %8s %10s %10s\n", "Block size", "Blocks", "In use", "High water", "Fallbacks");
+    for (size_t i = 0; i < count_of(xPools); ++i) {
+        pool_t *pxPool = &xPools[i];
+        printf("%10zu %8zu %8zu %10zu %10zu\n", pxPool->xBlockSize, pxPool->xCount,
+               pxPool->xInUse, pxPool->xHighWater, pxPool->xFallbacks);
+    }
+    printf("Arena: %zu of %zu bytes in use, high water %zu, fallbacks %zu\n", xArenaTop,
+           sizeof ucArena, xArenaHighWater, xArenaFallbacks);
+}
+
+#endif
+
+/* [] END OF FILE */
@@ -0,0 +1,294 @@
+/*
+ * ff_syscalls.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+//
+#include "pico/mutex.h"
+#include "pico/stdio.h"
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_direct.h"
+#include "ff_dirindex.h"
+#include "ff_extents.h"
+#include "file_stream.h"
+#include "my_debug.h"
+//
+#include "ff_syscalls.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#if FF_SYSCALLS
+
+typedef struct {
+    bool bInUse;
+    FF_FILE *pxFile;  // NULL until the file is open
+    int iAccess;      // O_RDONLY, O_WRONLY or O_RDWR
+    unsigned uUsers;  // Calls using pxFile now
+    bool bClosing;    // Closed; the last user closes pxFile
+} fd_slot_t;
+
+static fd_slot_t slots[FF_SYSCALLS_MAX_FILES];
+auto_init_mutex(slots_mutex);
+/* Held from the existence check to the ff_fopen when opening with O_CREAT,
+so that two opens can't both find that a file is missing
+(which would let both have O_EXCL, or have the second truncate the first's file).
+It doesn't stop a file from being created behind this layer's back, with ff_fopen. */
+auto_init_mutex(create_mutex);
+
+static bool is_stdio(int fd) {
+    return STDIN_FILENO == fd || STDOUT_FILENO == fd || STDERR_FILENO == fd;
+}
+
+/* Must be called with slots_mutex held */
+static fd_slot_t *get_slot(int fd) {
+    if (fd < FF_SYSCALLS_FIRST_FD || fd >= FF_SYSCALLS_FIRST_FD + FF_SYSCALLS_MAX_FILES)
+        return NULL;
+    fd_slot_t *slot_p = &slots[fd - FF_SYSCALLS_FIRST_FD];
+    return slot_p->pxFile && !slot_p->bClosing ? slot_p : NULL;
+}
+
+/* Look up an open fd and keep its file open until release_slot */
+static fd_slot_t *acquire_slot(int fd) {
+    mutex_enter_blocking(&slots_mutex);
+    fd_slot_t *slot_p = get_slot(fd);
+    if (slot_p) ++slot_p->uUsers;
+    mutex_exit(&slots_mutex);
+    return slot_p;
+}
+
+/* Close the file and free the slot. Returns 0, or -1 with errno set. */
+static int close_slot(fd_slot_t *slot_p, FF_FILE *pxFile) {
+    ff_extents_detach(pxFile);
+    int rc = 0;
+    if (ff_fclose(pxFile)) {
+        errno = stdioGET_ERRNO();
+        rc = -1;
+    }
+    mutex_enter_blocking(&slots_mutex);
+    slot_p->bClosing = false;
+    slot_p->bInUse = false;
+    mutex_exit(&slots_mutex);
+    return rc;
+}
+
+static void release_slot(fd_slot_t *slot_p) {
+    mutex_enter_blocking(&slots_mutex);
+    FF_FILE *pxFile = NULL;
+    if (!--slot_p->uUsers && slot_p->bClosing) {
+        // _close was called while this call was using the file
+        pxFile = slot_p->pxFile;
+        slot_p->pxFile = NULL;
+    }
+    mutex_exit(&slots_mutex);
+    if (pxFile) {
+        int iErrno = errno;  // The caller's, not the deferred close's
+        close_slot(slot_p, pxFile);
+        errno = iErrno;
+    }
+}
+
+/* Translate open(2) flags to an ff_fopen mode.
+FreeRTOS+FAT can't open a file for writing without either truncating it
+or requiring that it exist, so check for existence where it matters. */
+static const char *ff_mode(const char *pcPath, int iFlags) {
+    int iAccess = iFlags & O_ACCMODE;
+    if (O_RDONLY == iAccess) return "r";
+    bool bRead = O_RDWR == iAccess;
+    if (iFlags & O_APPEND) return bRead ? "a+" : "a";
+    if (iFlags & O_TRUNC) return bRead ? "w+" : "w";
+    if (iFlags & O_CREAT) {
+        FF_Stat_t xStat;
+        if (ff_di_stat(pcPath, &xStat) != 0) return bRead ? "w+" : "w";  // Doesn't exist yet
+    }
+    return "r+";
+}
+
+int _open(const char *pcPath, int iFlags, ...) {
+    TRACE_PRINTF("%s(%s, 0x%x)\n", __func__, pcPath, iFlags);
+
+    // Reserve a slot
+    mutex_enter_blocking(&slots_mutex);
+    size_t i;
+    for (i = 0; i < FF_SYSCALLS_MAX_FILES && slots[i].bInUse; ++i);
+    if (i < FF_SYSCALLS_MAX_FILES) slots[i].bInUse = true;
+    mutex_exit(&slots_mutex);
+    if (FF_SYSCALLS_MAX_FILES == i) {
+        errno = EMFILE;
+        return -1;
+    }
+    bool bCreate = iFlags & O_CREAT;
+    if (bCreate) mutex_enter_blocking(&create_mutex);
+    FF_FILE *pxFile = NULL;
+    FF_Stat_t xStat;
+    if (bCreate && (iFlags & O_EXCL) && 0 == ff_di_stat(pcPath, &xStat)) {
+        errno = EEXIST;
+    } else {
+        pxFile = ff_di_fopen(pcPath, ff_mode(pcPath, iFlags));
+        if (!pxFile) errno = stdioGET_ERRNO();
+    }
+    if (bCreate) mutex_exit(&create_mutex);
+    if (!pxFile) {
+        mutex_enter_blocking(&slots_mutex);
+        slots[i].bInUse = false;
+        mutex_exit(&slots_mutex);
+        return -1;
+    }
+    mutex_enter_blocking(&slots_mutex);
+    slots[i].iAccess = iFlags & O_ACCMODE;
+    slots[i].uUsers = 0;
+    slots[i].pxFile = pxFile;
+    mutex_exit(&slots_mutex);
+
+    ff_extents_attach(pxFile);  // Not fatal if there is no map available
+    return FF_SYSCALLS_FIRST_FD + i;
+}
+
+int _close(int fd) {
+    TRACE_PRINTF("%s(%d)\n", __func__, fd);
+
+    if (is_stdio(fd)) return 0;
+    mutex_enter_blocking(&slots_mutex);
+    fd_slot_t *slot_p = get_slot(fd);
+    if (!slot_p) {
+        mutex_exit(&slots_mutex);
+        errno = EBADF;
+        return -1;
+    }
+    // No new calls can get the file now
+    slot_p->bClosing = true;
+    FF_FILE *pxFile = NULL;
+    if (!slot_p->uUsers) {
+        pxFile = slot_p->pxFile;
+        slot_p->pxFile = NULL;
+    }
+    mutex_exit(&slots_mutex);
+    // Otherwise, the last call still using the file closes it
+    return pxFile ? close_slot(slot_p, pxFile) : 0;
+}
+
+int _read(int fd, char *pcBuffer, int iLength) {
+    if (STDIN_FILENO == fd) {
+#if PICO_SDK_VERSION_MAJOR < 2
+        int i;
+        for (i = 0; i < iLength; ++i) pcBuffer[i] = (char)getchar();
+        return i;
+#else
+        return stdio_get_until(pcBuffer, iLength, at_the_end_of_time);
+#endif
+    }
+    fd_slot_t *slot_p = acquire_slot(fd);
+    if (!slot_p || O_WRONLY == slot_p->iAccess) {
+        if (slot_p) release_slot(slot_p);
+        errno = EBADF;
+        return -1;
+    }
+    stdioSET_ERRNO(0);
+    size_t nr = ff_fread_direct(pcBuffer, 1, iLength, slot_p->pxFile);
+    int error = stdioGET_ERRNO();
+    release_slot(slot_p);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return nr;
+}
+
+int _write(int fd, char *pcBuffer, int iLength) {
+    if (STDOUT_FILENO == fd || STDERR_FILENO == fd) {
+#if PICO_SDK_VERSION_MAJOR < 2
+        for (int i = 0; i < iLength; ++i) putchar(pcBuffer[i]);
+#else
+        stdio_put_string(pcBuffer, iLength, false, PICO_STDIO_ENABLE_CRLF_SUPPORT);
+#endif
+        return iLength;
+    }
+    fd_slot_t *slot_p = acquire_slot(fd);
+    if (!slot_p || O_RDONLY == slot_p->iAccess) {
+        if (slot_p) release_slot(slot_p);
+        errno = EBADF;
+        return -1;
+    }
+    size_t nw = ff_fwrite_direct(pcBuffer, 1, iLength, slot_p->pxFile);
+    int error = stdioGET_ERRNO();
+    release_slot(slot_p);
+    if (nw < (size_t)iLength) {
+        if (!nw) {
+            errno = error ? error : EIO;
+            return -1;
+        }
+    }
+    return nw;
+}
+
+off_t _lseek(int fd, off_t pos, int whence) {
+    int ff_whence;
+    switch (whence) {
+        case SEEK_SET:
+            ff_whence = FF_SEEK_SET;
+            break;
+        case SEEK_CUR:
+            ff_whence = FF_SEEK_CUR;
+            break;
+        case SEEK_END:
+            ff_whence = FF_SEEK_END;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    fd_slot_t *slot_p = acquire_slot(fd);
+    if (!slot_p) {
+        errno = is_stdio(fd) ? ESPIPE : EBADF;
+        return -1;
+    }
+    off_t xPos = -1;
+    if (ff_extents_fseek(slot_p->pxFile, pos, ff_whence))
+        errno = stdioGET_ERRNO();
+    else
+        xPos = ff_ftell(slot_p->pxFile);
+    release_slot(slot_p);
+    return xPos;
+}
+
+int _fstat(int fd, struct stat *pxStat) {
+    memset(pxStat, 0, sizeof *pxStat);
+    if (is_stdio(fd)) {
+        pxStat->st_mode = S_IFCHR;
+        return 0;
+    }
+    fd_slot_t *slot_p = acquire_slot(fd);
+    if (!slot_p) {
+        errno = EBADF;
+        return -1;
+    }
+    pxStat->st_mode = S_IFREG;
+    pxStat->st_size = ff_filelength(slot_p->pxFile);
+    release_slot(slot_p);
+    // newlib uses this to size the FILE buffer, where it supports that
+    pxStat->st_blksize = FILE_STREAM_BUFFER_SIZE;
+    return 0;
+}
+
+int _isatty(int fd) {
+    if (is_stdio(fd)) return 1;
+    mutex_enter_blocking(&slots_mutex);
+    errno = get_slot(fd) ? ENOTTY : EBADF;
+    mutex_exit(&slots_mutex);
+    return 0;
+}
+
+#endif
+/* [] END OF FILE */
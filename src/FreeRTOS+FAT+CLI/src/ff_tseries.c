@@ -0,0 +1,343 @@
+/*
+ * ff_tseries.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+//
+#include "FreeRTOS.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_direct.h"
+#include "my_debug.h"
+//
+#include "ff_tseries.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#define TIME_SIZE sizeof(uint32_t)  // Time offset at the start of each record
+
+struct ff_ts_writer_t {
+    FF_FILE *pxData;
+    FF_FILE *pxIndex;
+    size_t xRecordSize;  // Payload
+    size_t xBlockSize;
+    uint8_t *pucBlock;   // The block being filled
+    size_t xFill;        // Bytes used in pucBlock
+    bool bIndexed;       // The block being filled has its index entry
+    int64_t llLastTime;
+};
+
+struct ff_ts_reader_t {
+    FF_FILE *pxData;
+    FF_FILE *pxIndex;      // NULL if there is no index
+    uint32_t ulIndexed;    // Blocks in the index
+    uint32_t ulBlocks;     // Blocks in the data file
+    size_t xRecordSize;
+    size_t xBlockSize;
+    uint8_t *pucBuffer;
+    size_t xBufferBlocks;
+};
+
+static inline ff_ts_block_hdr_t *prvHdr(ff_ts_writer_t *pxWriter) {
+    return (ff_ts_block_hdr_t *)pxWriter->pucBlock;
+}
+
+/* Returns 0, or -1 (and sets errno to ENAMETOOLONG) if it doesn't fit */
+static int prvIndexPath(const char *pcPath, char *pcIndexPath, size_t xSize) {
+    int n = snprintf(pcIndexPath, xSize, "%s.idx", pcPath);
+    if (n < 0 || (size_t)n >= xSize) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENAMETOOLONG);
+        return -1;
+    }
+    return 0;
+}
+
+static void prvStartBlock(ff_ts_writer_t *pxWriter, uint32_t ulBlock, int64_t llTime) {
+    memset(pxWriter->pucBlock, 0, pxWriter->xBlockSize);
+    ff_ts_block_hdr_t *pxHdr = prvHdr(pxWriter);
+    pxHdr->ulMagic = FF_TS_BLOCK_MAGIC;
+    pxHdr->ulBlock = ulBlock;
+    pxHdr->llFirstTime = llTime;
+    pxHdr->ulBlockSize = pxWriter->xBlockSize;
+    pxHdr->usRecordSize = pxWriter->xRecordSize;
+    pxWriter->xFill = sizeof(ff_ts_block_hdr_t);
+    pxWriter->bIndexed = false;
+}
+
+/* Write the block being filled, whole, at its place in the file.
+A partly filled block is written again when it fills. */
+static int prvWriteBlock(ff_ts_writer_t *pxWriter) {
+    ff_ts_block_hdr_t *pxHdr = prvHdr(pxWriter);
+    if (!pxHdr->usCount) return 0;
+    if (ff_fseek(pxWriter->pxData, pxHdr->ulBlock * pxWriter->xBlockSize, FF_SEEK_SET))
+        return -1;
+    if (ff_fwrite_direct(pxWriter->pucBlock, 1, pxWriter->xBlockSize, pxWriter->pxData) !=
+        pxWriter->xBlockSize)
+        return -1;
+    if (!pxWriter->bIndexed) {
+        if (ff_fseek(pxWriter->pxIndex,
+                     sizeof(ff_ts_index_hdr_t) + pxHdr->ulBlock * sizeof(int64_t), FF_SEEK_SET))
+            return -1;
+        if (ff_fwrite(&pxHdr->llFirstTime, sizeof(int64_t), 1, pxWriter->pxIndex) != 1)
+            return -1;
+        pxWriter->bIndexed = true;
+    }
+    return 0;
+}
+
+ff_ts_writer_t *ff_ts_create(const char *pcPath, size_t xRecordSize, size_t xBlockSize) {
+    if (!xBlockSize || xBlockSize % 512 || xRecordSize > UINT16_MAX ||
+        sizeof(ff_ts_block_hdr_t) + TIME_SIZE + xRecordSize > xBlockSize) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        return NULL;
+    }
+    ff_ts_writer_t *pxWriter = pvPortMalloc(sizeof(ff_ts_writer_t));
+    if (!pxWriter) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        return NULL;
+    }
+    memset(pxWriter, 0, sizeof *pxWriter);
+    pxWriter->xRecordSize = xRecordSize;
+    pxWriter->xBlockSize = xBlockSize;
+    pxWriter->llLastTime = INT64_MIN;
+    pxWriter->pucBlock = pvPortMalloc(xBlockSize);
+    if (!pxWriter->pucBlock) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        goto fail;
+    }
+    char pcIndexPath[ffconfigMAX_FILENAME + 4];
+    if (-1 == prvIndexPath(pcPath, pcIndexPath, sizeof pcIndexPath)) goto fail;
+    pxWriter->pxData = ff_fopen(pcPath, "w");
+    if (!pxWriter->pxData) goto fail;
+    pxWriter->pxIndex = ff_fopen(pcIndexPath, "w");
+    if (!pxWriter->pxIndex) goto fail;
+    ff_ts_index_hdr_t xIndexHdr = {FF_TS_INDEX_MAGIC, xBlockSize};
+    if (ff_fwrite(&xIndexHdr, sizeof xIndexHdr, 1, pxWriter->pxIndex) != 1) goto fail;
+
+    prvStartBlock(pxWriter, 0, 0);
+    return pxWriter;
+
+fail:
+    if (pxWriter->pxIndex) ff_fclose(pxWriter->pxIndex);
+    if (pxWriter->pxData) ff_fclose(pxWriter->pxData);
+    vPortFree(pxWriter->pucBlock);
+    vPortFree(pxWriter);
+    return NULL;
+}
+
+int ff_ts_append(ff_ts_writer_t *pxWriter, int64_t llTime, const void *pvRecord) {
+    if (llTime < pxWriter->llLastTime) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        return -1;
+    }
+    ff_ts_block_hdr_t *pxHdr = prvHdr(pxWriter);
+    if (pxHdr->usCount &&
+        (pxWriter->xFill + TIME_SIZE + pxWriter->xRecordSize > pxWriter->xBlockSize ||
+         pxHdr->usCount == UINT16_MAX || llTime - pxHdr->llFirstTime > UINT32_MAX)) {
+        // This block is finished
+        if (-1 == prvWriteBlock(pxWriter)) return -1;
+        prvStartBlock(pxWriter, pxHdr->ulBlock + 1, llTime);
+    }
+    if (!pxHdr->usCount) pxHdr->llFirstTime = llTime;
+    uint32_t ulOffset = llTime - pxHdr->llFirstTime;
+    memcpy(pxWriter->pucBlock + pxWriter->xFill, &ulOffset, TIME_SIZE);
+    memcpy(pxWriter->pucBlock + pxWriter->xFill + TIME_SIZE, pvRecord, pxWriter->xRecordSize);
+    pxWriter->xFill += TIME_SIZE + pxWriter->xRecordSize;
+    ++pxHdr->usCount;
+    pxWriter->llLastTime = llTime;
+    return 0;
+}
+
+int ff_ts_sync(ff_ts_writer_t *pxWriter) {
+    if (-1 == prvWriteBlock(pxWriter)) return -1;
+    if (ff_fflush(pxWriter->pxIndex)) return -1;
+    return ff_fflush(pxWriter->pxData);
+}
+
+int ff_ts_close(ff_ts_writer_t *pxWriter) {
+    int iResult = prvWriteBlock(pxWriter);
+    if (ff_fclose(pxWriter->pxIndex)) iResult = -1;
+    if (ff_fclose(pxWriter->pxData)) iResult = -1;
+    vPortFree(pxWriter->pucBlock);
+    vPortFree(pxWriter);
+    return iResult;
+}
+
+ff_ts_reader_t *ff_ts_open(const char *pcPath, size_t xBufferBlocks) {
+    ff_ts_reader_t *pxReader = pvPortMalloc(sizeof(ff_ts_reader_t));
+    if (!pxReader) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        return NULL;
+    }
+    memset(pxReader, 0, sizeof *pxReader);
+    pxReader->xBufferBlocks = xBufferBlocks ? xBufferBlocks : 1;
+
+    pxReader->pxData = ff_fopen(pcPath, "r");
+    if (!pxReader->pxData) goto fail;
+    ff_ts_block_hdr_t xHdr;
+    if (ff_fread(&xHdr, sizeof xHdr, 1, pxReader->pxData) != 1 ||
+        FF_TS_BLOCK_MAGIC != xHdr.ulMagic || !xHdr.ulBlockSize || xHdr.ulBlockSize % 512) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        goto fail;
+    }
+    pxReader->xBlockSize = xHdr.ulBlockSize;
+    pxReader->xRecordSize = xHdr.usRecordSize;
+    pxReader->ulBlocks = ff_filelength(pxReader->pxData) / pxReader->xBlockSize;
+
+    // The index is only an accelerator
+    char pcIndexPath[ffconfigMAX_FILENAME + 4];
+    if (0 == prvIndexPath(pcPath, pcIndexPath, sizeof pcIndexPath))
+        pxReader->pxIndex = ff_fopen(pcIndexPath, "r");
+    if (pxReader->pxIndex) {
+        ff_ts_index_hdr_t xIndexHdr;
+        if (ff_fread(&xIndexHdr, sizeof xIndexHdr, 1, pxReader->pxIndex) == 1 &&
+            FF_TS_INDEX_MAGIC == xIndexHdr.ulMagic &&
+            pxReader->xBlockSize == xIndexHdr.ulBlockSize) {
+            pxReader->ulIndexed =
+                (ff_filelength(pxReader->pxIndex) - sizeof xIndexHdr) / sizeof(int64_t);
+        } else {
+            ff_fclose(pxReader->pxIndex);
+            pxReader->pxIndex = NULL;
+        }
+    }
+    pxReader->pucBuffer = pvPortMalloc(pxReader->xBufferBlocks * pxReader->xBlockSize);
+    if (!pxReader->pucBuffer) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        goto fail;
+    }
+    return pxReader;
+
+fail:
+    if (pxReader->pxIndex) ff_fclose(pxReader->pxIndex);
+    if (pxReader->pxData) ff_fclose(pxReader->pxData);
+    vPortFree(pxReader);
+    return NULL;
+}
+
+void ff_ts_close_reader(ff_ts_reader_t *pxReader) {
+    if (pxReader->pxIndex) ff_fclose(pxReader->pxIndex);
+    ff_fclose(pxReader->pxData);
+    vPortFree(pxReader->pucBuffer);
+    vPortFree(pxReader);
+}
+
+/* Time of the first record in a block, from the index if possible */
+static int prvFirstTime(ff_ts_reader_t *pxReader, uint32_t ulBlock, int64_t *pllTime) {
+    if (ulBlock < pxReader->ulIndexed) {
+        if (ff_fseek(pxReader->pxIndex, sizeof(ff_ts_index_hdr_t) + ulBlock * sizeof(int64_t),
+                     FF_SEEK_SET) ||
+            ff_fread(pllTime, sizeof(int64_t), 1, pxReader->pxIndex) != 1)
+            return -1;
+        return 0;
+    }
+    ff_ts_block_hdr_t xHdr;
+    if (ff_fseek(pxReader->pxData, ulBlock * pxReader->xBlockSize, FF_SEEK_SET) ||
+        ff_fread(&xHdr, sizeof xHdr, 1, pxReader->pxData) != 1)
+        return -1;
+    if (FF_TS_BLOCK_MAGIC != xHdr.ulMagic || ulBlock != xHdr.ulBlock) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        return -1;
+    }
+    *pllTime = xHdr.llFirstTime;
+    return 0;
+}
+
+/* Find the last block whose first time is <= llTime (or block 0).
+If bBefore, find the last block whose first time is < llTime instead:
+times can repeat, so records at llTime can start in a block before the first one that begins with it. */
+static int prvFindBlock(ff_ts_reader_t *pxReader, int64_t llTime, bool bBefore,
+                        uint32_t *pulBlock) {
+    uint32_t ulLo = 0, ulHi = pxReader->ulBlocks;  // Answer is in [ulLo, ulHi)
+    while (ulHi - ulLo > 1) {
+        uint32_t ulMid = ulLo + (ulHi - ulLo) / 2;
+        int64_t llFirst;
+        if (-1 == prvFirstTime(pxReader, ulMid, &llFirst)) return -1;
+        if (llFirst < llTime || (!bBefore && llFirst == llTime))
+            ulLo = ulMid;
+        else
+            ulHi = ulMid;
+    }
+    *pulBlock = ulLo;
+    return 0;
+}
+
+long ff_ts_query(ff_ts_reader_t *pxReader, int64_t llFrom, int64_t llTo,
+                 ff_ts_visitor_t pxVisitor, void *pvArg) {
+    if (!pxReader->ulBlocks || llFrom > llTo) return 0;
+    uint32_t ulFirst, ulLast;
+    if (-1 == prvFindBlock(pxReader, llFrom, true, &ulFirst)) return -1;
+    if (-1 == prvFindBlock(pxReader, llTo, false, &ulLast)) return -1;
+    TRACE_PRINTF("%s: blocks %lu to %lu\n", __func__, (unsigned long)ulFirst,
+                 (unsigned long)ulLast);
+
+    long lVisited = 0;
+    const size_t xRecordSize = TIME_SIZE + pxReader->xRecordSize;
+    for (uint32_t ulBlock = ulFirst; ulBlock <= ulLast;) {
+        // Read as many of the blocks as fit in the buffer with one multiple block read
+        size_t xN = ulLast - ulBlock + 1;
+        if (xN > pxReader->xBufferBlocks) xN = pxReader->xBufferBlocks;
+        if (ff_fseek(pxReader->pxData, ulBlock * pxReader->xBlockSize, FF_SEEK_SET) ||
+            ff_fread_direct(pxReader->pucBuffer, pxReader->xBlockSize, xN, pxReader->pxData) !=
+                xN)
+            return -1;
+        for (size_t i = 0; i < xN; ++i) {
+            const uint8_t *pucBlock = pxReader->pucBuffer + i * pxReader->xBlockSize;
+            const ff_ts_block_hdr_t *pxHdr = (const ff_ts_block_hdr_t *)pucBlock;
+            if (FF_TS_BLOCK_MAGIC != pxHdr->ulMagic || ulBlock + i != pxHdr->ulBlock) {
+                stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+                return -1;
+            }
+            const uint8_t *pucRecord = pucBlock + sizeof(ff_ts_block_hdr_t);
+            for (size_t j = 0; j < pxHdr->usCount; ++j, pucRecord += xRecordSize) {
+                uint32_t ulOffset;
+                memcpy(&ulOffset, pucRecord, TIME_SIZE);
+                int64_t llTime = pxHdr->llFirstTime + ulOffset;
+                if (llTime < llFrom) continue;
+                if (llTime > llTo) return lVisited;
+                ++lVisited;
+                if (!pxVisitor(llTime, pucRecord + TIME_SIZE, pvArg)) return lVisited;
+            }
+        }
+        ulBlock += xN;
+    }
+    return lVisited;
+}
+
+int ff_ts_reindex(const char *pcPath) {
+    char pcIndexPath[ffconfigMAX_FILENAME + 4];
+    if (-1 == prvIndexPath(pcPath, pcIndexPath, sizeof pcIndexPath)) return -1;
+    FF_FILE *pxData = ff_fopen(pcPath, "r");
+    if (!pxData) return -1;
+    FF_FILE *pxIndex = ff_fopen(pcIndexPath, "w");
+    if (!pxIndex) {
+        ff_fclose(pxData);
+        return -1;
+    }
+    int iResult = 0;
+    ff_ts_block_hdr_t xHdr;
+    if (ff_fread(&xHdr, sizeof xHdr, 1, pxData) != 1 || FF_TS_BLOCK_MAGIC != xHdr.ulMagic ||
+        !xHdr.ulBlockSize) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        iResult = -1;
+    } else {
+        const uint32_t ulBlockSize = xHdr.ulBlockSize;
+        ff_ts_index_hdr_t xIndexHdr = {FF_TS_INDEX_MAGIC, ulBlockSize};
+        if (ff_fwrite(&xIndexHdr, sizeof xIndexHdr, 1, pxIndex) != 1) iResult = -1;
+        uint32_t ulBlocks = ff_filelength(pxData) / ulBlockSize;
+        for (uint32_t ulBlock = 0; !iResult && ulBlock < ulBlocks; ++ulBlock) {
+            if (ff_fseek(pxData, ulBlock * ulBlockSize, FF_SEEK_SET) ||
+                ff_fread(&xHdr, sizeof xHdr, 1, pxData) != 1 ||
+                ff_fwrite(&xHdr.llFirstTime, sizeof(int64_t), 1, pxIndex) != 1)
+                iResult = -1;
+        }
+    }
+    if (ff_fclose(pxIndex)) iResult = -1;
+    ff_fclose(pxData);
+    return iResult;
+}
+
+/* [] END OF FILE */
@@ -24,6 +24,8 @@ specific language governing permissions and limitations under the License.
 //
 #include "FreeRTOS_strerror.h"
 #include "SPI/sd_card_spi.h"
+#include "ff_dirindex.h"
+#include "ff_freemap.h"
 #include "file_stream.h"
 #include "hw_config.h"
 #include "my_debug.h"
@@ -86,6 +88,7 @@ bool format(const char *name) {
         return false;
     }
     FF_Error_t e = prvPartitionAndFormatDisk(pxDisk);
+    ff_di_invalidate(NULL);
     return FF_ERR_NONE == e ? true : false;
 }
 
@@ -107,6 +110,7 @@ void unmount(const char *name) {
         return;
     }
     FF_FS_Remove(sd_card_p->mount_point);
+    ff_di_invalidate(sd_card_p->mount_point);
     FF_Disk_t *pxDisk = &sd_card_p->state.ff_disk;
 
     /*Unmount the partition. */
@@ -126,9 +130,7 @@ void getFree(FF_Disk_t *pxDisk, uint64_t *pFreeMB, unsigned *pFreePct) {
     configASSERT(pxDisk);
     FF_IOManager_t *pxIOManager = pxDisk->pxIOManager;
 
-    FF_GetFreeSize(pxIOManager, &xError);
-
-    ullFreeSectors = pxIOManager->xPartition.ulFreeClusterCount *
+    ullFreeSectors = (uint64_t)ff_freemap_free_clusters(pxDisk, &xError) *
                      pxIOManager->xPartition.ulSectorsPerCluster;
     if (pxIOManager->xPartition.ulDataSectors == 0) {
         iPercentageFree = 0;
@@ -190,8 +192,165 @@ FF_Error_t ff_set_fsize(FF_FILE *pxStream) {
     return iReturn;
 }
 
+/* Search the FAT for ulCount consecutive free clusters, starting at
+ulStart and wrapping around to the first data cluster.
+Returns the first cluster of the run, or 0 if there is no such run.
+The caller must hold the FAT lock. */
+static uint32_t prvFindFreeRun(FF_IOManager_t *pxIOManager, uint32_t ulStart, uint32_t ulCount,
+                               FF_Error_t *pxError) {
+    const uint32_t ulFirst = 2, ulLast = pxIOManager->xPartition.ulNumClusters + 1;
+    uint32_t ulRunStart = 0, ulRunLength = 0;
+    FF_FATBuffers_t xFATBuffers;
+    FF_InitFATBuffers(&xFATBuffers, FF_MODE_READ);
+
+    if (ulStart < ulFirst || ulStart > ulLast) ulStart = ulFirst;
+    uint32_t ulCluster = ulStart;
+    for (uint32_t ulScanned = 0; ulScanned <= ulLast - ulFirst; ++ulScanned) {
+        if (ulCluster > ulLast) {
+            // Wrapped around: a run can't span the end of the FAT
+            ulCluster = ulFirst;
+            ulRunLength = 0;
+        }
+        uint32_t ulEntry = FF_getFATEntry(pxIOManager, ulCluster, pxError, &xFATBuffers);
+        if (FF_isERR(*pxError)) break;
+        if (0 == ulEntry) {
+            if (!ulRunLength) ulRunStart = ulCluster;
+            if (++ulRunLength == ulCount) break;
+        } else {
+            ulRunLength = 0;
+        }
+        ++ulCluster;
+    }
+    FF_Error_t xTempError = FF_ReleaseFATBuffers(pxIOManager, &xFATBuffers);
+    if (!FF_isERR(*pxError)) *pxError = xTempError;
+    if (FF_isERR(*pxError) || ulRunLength < ulCount) return 0;
+    return ulRunStart;
+}
+
+/* Extend the cluster chain of pxFile with ulCount clusters starting at
+ulRunStart, which must all be free. The caller must hold the FAT lock. */
+static FF_Error_t prvClaimRun(FF_FILE *pxFile, uint32_t ulEndOfChain, uint32_t ulRunStart,
+                              uint32_t ulCount) {
+    FF_IOManager_t *pxIOManager = pxFile->pxIOManager;
+    FF_Error_t xError = FF_ERR_NONE;
+    FF_FATBuffers_t xFATBuffers;
+    FF_InitFATBuffers(&xFATBuffers, FF_MODE_WRITE);
+
+    const uint32_t ulRunEnd = ulRunStart + ulCount - 1;
+    for (uint32_t ulCluster = ulRunStart; ulCluster <= ulRunEnd && !FF_isERR(xError);
+         ++ulCluster) {
+        // Link each cluster to its neighbour; terminate the chain at the last one
+        uint32_t ulNext = ulCluster == ulRunEnd ? 0xFFFFFFFF : ulCluster + 1;
+        xError = FF_putFATEntry(pxIOManager, ulCluster, ulNext, &xFATBuffers);
+    }
+    if (!FF_isERR(xError) && ulEndOfChain)
+        xError = FF_putFATEntry(pxIOManager, ulEndOfChain, ulRunStart, &xFATBuffers);
+    FF_Error_t xTempError = FF_ReleaseFATBuffers(pxIOManager, &xFATBuffers);
+    if (!FF_isERR(xError)) xError = xTempError;
+    if (FF_isERR(xError)) return xError;
+
+    FF_DecreaseFreeClusters(pxIOManager, ulCount);
+    pxIOManager->xPartition.ulLastFreeCluster = ulRunEnd + 1;
+    ff_freemap_claim(pxIOManager->xBlkDevice.pxDisk, ulRunStart, ulCount);
+
+    if (!ulEndOfChain) {
+        pxFile->ulObjectCluster = ulRunStart;
+        pxFile->ulAddrCurrentCluster = ulRunStart;
+        pxFile->ulCurrentCluster = 0;
+    }
+    pxFile->ulChainLength += ulCount;
+    pxFile->ulEndOfChain = ulRunEnd;
+    return xError;
+}
+
+/*
+ff_fallocate() - reserve a contiguous run of clusters for a file
+
+The file must be open for writing. Enough clusters are linked onto the end of
+the file's cluster chain to hold "size" bytes. The new clusters are taken from
+a single run of free clusters, preferably the one immediately following the
+current end of the chain, so that later sequential writes turn into long
+multiple block writes with no FAT updates. Nothing is written to the data
+area, so the reserved space reads back as whatever was on the card before.
+
+If bExtendSize is true, the file size is set to "size" and the directory
+entry is updated. Otherwise, the file size is left alone and grows as data
+is written, while the reservation remains attached to the file. If the file
+might be closed without anything having been written to it,
+call ff_seteof() first to hand the reservation back.
+
+returns:
+    0			success
+    -1 (and sets errno)	error. ENOSPC if there is no free run long enough.
+*/
+int ff_fallocate(FF_FILE *pxFile, size_t size, bool bExtendSize) {
+    FF_Error_t xError = FF_ERR_NONE;
+
+    if (!pxFile || !(pxFile->ucMode & FF_MODE_WRITE)) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EBADF);
+        return -1;
+    }
+    FF_IOManager_t *pxIOManager = pxFile->pxIOManager;
+    const uint32_t ulClusterSize =
+        pxIOManager->xPartition.ulSectorsPerCluster * pxIOManager->xPartition.usBlkSize;
+    // Rounded up without overflowing when size is close to 4 GiB
+    const uint32_t ulClustersNeeded = size / ulClusterSize + (0 != size % ulClusterSize);
+    bool bNewChain = false;
+
+    // FF_GetChainLength takes the FAT lock itself, so it is called first, as in FF_ExtendFile
+    uint32_t ulChainLength = 0, ulEndOfChain = 0;
+    if (pxFile->ulObjectCluster)
+        ulChainLength =
+            FF_GetChainLength(pxIOManager, pxFile->ulObjectCluster, &ulEndOfChain, &xError);
+    if (!FF_isERR(xError)) {
+        pxFile->ulChainLength = ulChainLength;
+        pxFile->ulEndOfChain = ulEndOfChain;
+    }
+
+    FF_LockFAT(pxIOManager);
+    {
+        if (!FF_isERR(xError) && ulChainLength < ulClustersNeeded) {
+            const uint32_t ulCount = ulClustersNeeded - ulChainLength;
+            uint32_t ulHint = ulEndOfChain + 1;
+            if (!ulEndOfChain) {
+                ulHint = ff_freemap_hint(pxIOManager->xBlkDevice.pxDisk, ulCount);
+                if (!ulHint) ulHint = pxIOManager->xPartition.ulLastFreeCluster;
+            }
+            uint32_t ulRunStart = prvFindFreeRun(pxIOManager, ulHint, ulCount, &xError);
+            if (!FF_isERR(xError) && !ulRunStart)
+                xError = FF_ERR_FAT_NO_FREE_CLUSTERS | FF_ERRFLAG;
+            if (!FF_isERR(xError)) {
+                bNewChain = !ulEndOfChain;
+                xError = prvClaimRun(pxFile, ulEndOfChain, ulRunStart, ulCount);
+            }
+        }
+    }
+    FF_UnlockFAT(pxIOManager);
+
+    if (!FF_isERR(xError) && (bNewChain || bExtendSize)) {
+        FF_DirEnt_t xOriginalEntry;
+        xError = FF_GetEntry(pxIOManager, pxFile->usDirEntry, pxFile->ulDirCluster,
+                             &xOriginalEntry);
+        if (!FF_isERR(xError)) {
+            if (bExtendSize && pxFile->ulFileSize < size) pxFile->ulFileSize = size;
+            xOriginalEntry.ulObjectCluster = pxFile->ulObjectCluster;
+            xOriginalEntry.ulFileSize = pxFile->ulFileSize;
+            xError = FF_PutEntry(pxIOManager, pxFile->usDirEntry, pxFile->ulDirCluster,
+                                 &xOriginalEntry, NULL);
+        }
+    }
+    if (!FF_isERR(xError)) xError = FF_FlushCache(pxIOManager);
+
+    int ff_errno = prvFFErrorToErrno(xError);
+    stdioSET_ERRNO(ff_errno);
+    return ff_errno ? -1 : 0;
+}
+
 /*
 ** mkdirhier() - create all directories in a given path
+** Paths it has made or found are remembered (see ff_di_known_dir),
+** so calling it again for the same directory costs one ff_di_stat
+** (usually one directory entry, from the index) instead of a walk from the root.
 ** returns:
 **	0			success
 **	1			all directories already exist
@@ -204,6 +363,22 @@ int mkdirhier(char *path) {
     char *dirp, *nextp = src;
     int retval = 1;
 
+    if (ff_di_known_dir(path)) {
+        // Only a hint: it might have been removed or renamed some other way since
+        FF_Stat_t xStat;
+        if (0 == ff_di_stat(path, &xStat) && FF_IFDIR == xStat.st_mode) return 1;
+    }
+
+    // Usually at most the last directory is missing: try that before walking from the root
+    if (0 == ff_di_mkdir(path)) {
+        ff_di_add_known_dir(path);
+        return 0;
+    }
+    if (pdFREERTOS_ERRNO_EEXIST == stdioGET_ERRNO()) {
+        ff_di_add_known_dir(path);
+        return 1;
+    }
+
     if (strlcpy(src, path, sizeof(src)) > sizeof(src)) {
         stdioSET_ERRNO(pdFREERTOS_ERRNO_ENAMETOOLONG);
         return -1;
@@ -219,7 +394,7 @@ int mkdirhier(char *path) {
         strlcat(dst, dirp, sizeof dst);
 
         //		DBG_PRINTF("Creating directory dst = %s\n",dst);
-        if (ff_mkdir(dst) == -1) {
+        if (ff_di_mkdir(dst) == -1) {
             if (stdioGET_ERRNO() != pdFREERTOS_ERRNO_EEXIST) {
                 int error = stdioGET_ERRNO();
                 DBG_PRINTF("%s: %s (%d)\n", __FUNCTION__, FreeRTOS_strerror(error), error);
@@ -228,6 +403,7 @@ int mkdirhier(char *path) {
         } else
             retval = 0;
     }
+    ff_di_add_known_dir(path);
 
     return retval;
 }
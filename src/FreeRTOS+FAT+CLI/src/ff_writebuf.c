@@ -0,0 +1,248 @@
+/*
+ * ff_writebuf.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+#include "event_groups.h"
+#include "semphr.h"
+#include "stream_buffer.h"
+#include "task.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "FreeRTOS_strerror.h"
+#include "ff_direct.h"
+#include "my_debug.h"
+//
+#include "ff_writebuf.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#define EV_PROGRESS (1 << 0)  // The drain task wrote something or flushed
+
+struct ff_writebuf_t {
+    ff_writebuf_config_t xConfig;
+    FF_FILE *pxFile;
+
+    StreamBufferHandle_t xStream;
+    SemaphoreHandle_t xWriteMutex;  // A stream buffer allows only one writer at a time
+    SemaphoreHandle_t xRoom;        // Given by the drain task whenever it makes room
+    EventGroupHandle_t xEvents;
+    uint8_t *pucChunk;              // Data on its way from the stream buffer to the file
+
+    volatile uint64_t ullTaken;        // Bytes taken from the stream buffer (and written)
+    volatile uint64_t ullDurable;      // Bytes written and flushed with ff_fflush
+    volatile uint64_t ullFlushTarget;  // Bytes ff_writebuf_flush is waiting for
+
+    TaskHandle_t xTask;
+    volatile bool bStop;
+    ff_writebuf_stats_t xStats;
+};
+
+static inline uint32_t prvMicros(void) {
+    return to_us_since_boot(get_absolute_time());
+}
+
+bool ff_writebuf_write(ff_writebuf_t *pxWb, const void *pvData, size_t xLength) {
+    uint32_t ulStart = prvMicros();
+    TimeOut_t xTimeOut;
+    TickType_t xTicksToWait = pxWb->xConfig.xMaxBlock;
+    vTaskSetTimeOutState(&xTimeOut);
+    bool bOk = false;
+
+    if (xLength <= pxWb->xConfig.xBufferSize &&
+        pdTRUE == xSemaphoreTake(pxWb->xWriteMutex, xTicksToWait)) {
+        for (;;) {
+            // All or nothing: never leave part of a write in the buffer
+            if (xStreamBufferSpacesAvailable(pxWb->xStream) >= xLength) {
+                xStreamBufferSend(pxWb->xStream, pvData, xLength, 0);
+                bOk = true;
+                break;
+            }
+            if (xTaskCheckForTimeOut(&xTimeOut, &xTicksToWait)) break;
+            xSemaphoreTake(pxWb->xRoom, xTicksToWait);
+        }
+        size_t xUsed = xStreamBufferBytesAvailable(pxWb->xStream);
+        uint32_t ulUs = prvMicros() - ulStart;
+        taskENTER_CRITICAL();
+        if (bOk) {
+            ++pxWb->xStats.ulWrites;
+            pxWb->xStats.ullBytes += xLength;
+        }
+        if (xUsed > pxWb->xStats.xHighWater) pxWb->xStats.xHighWater = xUsed;
+        if (ulUs > pxWb->xStats.ulMaxBlockUs) pxWb->xStats.ulMaxBlockUs = ulUs;
+        taskEXIT_CRITICAL();
+        xSemaphoreGive(pxWb->xWriteMutex);
+    }
+    if (!bOk) {
+        taskENTER_CRITICAL();
+        ++pxWb->xStats.ulDrops;
+        pxWb->xStats.ullDroppedBytes += xLength;
+        taskEXIT_CRITICAL();
+    }
+    return bOk;
+}
+
+static void prvWrite(ff_writebuf_t *pxWb, size_t xLength) {
+    uint32_t ulStart = prvMicros();
+    size_t xN = ff_fwrite_direct(pxWb->pucChunk, 1, xLength, pxWb->pxFile);
+    uint32_t ulUs = prvMicros() - ulStart;
+    int iError = xN == xLength ? 0 : stdioGET_ERRNO();
+
+    taskENTER_CRITICAL();
+    ++pxWb->xStats.ulCardWrites;
+    pxWb->xStats.ullWritten += xN;
+    if (ulUs > pxWb->xStats.ulMaxWriteUs) pxWb->xStats.ulMaxWriteUs = ulUs;
+    if (ulUs > pxWb->xConfig.ulStallMs * 1000) ++pxWb->xStats.ulStalls;
+    if (xN != xLength) {
+        ++pxWb->xStats.ulErrors;
+        pxWb->xStats.iLastError = iError;
+    }
+    taskEXIT_CRITICAL();
+
+    if (xN != xLength)
+        DBG_PRINTF("%s: ff_fwrite_direct: %s (%d)\n", __func__, FreeRTOS_strerror(iError),
+                   iError);
+    if (ulUs > pxWb->xConfig.ulStallMs * 1000)
+        TRACE_PRINTF("%s: write of %zu bytes took %lu us\n", __func__, xLength,
+                     (unsigned long)ulUs);
+}
+
+static void prvDrainTask(void *pvParameters) {
+    ff_writebuf_t *pxWb = pvParameters;
+
+    for (;;) {
+        /* Returns when there is a whole chunk (the trigger level),
+        or after xIdleFlush with whatever there is */
+        size_t xN = xStreamBufferReceive(pxWb->xStream, pxWb->pucChunk,
+                                         pxWb->xConfig.xChunkSize, pxWb->xConfig.xIdleFlush);
+        if (xN) {
+            xSemaphoreGive(pxWb->xRoom);
+            prvWrite(pxWb, xN);  // On error, the data is lost, but producers aren't stalled
+            taskENTER_CRITICAL();
+            pxWb->ullTaken += xN;
+            taskEXIT_CRITICAL();
+        }
+        const bool bEmpty = xStreamBufferIsEmpty(pxWb->xStream);
+        /* Make what's been written durable when there's nothing else to do,
+        or when ff_writebuf_flush is waiting for it (producers may never let the buffer empty) */
+        taskENTER_CRITICAL();
+        const uint64_t ullTaken = pxWb->ullTaken;
+        const bool bFlush = ullTaken > pxWb->ullDurable &&
+                            (bEmpty || (pxWb->ullFlushTarget > pxWb->ullDurable &&
+                                        ullTaken >= pxWb->ullFlushTarget));
+        taskEXIT_CRITICAL();
+        if (bFlush) {
+            if (ff_fflush(pxWb->pxFile)) {
+                taskENTER_CRITICAL();
+                ++pxWb->xStats.ulErrors;
+                pxWb->xStats.iLastError = stdioGET_ERRNO();
+                taskEXIT_CRITICAL();
+            }
+            taskENTER_CRITICAL();
+            pxWb->ullDurable = ullTaken;
+            taskEXIT_CRITICAL();
+        }
+        if (bEmpty && pxWb->bStop) break;
+        xEventGroupSetBits(pxWb->xEvents, EV_PROGRESS);
+    }
+    pxWb->xTask = NULL;
+    vTaskDelete(NULL);
+}
+
+ff_writebuf_t *ff_writebuf_open(FF_FILE *pxFile, const ff_writebuf_config_t *pxConfig) {
+    configASSERT(pxFile);
+    configASSERT(pxConfig->xChunkSize && 0 == pxConfig->xChunkSize % 512);
+    configASSERT(pxConfig->xBufferSize >= pxConfig->xChunkSize);
+    ff_writebuf_t *pxWb = pvPortMalloc(sizeof(ff_writebuf_t));
+    if (!pxWb) return NULL;
+    memset(pxWb, 0, sizeof *pxWb);
+    pxWb->xConfig = *pxConfig;
+    if (!pxWb->xConfig.xIdleFlush) pxWb->xConfig.xIdleFlush = pdMS_TO_TICKS(100);
+    if (!pxWb->xConfig.ulStallMs) pxWb->xConfig.ulStallMs = 50;
+    pxWb->pxFile = pxFile;
+
+    pxWb->xStream = xStreamBufferCreate(pxConfig->xBufferSize, pxConfig->xChunkSize);
+    pxWb->xWriteMutex = xSemaphoreCreateMutex();
+    pxWb->xRoom = xSemaphoreCreateBinary();
+    pxWb->xEvents = xEventGroupCreate();
+    pxWb->pucChunk = pvPortMalloc(pxConfig->xChunkSize);
+    if (!pxWb->xStream || !pxWb->xWriteMutex || !pxWb->xRoom || !pxWb->xEvents ||
+        !pxWb->pucChunk ||
+        pdPASS != xTaskCreate(prvDrainTask, "writebuf", 1024, pxWb, pxConfig->uxPriority,
+                              &pxWb->xTask)) {
+        if (pxWb->xStream) vStreamBufferDelete(pxWb->xStream);
+        if (pxWb->xWriteMutex) vSemaphoreDelete(pxWb->xWriteMutex);
+        if (pxWb->xRoom) vSemaphoreDelete(pxWb->xRoom);
+        if (pxWb->xEvents) vEventGroupDelete(pxWb->xEvents);
+        vPortFree(pxWb->pucChunk);
+        vPortFree(pxWb);
+        return NULL;
+    }
+    return pxWb;
+}
+
+bool ff_writebuf_flush(ff_writebuf_t *pxWb, TickType_t xTimeout) {
+    // Everything accepted before now
+    taskENTER_CRITICAL();
+    uint64_t ullTarget = pxWb->xStats.ullBytes;
+    if (ullTarget > pxWb->ullFlushTarget) pxWb->ullFlushTarget = ullTarget;
+    taskEXIT_CRITICAL();
+
+    TimeOut_t xTimeOut;
+    vTaskSetTimeOutState(&xTimeOut);
+    for (;;) {
+        xEventGroupClearBits(pxWb->xEvents, EV_PROGRESS);
+        taskENTER_CRITICAL();
+        bool bDone = pxWb->ullDurable >= ullTarget;
+        taskEXIT_CRITICAL();
+        if (bDone) return true;
+        if (xTaskCheckForTimeOut(&xTimeOut, &xTimeout)) return false;
+        xEventGroupWaitBits(pxWb->xEvents, EV_PROGRESS, pdFALSE, pdFALSE, xTimeout);
+    }
+}
+
+bool ff_writebuf_close(ff_writebuf_t *pxWb) {
+    pxWb->bStop = true;
+    while (pxWb->xTask) vTaskDelay(pdMS_TO_TICKS(1));
+    bool bOk = !pxWb->xStats.ulErrors && !pxWb->xStats.ulDrops;
+    vStreamBufferDelete(pxWb->xStream);
+    vSemaphoreDelete(pxWb->xWriteMutex);
+    vSemaphoreDelete(pxWb->xRoom);
+    vEventGroupDelete(pxWb->xEvents);
+    vPortFree(pxWb->pucChunk);
+    vPortFree(pxWb);
+    return bOk;
+}
+
+void ff_writebuf_get_stats(ff_writebuf_t *pxWb, ff_writebuf_stats_t *pxStats) {
+    taskENTER_CRITICAL();
+    *pxStats = pxWb->xStats;
+    taskEXIT_CRITICAL();
+}
+
+void ff_writebuf_print_stats(ff_writebuf_t *pxWb) {
+    ff_writebuf_stats_t xStats;
+    ff_writebuf_get_stats(pxWb, &xStats);
+    printf("Accepted: %lu writes, %llu bytes; dropped: %lu writes, %llu bytes\n",
+           (unsigned long)xStats.ulWrites, xStats.ullBytes, (unsigned long)xStats.ulDrops,
+           xStats.ullDroppedBytes);
+    printf("Buffer high water: %zu of %zu bytes; longest wait for room: %lu us\n",
+           xStats.xHighWater, pxWb->xConfig.xBufferSize, (unsigned long)xStats.ulMaxBlockUs);
+    printf("Card: %lu writes, %llu bytes; slowest: %lu us; stalls (> %lu ms): %lu\n",
+           (unsigned long)xStats.ulCardWrites, xStats.ullWritten,
+           (unsigned long)xStats.ulMaxWriteUs, (unsigned long)pxWb->xConfig.ulStallMs,
+           (unsigned long)xStats.ulStalls);
+    if (xStats.ulErrors)
+        printf("Errors: %lu; last: %s (%d)\n", (unsigned long)xStats.ulErrors,
+               FreeRTOS_strerror(xStats.iLastError), xStats.iLastError);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,332 @@
+/*
+ * ff_zstream.c
+ */
+
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "FreeRTOS.h"
+//
+#include "ff_headers.h"
+#include "ff_stdio.h"
+//
+#include "ff_direct.h"
+#include "my_debug.h"
+//
+#include "ff_zstream.h"
+
+#define TRACE_PRINTF(fmt, args...)
+// #define TRACE_PRINTF printf
+
+#define MAX_VARINT 5  // Bytes to code 32 bits, 7 at a time
+
+struct ff_zwriter_t {
+    FF_FILE *pxFile;
+    uint16_t usChannels;
+    size_t xBlockSize;
+    uint8_t *pucBlock;
+    size_t xFill;      // Bytes used in pucBlock
+    int32_t *plPrev;   // Previous frame
+    ff_zs_stats_t xStats;
+};
+
+struct ff_zreader_t {
+    FF_FILE *pxFile;
+    uint16_t usChannels;
+    size_t xBlockSize;
+    uint32_t ulBlocks;
+    uint8_t *pucBlock;
+    int32_t *plPrev;
+    // Decoder position
+    uint32_t ulBlock;        // Block in pucBlock, or UINT32_MAX
+    size_t xPos;             // Offset in pucBlock of the next frame
+    uint32_t ulFrameInBlock; // Index in the block of the next frame
+    uint64_t ullNextFrame;   // Number of the next frame
+};
+
+static inline uint32_t prvZigZag(int32_t l) {
+    return ((uint32_t)l << 1) ^ (uint32_t)(l >> 31);
+}
+static inline int32_t prvUnZigZag(uint32_t ul) {
+    return (int32_t)(ul >> 1) ^ -(int32_t)(ul & 1);
+}
+
+static inline uint8_t *prvPutVarint(uint8_t *puc, uint32_t ul) {
+    while (ul >= 0x80) {
+        *puc++ = (uint8_t)ul | 0x80;
+        ul >>= 7;
+    }
+    *puc++ = (uint8_t)ul;
+    return puc;
+}
+static inline const uint8_t *prvGetVarint(const uint8_t *puc, const uint8_t *pucEnd,
+                                          uint32_t *pul) {
+    uint32_t ul = 0;
+    for (unsigned uShift = 0; puc < pucEnd && uShift < 35; uShift += 7) {
+        uint8_t uc = *puc++;
+        ul |= (uint32_t)(uc & 0x7F) << uShift;
+        if (!(uc & 0x80)) {
+            *pul = ul;
+            return puc;
+        }
+    }
+    return NULL;  // Corrupt
+}
+
+static inline ff_zs_block_hdr_t *prvHdr(ff_zwriter_t *pxWriter) {
+    return (ff_zs_block_hdr_t *)pxWriter->pucBlock;
+}
+
+static void prvStartBlock(ff_zwriter_t *pxWriter, uint32_t ulBlock, uint64_t ullFirstFrame) {
+    memset(pxWriter->pucBlock, 0, pxWriter->xBlockSize);
+    ff_zs_block_hdr_t *pxHdr = prvHdr(pxWriter);
+    pxHdr->ulMagic = FF_ZS_BLOCK_MAGIC;
+    pxHdr->ulBlock = ulBlock;
+    pxHdr->ullFirstFrame = ullFirstFrame;
+    pxHdr->ulBlockSize = pxWriter->xBlockSize;
+    pxHdr->usChannels = pxWriter->usChannels;
+    pxWriter->xFill = sizeof(ff_zs_block_hdr_t);
+    memset(pxWriter->plPrev, 0, pxWriter->usChannels * sizeof(int32_t));
+}
+
+/* Write the block being filled, whole, at its place in the file */
+static int prvWriteBlock(ff_zwriter_t *pxWriter) {
+    ff_zs_block_hdr_t *pxHdr = prvHdr(pxWriter);
+    if (!pxHdr->ulFrames) return 0;
+    pxHdr->ulBytes = pxWriter->xFill - sizeof(ff_zs_block_hdr_t);
+    uint64_t ullStart = to_us_since_boot(get_absolute_time());
+    if (ff_fseek(pxWriter->pxFile, pxHdr->ulBlock * pxWriter->xBlockSize, FF_SEEK_SET) ||
+        ff_fwrite_direct(pxWriter->pucBlock, 1, pxWriter->xBlockSize, pxWriter->pxFile) !=
+            pxWriter->xBlockSize)
+        return -1;
+    pxWriter->xStats.ullWriteUs += to_us_since_boot(get_absolute_time()) - ullStart;
+    return 0;
+}
+
+ff_zwriter_t *ff_zw_create(const char *pcPath, uint16_t usChannels, size_t xBlockSize) {
+    if (!usChannels || !xBlockSize || xBlockSize % 512 ||
+        sizeof(ff_zs_block_hdr_t) + usChannels * MAX_VARINT > xBlockSize) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        return NULL;
+    }
+    ff_zwriter_t *pxWriter = pvPortMalloc(sizeof(ff_zwriter_t));
+    if (!pxWriter) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        return NULL;
+    }
+    memset(pxWriter, 0, sizeof *pxWriter);
+    pxWriter->usChannels = usChannels;
+    pxWriter->xBlockSize = xBlockSize;
+    pxWriter->pucBlock = pvPortMalloc(xBlockSize);
+    pxWriter->plPrev = pvPortMalloc(usChannels * sizeof(int32_t));
+    if (!pxWriter->pucBlock || !pxWriter->plPrev) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        goto fail;
+    }
+    pxWriter->pxFile = ff_fopen(pcPath, "w");
+    if (!pxWriter->pxFile) goto fail;
+    prvStartBlock(pxWriter, 0, 0);
+    return pxWriter;
+
+fail:
+    vPortFree(pxWriter->plPrev);
+    vPortFree(pxWriter->pucBlock);
+    vPortFree(pxWriter);
+    return NULL;
+}
+
+int ff_zw_write(ff_zwriter_t *pxWriter, const int32_t *plSamples, size_t xFrames) {
+    const size_t xMaxFrame = pxWriter->usChannels * MAX_VARINT;
+    uint64_t ullStart = to_us_since_boot(get_absolute_time());
+    uint64_t ullWriteUs = pxWriter->xStats.ullWriteUs;
+    for (size_t i = 0; i < xFrames; ++i) {
+        ff_zs_block_hdr_t *pxHdr = prvHdr(pxWriter);
+        if (pxWriter->xFill + xMaxFrame > pxWriter->xBlockSize) {
+            // No room for a frame that doesn't compress: this block is finished
+            if (-1 == prvWriteBlock(pxWriter)) return -1;
+            ++pxWriter->xStats.ulBlocks;
+            pxWriter->xStats.ullCodedBytes += pxWriter->xBlockSize;
+            prvStartBlock(pxWriter, pxHdr->ulBlock + 1, pxHdr->ullFirstFrame + pxHdr->ulFrames);
+        }
+        uint8_t *puc = pxWriter->pucBlock + pxWriter->xFill;
+        for (size_t j = 0; j < pxWriter->usChannels; ++j) {
+            int32_t lSample = *plSamples++;
+            // Modular arithmetic, so that any delta round-trips
+            int32_t lDelta = (int32_t)((uint32_t)lSample - (uint32_t)pxWriter->plPrev[j]);
+            pxWriter->plPrev[j] = lSample;
+            puc = prvPutVarint(puc, prvZigZag(lDelta));
+        }
+        pxWriter->xFill = puc - pxWriter->pucBlock;
+        ++pxHdr->ulFrames;
+    }
+    pxWriter->xStats.ullFrames += xFrames;
+    pxWriter->xStats.ullRawBytes += xFrames * pxWriter->usChannels * sizeof(int32_t);
+    // Time spent here, less time spent writing finished blocks
+    pxWriter->xStats.ullEncodeUs += to_us_since_boot(get_absolute_time()) - ullStart -
+                                    (pxWriter->xStats.ullWriteUs - ullWriteUs);
+    return 0;
+}
+
+int ff_zw_sync(ff_zwriter_t *pxWriter) {
+    if (-1 == prvWriteBlock(pxWriter)) return -1;
+    return ff_fflush(pxWriter->pxFile);
+}
+
+void ff_zw_get_stats(ff_zwriter_t *pxWriter, ff_zs_stats_t *pxStats) {
+    *pxStats = pxWriter->xStats;
+    // Count the partly filled block as if it were written
+    if (prvHdr(pxWriter)->ulFrames) pxStats->ullCodedBytes += pxWriter->xBlockSize;
+}
+
+int ff_zw_close(ff_zwriter_t *pxWriter) {
+    int iResult = prvWriteBlock(pxWriter);
+    if (ff_fclose(pxWriter->pxFile)) iResult = -1;
+    vPortFree(pxWriter->plPrev);
+    vPortFree(pxWriter->pucBlock);
+    vPortFree(pxWriter);
+    return iResult;
+}
+
+ff_zreader_t *ff_zr_open(const char *pcPath) {
+    ff_zreader_t *pxReader = pvPortMalloc(sizeof(ff_zreader_t));
+    if (!pxReader) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        return NULL;
+    }
+    memset(pxReader, 0, sizeof *pxReader);
+    pxReader->ulBlock = UINT32_MAX;
+    pxReader->pxFile = ff_fopen(pcPath, "r");
+    if (!pxReader->pxFile) goto fail;
+    ff_zs_block_hdr_t xHdr;
+    if (ff_fread(&xHdr, sizeof xHdr, 1, pxReader->pxFile) != 1 ||
+        FF_ZS_BLOCK_MAGIC != xHdr.ulMagic || !xHdr.ulBlockSize || xHdr.ulBlockSize % 512 ||
+        !xHdr.usChannels) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        goto fail;
+    }
+    pxReader->usChannels = xHdr.usChannels;
+    pxReader->xBlockSize = xHdr.ulBlockSize;
+    pxReader->ulBlocks = ff_filelength(pxReader->pxFile) / pxReader->xBlockSize;
+    pxReader->pucBlock = pvPortMalloc(pxReader->xBlockSize);
+    pxReader->plPrev = pvPortMalloc(pxReader->usChannels * sizeof(int32_t));
+    if (!pxReader->pucBlock || !pxReader->plPrev) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_ENOMEM);
+        goto fail;
+    }
+    return pxReader;
+
+fail:
+    if (pxReader->pxFile) ff_fclose(pxReader->pxFile);
+    vPortFree(pxReader->plPrev);
+    vPortFree(pxReader->pucBlock);
+    vPortFree(pxReader);
+    return NULL;
+}
+
+uint16_t ff_zr_channels(ff_zreader_t *pxReader) {
+    return pxReader->usChannels;
+}
+
+void ff_zr_close(ff_zreader_t *pxReader) {
+    ff_fclose(pxReader->pxFile);
+    vPortFree(pxReader->plPrev);
+    vPortFree(pxReader->pucBlock);
+    vPortFree(pxReader);
+}
+
+static inline const ff_zs_block_hdr_t *prvReaderHdr(ff_zreader_t *pxReader) {
+    return (const ff_zs_block_hdr_t *)pxReader->pucBlock;
+}
+
+/* Read a whole block and position the decoder at its start */
+static int prvLoadBlock(ff_zreader_t *pxReader, uint32_t ulBlock) {
+    pxReader->ulBlock = UINT32_MAX;
+    if (ff_fseek(pxReader->pxFile, ulBlock * pxReader->xBlockSize, FF_SEEK_SET) ||
+        ff_fread_direct(pxReader->pucBlock, 1, pxReader->xBlockSize, pxReader->pxFile) !=
+            pxReader->xBlockSize)
+        return -1;
+    const ff_zs_block_hdr_t *pxHdr = prvReaderHdr(pxReader);
+    if (FF_ZS_BLOCK_MAGIC != pxHdr->ulMagic || ulBlock != pxHdr->ulBlock ||
+        sizeof(ff_zs_block_hdr_t) + pxHdr->ulBytes > pxReader->xBlockSize) {
+        stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+        return -1;
+    }
+    pxReader->ulBlock = ulBlock;
+    pxReader->xPos = sizeof(ff_zs_block_hdr_t);
+    pxReader->ulFrameInBlock = 0;
+    pxReader->ullNextFrame = pxHdr->ullFirstFrame;
+    memset(pxReader->plPrev, 0, pxReader->usChannels * sizeof(int32_t));
+    return 0;
+}
+
+/* Find the last block whose first frame is <= ullFrame, from the headers */
+static int prvFindBlock(ff_zreader_t *pxReader, uint64_t ullFrame, uint32_t *pulBlock) {
+    uint32_t ulLo = 0, ulHi = pxReader->ulBlocks;  // Answer is in [ulLo, ulHi)
+    while (ulHi - ulLo > 1) {
+        uint32_t ulMid = ulLo + (ulHi - ulLo) / 2;
+        ff_zs_block_hdr_t xHdr;
+        if (ff_fseek(pxReader->pxFile, ulMid * pxReader->xBlockSize, FF_SEEK_SET) ||
+            ff_fread(&xHdr, sizeof xHdr, 1, pxReader->pxFile) != 1)
+            return -1;
+        if (xHdr.ullFirstFrame <= ullFrame)
+            ulLo = ulMid;
+        else
+            ulHi = ulMid;
+    }
+    *pulBlock = ulLo;
+    return 0;
+}
+
+/* Decode the next frame of the loaded block into plFrame (which can be NULL) */
+static int prvDecode(ff_zreader_t *pxReader, int32_t *plFrame) {
+    const ff_zs_block_hdr_t *pxHdr = prvReaderHdr(pxReader);
+    const uint8_t *puc = pxReader->pucBlock + pxReader->xPos;
+    const uint8_t *pucEnd = pxReader->pucBlock + sizeof(ff_zs_block_hdr_t) + pxHdr->ulBytes;
+    for (size_t j = 0; j < pxReader->usChannels; ++j) {
+        uint32_t ul;
+        puc = prvGetVarint(puc, pucEnd, &ul);
+        if (!puc) {
+            stdioSET_ERRNO(pdFREERTOS_ERRNO_EINVAL);
+            return -1;
+        }
+        pxReader->plPrev[j] = (int32_t)((uint32_t)pxReader->plPrev[j] + (uint32_t)prvUnZigZag(ul));
+        if (plFrame) plFrame[j] = pxReader->plPrev[j];
+    }
+    pxReader->xPos = puc - pxReader->pucBlock;
+    ++pxReader->ulFrameInBlock;
+    ++pxReader->ullNextFrame;
+    return 0;
+}
+
+long ff_zr_read(ff_zreader_t *pxReader, uint64_t ullFrame, int32_t *plSamples, size_t xFrames) {
+    if (!pxReader->ulBlocks) return 0;
+    // Sequential reads carry on where the last one left off
+    const ff_zs_block_hdr_t *pxHdr = prvReaderHdr(pxReader);
+    if (UINT32_MAX == pxReader->ulBlock || ullFrame < pxReader->ullNextFrame ||
+        (ullFrame != pxReader->ullNextFrame &&
+         ullFrame >= pxHdr->ullFirstFrame + pxHdr->ulFrames)) {
+        uint32_t ulBlock;
+        if (-1 == prvFindBlock(pxReader, ullFrame, &ulBlock)) return -1;
+        if (-1 == prvLoadBlock(pxReader, ulBlock)) return -1;
+    }
+    // Skip to the requested frame
+    while (pxReader->ullNextFrame < ullFrame &&
+           pxReader->ulFrameInBlock < prvReaderHdr(pxReader)->ulFrames)
+        if (-1 == prvDecode(pxReader, NULL)) return -1;
+    if (pxReader->ullNextFrame != ullFrame) return 0;  // Past the end
+
+    long lRead = 0;
+    while ((size_t)lRead < xFrames) {
+        if (pxReader->ulFrameInBlock == prvReaderHdr(pxReader)->ulFrames) {
+            if (pxReader->ulBlock + 1 >= pxReader->ulBlocks) break;
+            if (-1 == prvLoadBlock(pxReader, pxReader->ulBlock + 1)) return -1;
+            if (!prvReaderHdr(pxReader)->ulFrames) break;
+        }
+        if (-1 == prvDecode(pxReader, plSamples + lRead * pxReader->usChannels)) return -1;
+        ++lRead;
+    }
+    return lRead;
+}
+
+/* [] END OF FILE */
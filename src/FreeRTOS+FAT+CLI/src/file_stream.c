@@ -14,12 +14,15 @@
 #include "ff_stdio.h"
 //
 #include "FreeRTOS_strerror.h"
+#include "ff_direct.h"
+#include "ff_extents.h"
 #include "my_debug.h"
 //
 #include "file_stream.h"
 
 typedef struct {
     FF_FILE *ff_file;
+    char *buf;  // Stream buffer: a multiple of the sector size
 } cookie_t;
 
 //functions.read should return -1 on failure, or else the number of bytes read (0 on EOF).
@@ -31,7 +34,7 @@ static ssize_t cookie_read_function(void *vcookie_p, char *buf, size_t n) {
     size_t xItems = n;
     FF_FILE *pxStream = cookie_p->ff_file;
     stdioSET_ERRNO(0);
-    size_t nr = ff_fread(pvBuffer, xSize, xItems, pxStream);
+    size_t nr = ff_fread_direct(pvBuffer, xSize, xItems, pxStream);
     int error = stdioGET_ERRNO();
     if (error) {
         DBG_PRINTF("%s: %s: %s: %s (%d)\n", pcTaskGetName(NULL), __func__, "ff_fread",
@@ -48,7 +51,7 @@ static ssize_t cookie_write_function(void *vcookie_p, const char *buf, size_t n)
     size_t xSize = 1;
     size_t xItems = n;
     FF_FILE * pxStream = cookie_p->ff_file;
-    size_t nw = ff_fwrite(pvBuffer, xSize, xItems, pxStream);
+    size_t nw = ff_fwrite_direct(pvBuffer, xSize, xItems, pxStream);
     // If the number of items written to the file is less than the xItems value
     // then the task's errno is set to indicate the reason.
     if (nw < xItems) {
@@ -82,7 +85,7 @@ static int cookie_seek_function(void *vcookie_p, off_t *off, int whence) {
             ASSERT_CASE_NOT(whence);
     }
     cookie_t *cookie_p = vcookie_p;
-    int err = ff_fseek(cookie_p->ff_file, *off, ff_whence);
+    int err = ff_extents_fseek(cookie_p->ff_file, *off, ff_whence);
     if (!err)
         *off = ff_ftell(cookie_p->ff_file);
     return err;
@@ -94,7 +97,9 @@ static int cookie_seek_function(void *vcookie_p, off_t *off, int whence) {
 static int cookie_close_function(void *vcookie_p) {
     cookie_t *cookie_p = vcookie_p;
     FF_FILE *pxStream = cookie_p->ff_file;
-    vPortFree(cookie_p);
+    if (cookie_p->buf) vPortFree(cookie_p->buf);
+    ffconfigFREE(cookie_p);
+    ff_extents_detach(pxStream);
     return ff_fclose(pxStream);
 }
 
@@ -102,12 +107,14 @@ FILE *open_file_stream( const char *pcFile, const char *pcMode ) {
     FF_FILE *f = ff_fopen(pcFile, pcMode);
     if (!f) return NULL;
 
-    cookie_t *cookie_p = pvPortMalloc(sizeof(cookie_t));
+    cookie_t *cookie_p = ffconfigMALLOC(sizeof(cookie_t));
     if (!cookie_p) {
         ff_fclose(f);
         return NULL;
     }
     cookie_p->ff_file = f;
+    cookie_p->buf = NULL;
+    ff_extents_attach(f);  // Not fatal if there is no map available
 
     cookie_io_functions_t iofs = {
             cookie_read_function,
@@ -118,6 +125,19 @@ FILE *open_file_stream( const char *pcFile, const char *pcMode ) {
 
     /* create the stream */
     FILE *file = fopencookie(cookie_p, pcMode, iofs);
-    if (!file) cookie_close_function(cookie_p);
-    return (file);
+    if (!file) {
+        cookie_close_function(cookie_p);
+        return NULL;
+    }
+    /* Replace the standard I/O library's BUFSIZ buffer with a whole number of sectors.
+    When the buffer fills, it goes to the file as whole sectors, which
+    ff_fwrite_direct can send straight to the SD card. Writes at least as large as the buffer
+    bypass it. 8-byte allocation alignment is good enough for DMA.
+    It comes from the FreeRTOS heap rather than ffconfigMALLOC: with FF_USE_POOL,
+    a buffer this big would land in the arena, which only gives space back in LIFO order,
+    and streams are closed in any order. */
+    cookie_p->buf = pvPortMalloc(FILE_STREAM_BUFFER_SIZE);
+    if (cookie_p->buf)
+        setvbuf(file, cookie_p->buf, _IOFBF, FILE_STREAM_BUFFER_SIZE);
+    return file;
 }